@@ -0,0 +1,197 @@
+/*
+ * baseline.cpp
+ */
+
+#include "baseline.hpp"
+#include "benchmark.hpp"
+#include "context.hpp"
+#include "util.hpp"
+#include "version.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+
+#include <sys/utsname.h>
+
+using namespace std;
+
+/*
+ * The baseline file is plain text with tab-separated fields, one entry per line:
+ *
+ *   machine <key> <value>
+ *   result <key> <value> <noise>
+ *
+ * Lines starting with '#' are comments.
+ */
+
+constexpr double BaselineComparison::MIN_THRESHOLD;
+
+Baseline Baseline::load(const std::string& filename) {
+    std::ifstream in(filename);
+    if (!in) {
+        throw std::runtime_error("couldn't open baseline file " + filename + ": " + errno_to_str(errno));
+    }
+    Baseline baseline;
+    std::string line;
+    for (int lineno = 1; std::getline(in, line); lineno++) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        auto fields = split_on_string(line, "\t");
+        if (fields.size() == 3 && fields[0] == "machine") {
+            baseline.machine.emplace_back(fields[1], fields[2]);
+        } else if (fields.size() == 4 && fields[0] == "result") {
+            try {
+                baseline.results[fields[1]] = Entry{std::stod(fields[2]), std::stod(fields[3])};
+            } catch (std::logic_error&) {
+                throw std::runtime_error(string_format("bad number in baseline file %s at line %d", filename.c_str(), lineno));
+            }
+        } else {
+            throw std::runtime_error(string_format("unexpected line in baseline file %s at line %d", filename.c_str(), lineno));
+        }
+    }
+    return baseline;
+}
+
+void Baseline::save(const std::string& filename) const {
+    std::ofstream out(filename);
+    out << "# uarch-bench baseline (" << GIT_VERSION << ")" << endl;
+    for (auto& m : machine) {
+        out << "machine\t" << m.first << "\t" << m.second << endl;
+    }
+    for (auto& r : results) {
+        out << "result\t" << r.first << "\t" << string_format("%.10g\t%.6g", r.second.value, r.second.noise) << endl;
+    }
+    if (!out) {
+        throw std::runtime_error("couldn't write baseline file " + filename);
+    }
+}
+
+std::string Baseline::machineValue(const std::string& key) const {
+    for (auto& m : machine) {
+        if (m.first == key) {
+            return m.second;
+        }
+    }
+    return "";
+}
+
+BaselineComparison::BaselineComparison(const Baseline::Entry& baseline, const Baseline::Entry& current) :
+    change{(current.value - baseline.value) / baseline.value},
+    // a shift of the minimum by more than the distance from the minimum to the median in either run is
+    // unlikely to be noise
+    threshold{std::max(MIN_THRESHOLD, std::max(baseline.noise, current.noise))} {}
+
+std::string baseline_key(const ResultRecord& record) {
+    auto threads = std::find_if(record.attrs.begin(), record.attrs.end(),
+            [](const attr_list::value_type& attr){ return attr.first == "threads"; });
+    bool combined = threads != record.attrs.end();
+    if (!combined && record.name != record.bench->getDescription()) {
+        return "";
+    }
+    std::string key = record.bench->getPath();
+    if (combined) {
+        key += ":threads=" + threads->second;
+    }
+    for (auto& column : record.columns) {
+        if (column.first != "samples") {
+            key += ":" + column.second;
+        }
+    }
+    return key;
+}
+
+attr_list get_machine_info(const std::string& timer_name) {
+    struct utsname uts;
+    std::string kernel = uname(&uts) == 0 ? std::string(uts.release) + " " + uts.version : "unknown";
+    return {
+        {"cpu", cpuinfo_value("model name")},
+        {"microcode", cpuinfo_value("microcode")},
+        {"kernel", kernel},
+        {"timer", timer_name},
+    };
+}
+
+BaselineSink::BaselineSink(std::unique_ptr<ResultSink> inner, std::string save_file, std::string compare_file) :
+    inner_{std::move(inner)}, save_file_{std::move(save_file)}, compare_file_{std::move(compare_file)}
+{
+    if (!compare_file_.empty()) {
+        compare_ = Baseline::load(compare_file_);
+    }
+}
+
+void BaselineSink::result(Context& c, const ResultRecord& record) {
+    std::string key = baseline_key(record);
+    if (key.empty() || record.values.empty()) {
+        inner_->result(c, record);
+        return;
+    }
+
+    Baseline::Entry current{record.values.front(), record.noise};
+    if (!save_file_.empty()) {
+        saved_.results[key] = current;
+    }
+    if (compare_file_.empty()) {
+        inner_->result(c, record);
+        return;
+    }
+
+    auto found = compare_.results.find(key);
+    if (found == compare_.results.end()) {
+        missing_++;
+        inner_->result(c, record);
+        return;
+    }
+
+    const Baseline::Entry& baseline = found->second;
+    if (!(baseline.value > 0)) {
+        // a relative change from a zero or negative result isn't meaningful
+        inner_->result(c, record);
+        return;
+    }
+
+    BaselineComparison cmp(baseline, current);
+    compared_++;
+    const char* verdict = cmp.slower() ? "slower" : cmp.faster() ? "faster" : "same";
+    slower_ += cmp.slower();
+    faster_ += cmp.faster();
+
+    ResultRecord annotated(record);
+    annotated.attrs.emplace_back("baseline", string_format("%.10g", baseline.value));
+    annotated.attrs.emplace_back("baseline_change", string_format("%.4f", cmp.change));
+    annotated.attrs.emplace_back("baseline_threshold", string_format("%.4f", cmp.threshold));
+    annotated.attrs.emplace_back("baseline_verdict", verdict);
+    inner_->result(c, annotated);
+
+    if (inner_->isText() && (cmp.slower() || cmp.faster())) {
+        int precision = c.getPrecision();
+        c.out() << string_format("%*s^ %s than baseline: %.*f vs %.*f %s (%+.1f%%, threshold %.1f%%)",
+                DESC_WIDTH, "", verdict, precision, current.value, precision, baseline.value,
+                c.getTimerInfo().getMetricNames().at(0).c_str(), 100 * cmp.change, 100 * cmp.threshold) << endl;
+    }
+}
+
+void BaselineSink::finish(Context& c) {
+    inner_->finish(c);
+    attr_list machine = get_machine_info(c.getTimerName());
+
+    if (!compare_file_.empty()) {
+        for (auto& m : machine) {
+            std::string old = compare_.machineValue(m.first);
+            if (old != m.second) {
+                c.log() << "NOTE: " << m.first << " differs from baseline: was '" << old << "', now '" << m.second << "'" << endl;
+            }
+        }
+        c.log() << "Compared " << compared_ << " results against baseline " << compare_file_ << ": "
+                << slower_ << " slower, " << faster_ << " faster, " << missing_ << " not in baseline" << endl;
+    }
+
+    if (!save_file_.empty()) {
+        saved_.machine = machine;
+        saved_.save(save_file_);
+        c.log() << "Saved " << saved_.results.size() << " results to baseline " << save_file_ << endl;
+    }
+}
@@ -0,0 +1,109 @@
+/*
+ * baseline.hpp
+ *
+ * Support for --save-baseline and --compare-baseline: the results of a run can be saved to a file, along
+ * with some information about the machine, and a later run can be compared against it to flag benchmarks
+ * whose results moved by more than their noise would explain, e.g., to qualify a kernel or microcode update.
+ */
+
+#ifndef BASELINE_HPP_
+#define BASELINE_HPP_
+
+#include <map>
+#include <memory>
+#include <string>
+
+#include "result-sink.hpp"
+
+/**
+ * The saved results of an earlier run: the machine info and, for each result, the value of the first metric
+ * and its relative noise.
+ */
+struct Baseline {
+    struct Entry {
+        double value, noise;
+    };
+
+    attr_list machine;
+    std::map<std::string, Entry> results;
+
+    /* load a baseline from the given file, throws std::runtime_error if it can't be read or parsed */
+    static Baseline load(const std::string& filename);
+
+    /* save this baseline to the given file, throws std::runtime_error on failure */
+    void save(const std::string& filename) const;
+
+    /* return the value of the machine attribute with the given key, or the empty string if there isn't one */
+    std::string machineValue(const std::string& key) const;
+};
+
+/**
+ * The outcome of comparing one result against its baseline.
+ */
+struct BaselineComparison {
+    /* the minimum threshold, so that very quiet benchmarks aren't flagged for tiny changes */
+    static constexpr double MIN_THRESHOLD = 0.01;
+
+    /* relative change from the baseline, positive if the result is now larger (slower) */
+    double change;
+    /* the change above which this result is flagged, derived from the noise in both runs */
+    double threshold;
+
+    BaselineComparison(const Baseline::Entry& baseline, const Baseline::Entry& current);
+
+    bool slower() const { return change >  threshold; }
+    bool faster() const { return change < -threshold; }
+};
+
+/**
+ * The key identifying a result in the baseline, based on the benchmark path, the threads attribute of the
+ * combined results of threaded benchmarks and any text columns (e.g., the oneshot sample number), or the
+ * empty string for results which aren't saved (e.g., --stats=full rows and per-thread results), which are
+ * those whose name isn't the benchmark description and which aren't combined results.
+ */
+std::string baseline_key(const ResultRecord& record);
+
+/**
+ * Information about the current machine which is saved along with the baseline: CPU model, microcode and
+ * kernel version, and the given timer name.
+ */
+attr_list get_machine_info(const std::string& timer_name);
+
+/**
+ * A sink which passes everything through to another sink, while recording results to save as a baseline
+ * and/or comparing them against an earlier baseline. Results that moved by more than the threshold
+ * are flagged: the structured formats get baseline attributes on each compared result, and the text
+ * format gets an extra line after each flagged result.
+ */
+class BaselineSink : public ResultSink {
+    std::unique_ptr<ResultSink> inner_;
+    std::string save_file_, compare_file_;
+    Baseline saved_, compare_;
+    size_t compared_ = 0, slower_ = 0, faster_ = 0, missing_ = 0;
+
+public:
+    /* either filename may be empty, throws std::runtime_error if compare_file can't be loaded */
+    BaselineSink(std::unique_ptr<ResultSink> inner, std::string save_file, std::string compare_file);
+
+    virtual bool isText() const override { return inner_->isText(); }
+
+    virtual void groupStart(Context& c, BenchmarkGroup& group) override { inner_->groupStart(c, group); }
+
+    virtual void groupEnd(Context& c, BenchmarkGroup& group, int64_t elapsed_ms) override {
+        inner_->groupEnd(c, group, elapsed_ms);
+    }
+
+    virtual void result(Context& c, const ResultRecord& record) override;
+
+    virtual void histogram(Context& c, const BenchmarkBase& bench, const std::string& metric, const Stats::Histogram& histogram) override {
+        inner_->histogram(c, bench, metric, histogram);
+    }
+
+    virtual void skipped(Context& c, const BenchmarkBase& bench, const std::string& reason) override {
+        inner_->skipped(c, bench, reason);
+    }
+
+    virtual void finish(Context& c) override;
+};
+
+#endif /* BASELINE_HPP_ */
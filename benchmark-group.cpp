@@ -6,11 +6,21 @@
 #include "benchmark.hpp"
 #include "table.hpp"
 #include "simple-timer.hpp"
+#include "result-sink.hpp"
 
 using namespace std;
 
 using namespace table;
 
+static std::function<bool(const std::string&)> group_filter;
+
+void set_group_filter(std::function<bool(const std::string& id)> filter) {
+    group_filter = std::move(filter);
+}
+
+bool group_filter_accepts(const std::string& id) {
+    return !group_filter || group_filter(id);
+}
 
 void BenchmarkGroup::runIf(Context &c, const predicate_t& predicate) {
     SimpleTimer timer;
@@ -18,15 +28,14 @@ void BenchmarkGroup::runIf(Context &c, const predicate_t& predicate) {
     for (auto& b : benches_) {
         if (predicate(b)) {
             if (!header) {
-                c.out() << std::endl << "** Running group " << getId() << " : " << getDescription() << " **" << std::endl;
-                printGroupHeader(c);
+                c.getSink().groupStart(c, *this);
                 header = true;
             }
             b->runAndPrint(c);
         }
     }
     if (header) {
-        c.out() << "Finished in " << timer.elapsed<std::chrono::milliseconds>() << " ms (" << getId() << ")" << endl;
+        c.getSink().groupEnd(c, *this, timer.elapsed<std::chrono::milliseconds>());
     }
 }
 
@@ -2,10 +2,18 @@
  * benchmark.cpp
  */
 #include "benchmark.hpp"
+#include "derived-metrics.hpp"
+#include "freq-monitor.hpp"
 #include "isa-support.hpp"
 #include "opt-control.hpp"
+#include "result-sink.hpp"
+#include "stats.hpp"
 
+#include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <sstream>
+#include <stdexcept>
 
 
 using namespace std;
@@ -16,14 +24,16 @@ BenchArgs::BenchArgs(
             const std::string& description,
             taglist_t tags,
             featurelist_t features,
-            uint32_t ops_per_loop
+            uint32_t ops_per_loop,
+            uint32_t loop_count
             ) :
     parent{parent},
     id{id},
     description{description},
     tags{tags},
     features{features},
-    ops_per_loop{ops_per_loop}
+    ops_per_loop{ops_per_loop},
+    loop_count{loop_count}
     {}
 
 arg_provider_t constant(void *value) {
@@ -32,6 +42,8 @@ arg_provider_t constant(void *value) {
 
 const arg_provider_t null_provider = constant(nullptr);
 
+unsigned timer_config_epoch = 0;
+
 void printBenchName(Context& c, const std::string& name) {
     c.out() << setprecision(c.getPrecision()) << fixed << setw(DESC_WIDTH) << name;
 }
@@ -41,34 +53,301 @@ void printBenchName(Context& c, const Benchmark& b) {
 }
 
 void printResultLine(Context& c, const Benchmark& b, const TimingResult& result) {
-    std::ostream& os = c.out();
-    printBenchName(c, b);
-    printAlignedMetrics(c, result.getResults());
-    os << endl;
+    c.getSink().result(c, ResultRecord{b, b->getDescription(), {}, {}, result.getResults()});
+}
+
+void printSampledResult(Context& c, const Benchmark& b, const TimingResult& result,
+        const std::vector<TimingResult>& samples, size_t samples_taken) {
+    ResultRecord record{b, b->getDescription(), {}, {}, result.getResults(), relative_noise(samples)};
+    addSampleCount(c, record, samples_taken);
+    if (c.fullStats()) {
+        // the aggregated result is the minimum, which distinguishes it from the other statistics
+        record.attrs.emplace_back("stat", "min");
+    }
+    c.getSink().result(c, record);
+    if (c.fullStats()) {
+        printDistribution(c, b, samples, samples_taken);
+    }
+}
+
+double relative_noise(const std::vector<TimingResult>& samples) {
+    if (samples.empty()) {
+        return 0;
+    }
+    std::vector<double> values;
+    for (auto& sample : samples) {
+        values.push_back(sample.getCycles());
+    }
+    std::sort(values.begin(), values.end());
+    double min = values.front();
+    return min > 0 ? (Stats::percentile_sorted(values, 50) - min) / min : 0;
+}
+
+std::vector<std::pair<std::string, TimingResult>> distribution(const TimerInfo& ti, const std::vector<TimingResult>& samples) {
+    assert(!samples.empty());
+    const std::vector<std::string> names{"min", "p10", "p50", "p90", "max", "stddev"};
+    std::vector<std::vector<double>> sample_values;
+    for (auto& sample : samples) {
+        sample_values.push_back(sample.getResults());
+        append_derived_metrics(ti, sample_values.back());
+    }
+    size_t metric_count = sample_values.front().size();
+    std::vector<std::vector<double>> stats(names.size(), std::vector<double>(metric_count));
+    for (size_t m = 0; m < metric_count; m++) {
+        std::vector<double> values;
+        for (auto& sample : sample_values) {
+            values.push_back(sample.at(m));
+        }
+        std::sort(values.begin(), values.end());
+        stats[0][m] = values.front();
+        stats[1][m] = Stats::percentile_sorted(values, 10);
+        stats[2][m] = Stats::percentile_sorted(values, 50);
+        stats[3][m] = Stats::percentile_sorted(values, 90);
+        stats[4][m] = values.back();
+        stats[5][m] = Stats::stddev(values.begin(), values.end());
+    }
+    std::vector<std::pair<std::string, TimingResult>> ret;
+    for (size_t i = 0; i < names.size(); i++) {
+        ret.emplace_back(names[i], TimingResult(stats[i]));
+    }
+    return ret;
+}
+
+void printDistribution(Context& c, const Benchmark& b, const std::vector<TimingResult>& samples, size_t samples_taken) {
+    for (auto& stat : distribution(c.getTimerInfo(), samples)) {
+        if (stat.first == "min") {
+            continue;
+        }
+        ResultRecord record{b, stat.first, {}, {{"stat", stat.first}}, stat.second.getResults()};
+        addSampleCount(c, record, samples_taken);
+        c.getSink().result(c, record);
+    }
+    printHistogram(c, b, samples);
+}
+
+void printHistogram(Context& c, const Benchmark& b, const std::vector<TimingResult>& samples) {
+    if (c.getHistogramBuckets()) {
+        std::vector<double> values;
+        for (auto& sample : samples) {
+            values.push_back(sample.getCycles());
+        }
+        auto histogram = Stats::make_histogram(values.begin(), values.end(), c.getHistogramBuckets());
+        c.getSink().histogram(c, *b, c.getTimerInfo().getMetricNames().at(0), histogram);
+    }
+}
+
+void addSampleCount(Context& c, ResultRecord& record, size_t samples) {
+    auto& list = c.getSampleConfig().isAdaptive() ? record.columns : record.attrs;
+    list.emplace_back("samples", std::to_string(samples));
 }
 
 void printNameHeader(Context& c) {
     c.out() << setw(DESC_WIDTH) << "Benchmark";
 }
 
-void printResultHeader(Context& c) {
-    // "Benchmark", "Cycles", "Nanos"
+void printResultHeader(Context& c, bool samples) {
+    // "Benchmark", ["Samples"], "Cycles", "Nanos"
     printNameHeader(c);
+    if (samples) {
+        printOneMetric(c, "Samples");
+    }
     printAlignedMetrics(c, c.getTimerInfo().getMetricNames());
     c.out() << endl;
 }
 
 BenchmarkBase::BenchmarkBase(BenchArgs args) : args{std::move(args)} {}
 
+/**
+ * Captures everything a benchmark reports, along with any text written to the context output in between, so
+ * that the runs for all event batches can be merged, or a run can be discarded and repeated.
+ */
+class CaptureSink : public ResultSink {
+public:
+    struct Entry {
+        enum Type { TEXT, RESULT, HISTOGRAM } type;
+        /* the text, or the metric for a histogram */
+        std::string str;
+        /* the result, or just the benchmark for a histogram */
+        ResultRecord record;
+        Stats::Histogram histogram;
+    };
+
+    std::vector<Entry> entries;
+
+    CaptureSink(bool is_text, std::ostringstream& text) : is_text_{is_text}, text_(text) {}
+
+    /* capture any pending text, must be called before every other entry so that the order is kept */
+    void flushText() {
+        if (!text_.str().empty()) {
+            entries.push_back(Entry{Entry::TEXT, text_.str(), {}, {}});
+            text_.str("");
+        }
+    }
+
+    virtual bool isText() const override { return is_text_; }
+
+    virtual void result(Context& c, const ResultRecord& record) override {
+        flushText();
+        entries.push_back(Entry{Entry::RESULT, {}, record, {}});
+    }
+
+    virtual void histogram(Context& c, const BenchmarkBase& bench, const std::string& metric, const Stats::Histogram& histogram) override {
+        flushText();
+        ResultRecord record{};
+        record.bench = &bench;
+        entries.push_back(Entry{Entry::HISTOGRAM, metric, record, histogram});
+    }
+
+    virtual void skipped(Context& c, const BenchmarkBase& bench, const std::string& reason) override {
+        throw std::logic_error("benchmarks should be skipped before their output is captured");
+    }
+
+private:
+    bool is_text_;
+    std::ostringstream& text_;
+};
+
+using captured_t = std::vector<CaptureSink::Entry>;
+
+/* call f with the context output and results captured, returning everything captured */
+template <typename F>
+static captured_t capture(Context& c, F f) {
+    std::ostringstream text;
+    CaptureSink* capture_sink = new CaptureSink(c.getSink().isText(), text);
+    std::ostream* out = &c.out();
+    auto sink = c.redirect(&text, std::unique_ptr<ResultSink>(capture_sink));
+    try {
+        f();
+    } catch (...) {
+        c.redirect(out, std::move(sink));
+        throw;
+    }
+    capture_sink->flushText();
+    captured_t entries = std::move(capture_sink->entries);
+    c.redirect(out, std::move(sink));
+    return entries;
+}
+
+/* report the captured output to the context */
+static void replay(Context& c, const captured_t& entries) {
+    ResultSink& sink = c.getSink();
+    for (auto& e : entries) {
+        switch (e.type) {
+        case CaptureSink::Entry::TEXT:
+            c.out() << e.str;
+            break;
+        case CaptureSink::Entry::RESULT:
+            sink.result(c, e.record);
+            break;
+        case CaptureSink::Entry::HISTOGRAM:
+            sink.histogram(c, *e.record.bench, e.str, e.histogram);
+            break;
+        }
+    }
+}
+
+/* run the benchmark once per event batch and report the merged results */
+static void run_batched(Context& c, BenchmarkBase& bench) {
+    TimerInfo& ti = c.getTimerInfo();
+    std::vector<captured_t> batches;
+    for (size_t b = 0; b < ti.batchCount(); b++) {
+        ti.selectBatch(c, b);
+        timer_config_epoch++;
+        try {
+            batches.push_back(capture(c, [&]{ bench.runAndPrintInner(c); }));
+        } catch (...) {
+            ti.selectBatch(c, 0);
+            timer_config_epoch++;
+            throw;
+        }
+    }
+    ti.selectBatch(c, 0);
+    timer_config_epoch++;
+
+    // the output of the first batch is used as-is, except that the results get the metrics from the other
+    // batches, matched up by their order
+    std::vector<ResultRecord*> merged;
+    for (auto& e : batches[0]) {
+        if (e.type == CaptureSink::Entry::RESULT) {
+            merged.push_back(&e.record);
+        }
+    }
+    double max_diff = 0;
+    for (size_t b = 1; b < batches.size(); b++) {
+        size_t i = 0;
+        for (auto& e : batches[b]) {
+            if (e.type != CaptureSink::Entry::RESULT || i == merged.size()) {
+                continue;
+            }
+            auto& into = merged[i++]->values;
+            auto& from = e.record.values;
+            for (size_t m = 0; m < into.size() && m < from.size(); m++) {
+                if (std::isnan(into[m])) {
+                    into[m] = from[m];
+                }
+            }
+            if (!into.empty() && !from.empty() && into[0] > 0) {
+                max_diff = std::max(max_diff, std::abs(from[0] - into[0]) / into[0]);
+            }
+        }
+    }
+    replay(c, batches[0]);
+
+    if (max_diff > 0.1) {
+        c.err() << "WARNING: " << ti.getMetricNames().at(0) << " differed by up to " << (int)(max_diff * 100)
+                << "% between the event batches for " << bench.getPath() << ", so its events may not be comparable" << endl;
+    }
+}
+
+/* run the benchmark, once per event batch if the timer has more than one */
+static void run_once(Context& c, BenchmarkBase& bench) {
+    if (c.getTimerInfo().batchCount() > 1) {
+        run_batched(c, bench);
+    } else {
+        bench.runAndPrintInner(c);
+    }
+}
+
+/*
+ * Run the benchmark while the frequency monitor counts, and flag it if the effective frequency differed from
+ * the one the timer converts with. The output is captured so that a flagged run can be discarded and repeated,
+ * up to --freq-reruns times. The effective frequency is added to the results as the ghz attribute.
+ */
+static void run_checked(Context& c, BenchmarkBase& bench, FreqMonitor& monitor) {
+    double calibrated = c.getTimerInfo().calibratedGHz();
+    for (unsigned run = 0; ; run++) {
+        monitor.start();
+        captured_t entries = capture(c, [&]{ run_once(c, bench); });
+        double ghz = monitor.stop();
+        double diff = std::abs(ghz - calibrated) / calibrated;
+        bool flagged = ghz > 0 && diff > c.getFreqTolerance();
+        if (flagged && run < c.getFreqReruns()) {
+            c.log() << string_format("Effective frequency was %.3f GHz rather than %.3f GHz, rerunning %s",
+                    ghz, calibrated, bench.getPath().c_str()) << endl;
+            continue;
+        }
+        for (auto& e : entries) {
+            if (e.type == CaptureSink::Entry::RESULT) {
+                e.record.attrs.emplace_back("ghz", string_format("%.3f", ghz));
+            }
+        }
+        replay(c, entries);
+        if (flagged) {
+            c.err() << string_format("WARNING: the effective frequency was %.3f GHz during %s, %.0f%% off the calibrated"
+                    " %.3f GHz, so its cycle counts are wrong", ghz, bench.getPath().c_str(), diff * 100, calibrated) << endl;
+        }
+        return;
+    }
+}
+
 void BenchmarkBase::runAndPrint(Context& c) {
     if (!supports(args.features)) {
         // can't run this test on this hardware
-        printBenchName(c, this);
-        printOneMetric(c, std::string("Skipped because hardware doesn't support required features: ") +
-                container_to_string(args.features));
-        c.out() << endl;
+        c.getSink().skipped(c, *this, "hardware doesn't support required features: " + container_to_string(args.features));
+    } else if (FreqMonitor* monitor = c.getFreqMonitor()) {
+        run_checked(c, *this, *monitor);
     } else {
-        runAndPrintInner(c);
+        run_once(c, *this);
     }
 }
 
@@ -13,6 +13,7 @@
 #include <vector>
 #include <memory>
 #include <cassert>
+#include <cmath>
 
 #include "hedley.h"
 
@@ -21,6 +22,7 @@
 #include "timers.hpp"
 #include "context.hpp"
 #include "isa-support.hpp"
+#include "params.hpp"
 
 #if defined(__GNUC__) && !defined(__clang__)
 #define NO_STACK_PROTECTOR __attribute__((optimize("no-stack-protector")))
@@ -81,6 +83,7 @@ inline long inlined_empty(uint64_t iters, void *arg) {
 }
 
 class BenchmarkGroup;
+struct ResultRecord;
 
 typedef std::string tag_t;
 typedef std::vector<tag_t>      taglist_t;
@@ -94,6 +97,8 @@ struct BenchArgs {
     featurelist_t features;
     /* how many operations are involved in one iteration of the benchmark loop */
     uint32_t ops_per_loop;
+    /* the number of iterations of the benchmark loop */
+    uint32_t loop_count;
 
     BenchArgs(
             const BenchmarkGroup* parent,
@@ -101,7 +106,8 @@ struct BenchArgs {
             const std::string& description,
             taglist_t tags,
             featurelist_t features,
-            uint32_t ops_per_loop
+            uint32_t ops_per_loop,
+            uint32_t loop_count
             );
 };
 
@@ -131,8 +137,9 @@ static void printAlignedMetrics(Context &c, const std::vector<T>& metrics) {
 void printNameHeader(Context& c);
 /**
  * Print the entire header: name metric1 metric2 ... for the TimerInfo associated with the given context.
+ * If samples is true, a Samples column is included before the metrics.
  */
-void printResultHeader(Context& c);
+void printResultHeader(Context& c, bool samples = false);
 
 class BenchmarkBase {
 protected:
@@ -162,18 +169,26 @@ public:
     /** the unique group to which this */
     const BenchmarkGroup& getGroup() const { return *args.parent; }
 
-    /* Run the benchmark and return the normalized TimingResult.
+    /** the number of operations in one iteration of the benchmark loop, used to normalize results */
+    uint32_t getOpsPerLoop() const { return args.ops_per_loop; }
+
+    /** the number of iterations of the benchmark loop */
+    uint32_t getLoopCount() const { return args.loop_count; }
+
+    /* Run the benchmark and return the normalized TimingResult, using the timer and sampling configuration
+     * from the given context.
      *
      * Some flavors of benchmark may not implement this and will throw an exception, e.g., those
      * that don't have a meaningful aggregated single result.
      */
-    virtual TimingResult run(const TimerInfo& ti) = 0;
+    virtual TimingResult run(Context& c) = 0;
 
     /* Print the results to context - every benchmark should implement this */
     virtual void runAndPrintInner(Context& c) = 0;
 
     /* Print the results to context - does some generic logic such as checking if the ISA is supported
-     * and then defers to runAndPrintInner which is implemented by the Benchmark class */
+     * and then defers to runAndPrintInner which is implemented by the Benchmark class, once per event
+     * batch if the timer has more than one (see TimerInfo::batchCount) */
     void runAndPrint(Context& c);
 
     /* the full "path" of the benchmark, which is the group id and the benchmark id, like group-name/bench-name */
@@ -201,6 +216,54 @@ inline predicate_t pred_and(const predicate_t& left, const predicate_t& right) {
 void printBenchName(Context& c, const std::string& name);
 void printBenchName(Context& c, const Benchmark& b);
 void printResultLine(Context& c, const Benchmark& b, const TimingResult& result);
+/**
+ * Report the aggregated result of a benchmark along with what can be derived from its individual per-sample
+ * results: the number of samples taken, the noise estimate used for baseline comparisons and, with --stats=full,
+ * the distribution.
+ */
+void printSampledResult(Context& c, const Benchmark& b, const TimingResult& result,
+        const std::vector<TimingResult>& samples, size_t samples_taken);
+
+/**
+ * An estimate of the noise in the aggregated (minimum) result based on the per-sample results: the relative
+ * distance between the min and median of the first metric, (p50 - min) / min, or 0 if it can't be determined.
+ */
+double relative_noise(const std::vector<TimingResult>& samples);
+
+/**
+ * The distribution of the given per-sample results: the min, p10, p50, p90, max and stddev of each metric,
+ * returned as (statistic name, result) pairs in that order. The timer's derived metrics are computed for each
+ * sample first, so the results have every metric and their derived values are, e.g., the median IPC rather
+ * than the ratio of the median instructions and cycles.
+ */
+std::vector<std::pair<std::string, TimingResult>> distribution(const TimerInfo& ti, const std::vector<TimingResult>& samples);
+
+/**
+ * Report the distribution of the given per-sample results with one row per statistic, except the min which is
+ * assumed to be the already reported main result, followed by a histogram if one was requested.
+ */
+void printDistribution(Context& c, const Benchmark& b, const std::vector<TimingResult>& samples, size_t samples_taken);
+
+/**
+ * Report a histogram of the first metric of the given per-sample results, if --histogram was specified.
+ */
+void printHistogram(Context& c, const Benchmark& b, const std::vector<TimingResult>& samples);
+
+/**
+ * Add the number of samples to the record: as a column when adaptive sampling is enabled (so it
+ * lines up with the Samples header column), otherwise only as an attribute for the structured formats.
+ */
+void addSampleCount(Context& c, ResultRecord& record, size_t samples);
+
+/**
+ * Set a filter on group IDs, which is applied as groups are created. Groups which the filter rejects stay empty:
+ * benchmarks added to them are discarded, and the makers don't create them in the first place, so the cost of
+ * creating the whole suite isn't paid when only a few benchmarks will run. By default every group is accepted.
+ */
+void set_group_filter(std::function<bool(const std::string& id)> filter);
+
+/* true if the current group filter accepts the given group ID */
+bool group_filter_accepts(const std::string& id);
 
 /**
  * Interface for a group of benchmarks. The group itself has a name, and can run and output all the contained
@@ -212,9 +275,13 @@ class BenchmarkGroup {
     /* human friendly plain text description, may have spaces and other command-line unfriendly chars */
     std::string desc;
     std::vector<Benchmark> benches_;
+    /* tags which apply to the group as a whole, rather than individual benchmarks */
+    taglist_t tags_;
+    /* false if the group filter rejected this group */
+    bool selected_;
 
 public:
-    BenchmarkGroup(const std::string& id, const std::string& desc) : id{id}, desc{desc} {}
+    BenchmarkGroup(const std::string& id, const std::string& desc) : id{id}, desc{desc}, selected_{group_filter_accepts(id)} {}
 
     virtual ~BenchmarkGroup() {}
 
@@ -229,6 +296,10 @@ public:
 
     void add(const Benchmark &bench) {
         assert(&bench->getGroup() == this);
+        if (!selected_) {
+            delete bench;
+            return;
+        }
         if (std::find_if(benches_.begin(), benches_.end(),
                          [&bench](const Benchmark& o) { return bench->getId() == o->getId(); }) != benches_.end()) {
             // duplicate ID
@@ -245,7 +316,7 @@ public:
      * Print the header for the tests in this group - override it if you don't use the default layout.
      */
     virtual void printGroupHeader(Context& c) {
-        printResultHeader(c);
+        printResultHeader(c, c.getSampleConfig().isAdaptive());
     }
 
     const std::string& getDescription() const {
@@ -256,6 +327,33 @@ public:
         return id;
     }
 
+    /**
+     * Set the group tags. Currently the only group tag is "core-local", for groups that only exercise resources
+     * private to a core, such as decode or the execution ports, which may run alongside other groups with
+     * --parallel-groups.
+     */
+    void setTags(taglist_t tags) {
+        tags_ = std::move(tags);
+    }
+
+    const taglist_t& getTags() const {
+        return tags_;
+    }
+
+    /* false if the group filter rejected this group, in which case it has no benchmarks */
+    bool isSelected() const {
+        return selected_;
+    }
+
+    /**
+     * Declare a runtime parameter for this group, returning its values: the defaults unless the user overrode
+     * them with --param or --param-file. See params.hpp for the format of default_spec.
+     */
+    param_values param(const std::string& name, const std::string& description, const std::string& default_spec,
+            int64_t min = 0, int64_t max = PARAM_MAX) const {
+        return get_param(id, name, description, default_spec, min, max);
+    }
+
     /**
      * Print benchmark descriptions for the contained benchmarks to the given output stream.
      */
@@ -286,41 +384,63 @@ protected:
 
 protected:
 
-    raw_result get_raw() {
+    raw_result get_raw(const SampleConfig& config) {
         void *arg = arg_provider.make();
-        auto ret = raw_func(loop_count, arg);
+        auto ret = raw_func(loop_count, arg, config);
         arg_provider.free(arg);
         return ret;
     }
 
-    TimingResult handle_raw(const raw_result& raw, const TimerInfo& ti) {
-        TimingResult result = TIMER::to_result(static_cast<const TIMER &>(ti), ALGO::aggregate(raw));
+    TimingResult handle_delta(const typename TIMER::delta_t& delta, const TimerInfo& ti) {
+        TimingResult result = TIMER::to_result(static_cast<const TIMER &>(ti), delta);
         return normalize(result, BenchmarkBase::args, loop_count);
     }
 
+    TimingResult handle_raw(const raw_result& raw, const TimerInfo& ti) {
+        return handle_delta(ALGO::aggregate(raw), ti);
+    }
+
 public:
 
     BenchTemplate(BenchArgs args, size_t loop_count, raw_f raw_func, arg_provider_t arg_provider) : BenchmarkBase(std::move(args)),
     loop_count{loop_count}, raw_func{raw_func}, arg_provider{std::move(arg_provider)} {}
 
 
-    virtual TimingResult run(const TimerInfo& ti) override {
-        raw_result raw = get_raw();
-        return handle_raw(raw, ti);
+    virtual TimingResult run(Context& c) override {
+        size_t samples_taken;
+        return run(c, samples_taken);
+    }
+
+    /* as run(Context&), but also returns the number of samples taken, which varies with adaptive sampling */
+    TimingResult run(Context& c, size_t& samples_taken) {
+        raw_result raw = get_raw(c.getSampleConfig());
+        samples_taken = ALGO::sample_count(raw);
+        return handle_raw(raw, c.getTimerInfo());
     }
 
     virtual void runAndPrintInner(Context& c) override {
-        TimingResult result = run(c.getTimerInfo());
-        printResultLine(c, this, result);
+        raw_result raw = get_raw(c.getSampleConfig());
+        std::vector<TimingResult> results;
+        for (auto& delta : ALGO::sample_deltas(raw)) {
+            results.push_back(handle_delta(delta, c.getTimerInfo()));
+        }
+        printSampledResult(c, this, handle_raw(raw, c.getTimerInfo()), results, ALGO::sample_count(raw));
     }
 };
 
-template <typename DELTA_T, size_t SIZE>
+/**
+ * The raw samples for the base and bench methods of a delta benchmark. The two always have the
+ * same number of samples.
+ */
+template <typename DELTA_T>
 struct DeltaRaw {
-    using one_result = std::array<DELTA_T, SIZE>;
+    using one_result = std::vector<DELTA_T>;
     one_result base, bench;
 };
 
+/* the number of disrupted samples (see TimerInfo::valid) retaken in one call before they're kept anyway */
+constexpr size_t max_sample_retries = 100;
+
 /**
  * The core benchmark loop, which performs samples calls to METHOD and returns an array of the timing for
  * each one.
@@ -336,16 +456,106 @@ NO_STACK_PROTECTOR
 std::array<typename TIMER::delta_t,samples> time_one(size_t loop_count, void* arg) {
     WARM_ONCE(loop_count, arg);
     std::array<typename TIMER::delta_t,samples> result;
+    size_t retries = 0;
     for (int i = 0; i < samples; i++) {
         WARM_EVERY(loop_count, arg);
         auto t0 = TIMER::now();
         METHOD(loop_count, arg);
         auto t1 = TIMER::now();
+        if (!TIMER::valid(t0, t1) && retries++ < max_sample_retries) {
+            i--;
+            continue;
+        }
         result[i] = TIMER::delta(t1, t0);
     }
     return result;
 }
 
+/**
+ * Like time_one, but the number of samples is determined at runtime and they are appended to
+ * the out vector, whose storage is allocated before any timing takes place.
+ */
+template <typename TIMER, bench2_f METHOD>
+HEDLEY_NEVER_INLINE
+NO_STACK_PROTECTOR
+void time_some(size_t loop_count, void* arg, size_t samples, std::vector<typename TIMER::delta_t>& out) {
+    size_t start = out.size();
+    out.resize(start + samples);
+    typename TIMER::delta_t* result = out.data() + start;
+    size_t retries = 0;
+    for (size_t i = 0; i < samples; i++) {
+        auto t0 = TIMER::now();
+        METHOD(loop_count, arg);
+        auto t1 = TIMER::now();
+        if (!TIMER::valid(t0, t1) && retries++ < max_sample_retries) {
+            i--;
+            continue;
+        }
+        result[i] = TIMER::delta(t1, t0);
+    }
+}
+
+/**
+ * Incremented whenever the timer is reconfigured between benchmarks, e.g., when another event batch is
+ * selected, so that overheads calibrated under the old configuration (see TimerOverhead) are measured again.
+ */
+extern unsigned timer_config_epoch;
+
+/**
+ * The overhead of timing with TIMER, calibrated on first use: the minimum over many samples of a pair of
+ * back-to-back TIMER::now() calls, and of a timed call to dummy_bench, which is what the base method of most
+ * delta benchmarks measures.
+ */
+template <typename TIMER>
+struct TimerOverhead {
+    static constexpr int warmup_samples =   10;
+    static constexpr int total_samples  = 1000;
+
+    using delta_t = typename TIMER::delta_t;
+
+    delta_t now_pair, dummy_call;
+
+    static const TimerOverhead& get() {
+        static TimerOverhead overhead = measure();
+        static unsigned epoch = timer_config_epoch;
+        if (epoch != timer_config_epoch) {
+            overhead = measure();
+            epoch = timer_config_epoch;
+        }
+        return overhead;
+    }
+
+private:
+    template <bench2_f METHOD>
+    static delta_t calibrate() {
+        std::vector<delta_t> samples;
+        time_some<TIMER, METHOD>(0, nullptr, total_samples, samples);
+        return TimerHelper<TIMER>::min(samples.begin() + warmup_samples, samples.end());
+    }
+
+    static TimerOverhead measure() {
+        return {calibrate<inlined_empty>(), calibrate<dummy_bench>()};
+    }
+};
+
+/* log the calibrated overheads of TIMER, see TimerOverhead */
+template <typename TIMER>
+void log_timer_overhead(Context& c) {
+    auto& ti = static_cast<const TIMER&>(c.getTimerInfo());
+    auto& names = ti.getMetricNames();
+    auto format = [&](const typename TIMER::delta_t& delta) {
+        std::string s;
+        auto values = TIMER::to_result(ti, delta).getResults();
+        for (size_t i = 0; i < values.size() && i < names.size(); i++) {
+            s += string_format("%s%.2f %s", i ? ", " : "", values[i], names[i].c_str());
+        }
+        return s;
+    };
+    auto& overhead = TimerOverhead<TIMER>::get();
+    c.log() << "Timer overhead: " << format(overhead.now_pair) << " for a now() pair, "
+            << format(overhead.dummy_call) << " for a dummy_bench call" << std::endl;
+}
+
 template <typename TIMER>
 struct DeltaAlgo {
     static constexpr int warmup_samples =  2;
@@ -354,25 +564,99 @@ struct DeltaAlgo {
     static_assert(warmup_samples < total_samples, "warmup samples must be less than total");
 
     using delta_t    = typename TIMER::delta_t;
-    using raw_result = DeltaRaw<delta_t, total_samples>;
+    using raw_result = DeltaRaw<delta_t>;
     using one_result = typename raw_result::one_result;
 
-    using raw_f      = raw_result (*)(size_t loop_count, void *arg);
+    using raw_f      = raw_result (*)(size_t loop_count, void *arg, const SampleConfig& config);
 
     template <bench2_f BENCH_METHOD>
-    static raw_result delta_loop_bench(size_t loop_count, void *arg) {
-        raw_result result;
-        result.base  = time_one<TIMER, total_samples, BENCH_METHOD>(loop_count,     arg);
-        result.bench = time_one<TIMER, total_samples, BENCH_METHOD>(loop_count * 2, arg);
-        return result;
+    static raw_result delta_loop_bench(size_t loop_count, void *arg, const SampleConfig& config) {
+        return sample<BENCH_METHOD, BENCH_METHOD>(loop_count * 2, loop_count, arg, config);
     }
 
     template <bench2_f BENCH_METHOD, bench2_f BASE_METHOD>
-    static raw_result delta_bench(size_t loop_count, void *arg) {
+    static raw_result delta_bench(size_t loop_count, void *arg, const SampleConfig& config) {
+        return sample<BENCH_METHOD, BASE_METHOD>(loop_count, loop_count, arg, config);
+    }
+
+    template <bench2_f BENCH_METHOD>
+    static raw_result calibrated_bench(size_t loop_count, void *arg, const SampleConfig& config) {
+        return sample<BENCH_METHOD, dummy_bench, true>(loop_count, loop_count, arg, config);
+    }
+
+    /**
+     * Take samples of the base and bench methods, in batches that alternate between the two. Without
+     * adaptive sampling this is a single batch of total_samples. With adaptive sampling the first batch
+     * has min_samples and each later batch doubles the total, until the estimate is stable within the
+     * target error or max_samples is reached.
+     *
+     * If calibrated is true the base method isn't run at all, and every base sample is the calibrated cost
+     * of a timed dummy_bench call instead.
+     */
+    template <bench2_f BENCH_METHOD, bench2_f BASE_METHOD, bool calibrated = false>
+    static raw_result sample(size_t bench_loops, size_t base_loops, void *arg, const SampleConfig& config) {
         raw_result result;
-        result.base  = time_one<TIMER, total_samples, BASE_METHOD> (loop_count, arg);
-        result.bench = time_one<TIMER, total_samples, BENCH_METHOD>(loop_count, arg);
-        return result;
+        size_t max_samples = config.isAdaptive() ? std::max(config.max_samples, min_adaptive_samples()) : total_samples;
+        size_t batch = config.isAdaptive() ? std::max(config.min_samples, min_adaptive_samples()) : total_samples;
+        batch = std::min(batch, max_samples);
+        result.base.reserve(max_samples);
+        result.bench.reserve(max_samples);
+        while (true) {
+            if (calibrated) {
+                result.base.insert(result.base.end(), batch, TimerOverhead<TIMER>::get().dummy_call);
+            } else {
+                time_some<TIMER, BASE_METHOD> (base_loops,  arg, batch, result.base);
+            }
+            time_some<TIMER, BENCH_METHOD>(bench_loops, arg, batch, result.bench);
+            size_t taken = sample_count(result);
+            if (!config.isAdaptive() || taken >= max_samples || is_stable(result, config.target_error)) {
+                return result;
+            }
+            batch = std::min(taken, max_samples - taken);
+        }
+    }
+
+    /* adaptive sampling needs at least two samples after warmup to compare the estimates */
+    static size_t min_adaptive_samples() { return warmup_samples + 2; }
+
+    /* the number of samples (including warmup samples) taken for each of base and bench */
+    static size_t sample_count(const raw_result& result) {
+        assert(result.base.size() == result.bench.size());
+        return result.bench.size();
+    }
+
+    /* the aggregated bench minus base value, using only the first count samples */
+    static double estimate(const raw_result& result, size_t count) {
+        auto bench = TimerHelper<TIMER>::min(result.bench.begin() + warmup_samples, result.bench.begin() + count);
+        auto base  = TimerHelper<TIMER>::min(result.base.begin()  + warmup_samples, result.base.begin()  + count);
+        return (double)TIMER::aggr_value(bench) - (double)TIMER::aggr_value(base);
+    }
+
+    /**
+     * The result is considered stable if the estimate from all the samples differs from the estimate from
+     * the first half of the samples by at most target_error, relative to the bench time. Since the estimate is
+     * based on the minimum, this means the second half of the samples didn't find a meaningfully faster run.
+     * The bench time is used as the reference rather than the estimate itself, since the estimate can be
+     * close to zero.
+     */
+    static bool is_stable(const raw_result& result, double target_error) {
+        size_t count = sample_count(result), half = warmup_samples + (count - warmup_samples) / 2;
+        assert(half > warmup_samples && half < count);
+        double bench = TIMER::aggr_value(aggregate_one(result.bench));
+        return std::abs(estimate(result, count) - estimate(result, half)) <= target_error * std::abs(bench);
+    }
+
+    /**
+     * The individual bench samples after warmup, each with the aggregated base subtracted, used to report the
+     * distribution and noise. The minimum of these is the same as the aggregated result.
+     */
+    static std::vector<delta_t> sample_deltas(const raw_result& result) {
+        delta_t base = aggregate_one(result.base);
+        std::vector<delta_t> deltas;
+        for (auto it = result.bench.begin() + warmup_samples; it != result.bench.end(); it++) {
+            deltas.push_back(TIMER::delta(*it, base));
+        }
+        return deltas;
     }
 
     static typename TIMER::delta_t aggregate_one(const one_result& result) {
@@ -390,6 +674,9 @@ struct DeltaAlgo {
 
 template <typename TIMER, typename DERIVED>
 class MakerBase {
+    template <typename, typename>
+    friend class MakerBase;
+
 protected:
     BenchmarkGroup* parent;
     uint32_t loop_count;
@@ -398,6 +685,11 @@ protected:
 
     MakerBase(BenchmarkGroup* parent, uint32_t loop_count) : parent{parent}, loop_count{loop_count}, tags{} {}
 
+    /* copy the settings of a maker of another type, e.g., when a DeltaMaker switches algorithm */
+    template <typename OTHER>
+    MakerBase(const MakerBase<TIMER, OTHER>& rhs) :
+        parent{rhs.parent}, loop_count{rhs.loop_count}, tags{rhs.tags}, features{rhs.features} {}
+
     template <typename ALGO>
     HEDLEY_NEVER_INLINE
     Benchmark make_bench_from_raw(
@@ -411,7 +703,7 @@ protected:
     }
 
     BenchArgs make_args(const std::string& id, const std::string& description, uint32_t ops_per_loop) {
-        return {parent, id, description, tags, features, ops_per_loop};
+        return {parent, id, description, tags, features, ops_per_loop, loop_count};
     }
 
 public:
@@ -462,15 +754,16 @@ public:
  * to include (i.e., it is possible to create "sparse" benchmarks where the code under test is surrounded
  * by code that shouldn't contribute to the result).
  */
-template <typename TIMER, bool use_loop_delta = false>
-class DeltaMaker : public MakerBase<TIMER, DeltaMaker<TIMER>> {
+template <typename TIMER, bool use_loop_delta = false, bool use_calibrated = false>
+class DeltaMaker : public MakerBase<TIMER, DeltaMaker<TIMER, use_loop_delta, use_calibrated>> {
 public:
 
-    using this_t = DeltaMaker<TIMER>;
-    using base_t = MakerBase<TIMER, DeltaMaker<TIMER>>;
+    // the full type, so the setters in MakerBase return a maker with the same algorithm
+    using this_t = DeltaMaker<TIMER, use_loop_delta, use_calibrated>;
+    using base_t = MakerBase<TIMER, this_t>;
 
-    template <bool uld>
-    DeltaMaker(const DeltaMaker<TIMER, uld>& rhs) : base_t{rhs} {
+    template <bool uld, bool uc>
+    DeltaMaker(const DeltaMaker<TIMER, uld, uc>& rhs) : base_t{rhs} {
         // if DeltaMaker has state we need to fix the copy ctor, etc
         static_assert(sizeof(this_t) == sizeof(base_t), "DeltaMaker shouldn't have state");
     }
@@ -492,6 +785,9 @@ public:
                 uint32_t ops_per_loop,
                 const arg_provider_t& arg_provider = null_provider)
     {
+        if (!this->parent->isSelected()) {
+            return;
+        }
         Benchmark b = make_only<BENCH_METHOD, BASE_METHOD>(id, description, ops_per_loop, arg_provider);
         this->parent->add(b);
     }
@@ -506,6 +802,8 @@ public:
         typename BenchTemplate<TIMER, DeltaAlgo<TIMER>>::raw_f f;
         if (use_loop_delta) {
             f = DeltaAlgo<TIMER>::template delta_loop_bench<BENCH_METHOD>;
+        } else if (use_calibrated) {
+            f = DeltaAlgo<TIMER>::template calibrated_bench<BENCH_METHOD>;
         } else {
             f = DeltaAlgo<TIMER>::template delta_bench<BENCH_METHOD, BASE_METHOD>;
         }
@@ -520,6 +818,16 @@ public:
         DeltaMaker<TIMER, true> ret(*this);
         return ret;
     }
+
+    /* If useCalibratedOverhead is set to true, only the bench method is timed, and the calibrated cost of a timed
+     * dummy_bench call (see TimerOverhead) is subtracted rather than timing a base method alongside it. This suits
+     * benchmarks with small loop counts, where the base method would take as long as the benchmark itself. Any
+     * BASE_METHOD passed to make is ignored.
+     */
+    DeltaMaker<TIMER, false, true> useCalibratedOverhead() {
+        DeltaMaker<TIMER, false, true> ret(*this);
+        return ret;
+    }
 };
 
 template <typename TIMER>
@@ -563,6 +871,9 @@ void register_cacheline_branch(GroupList& list);
 template <typename TIMER>
 void register_call(GroupList& list);
 
+template <typename TIMER>
+void register_coherence(GroupList& list);
+
 template <typename TIMER>
 void register_cpp(GroupList& list);
 
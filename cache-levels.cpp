@@ -0,0 +1,72 @@
+/*
+ * cache-levels.cpp
+ */
+
+#include "cache-levels.hpp"
+#include "util.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+
+std::vector<CacheLevel> find_cache_levels(const std::vector<SweepPoint>& points, double tolerance, double min_width) {
+    std::vector<CacheLevel> levels;
+    for (size_t i = 0, end; i < points.size(); i = end) {
+        // the plateau grows while the next point is within tolerance of the median of the plateau so far, which
+        // allows for some noise and a slow creep in latency, e.g., from TLB misses
+        std::vector<double> cycles{points[i].cycles};
+        for (end = i + 1; end < points.size() && points[end].cycles <= cycles[(cycles.size() - 1) / 2] * (1 + tolerance); end++) {
+            cycles.insert(std::upper_bound(cycles.begin(), cycles.end(), points[end].cycles), points[end].cycles);
+        }
+        // plateaus narrower than min_width are just points on the way up from one level to the next, except
+        // that the sweep may start or end part way along a plateau
+        bool at_edge = i == 0 || end == points.size();
+        if (end - i >= 2 && (at_edge || points[end - 1].bytes >= min_width * points[i].bytes)) {
+            levels.push_back(CacheLevel{points[i].bytes, points[end - 1].bytes, cycles[(cycles.size() - 1) / 2]});
+        }
+    }
+    return levels;
+}
+
+size_t parse_cache_size(const std::string& size) {
+    char* end;
+    unsigned long value = strtoul(size.c_str(), &end, 10);
+    if (end == size.c_str()) {
+        return 0;
+    }
+    std::string suffix = end;
+    if (suffix.empty()) {
+        return value;
+    } else if (suffix == "K") {
+        return value * 1024;
+    } else if (suffix == "M") {
+        return value * 1024 * 1024;
+    } else if (suffix == "G") {
+        return value * 1024 * 1024 * 1024;
+    }
+    return 0;
+}
+
+std::string format_cache_size(size_t bytes) {
+    if (bytes < 1024 * 1024) {
+        return string_format("%.4g KiB", bytes / 1024.);
+    }
+    return string_format("%.4g MiB", bytes / (1024. * 1024.));
+}
+
+std::vector<SysfsCache> read_sysfs_caches(int cpu) {
+    std::vector<SysfsCache> caches;
+    for (int index = 0; ; index++) {
+        std::string dir = string_format("/sys/devices/system/cpu/cpu%d/cache/index%d/", cpu, index);
+        std::string level = read_first_line(dir + "level");
+        if (level == "unknown") {
+            break;
+        }
+        std::string type = read_first_line(dir + "type");
+        size_t bytes = parse_cache_size(read_first_line(dir + "size"));
+        if (type != "Instruction" && bytes) {
+            caches.push_back(SysfsCache{atoi(level.c_str()), type, bytes});
+        }
+    }
+    std::stable_sort(caches.begin(), caches.end(), [](const SysfsCache& a, const SysfsCache& b){ return a.level < b.level; });
+    return caches;
+}
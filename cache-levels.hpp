@@ -0,0 +1,59 @@
+/*
+ * cache-levels.hpp
+ *
+ * Finding the levels of the cache hierarchy in the results of a latency sweep over region sizes, as done by
+ * the memory/characterize-caches group (see --characterize-caches), and reading the cache sizes the kernel
+ * reports, to cross-check them.
+ */
+
+#ifndef CACHE_LEVELS_HPP_
+#define CACHE_LEVELS_HPP_
+
+#include <string>
+#include <vector>
+
+/* the load-to-use latency measured for one region size */
+struct SweepPoint {
+    size_t bytes;
+    double cycles;
+};
+
+/* a plateau in the latency sweep, i.e., a cache level, or main memory for the last one */
+struct CacheLevel {
+    /* the smallest and largest sizes measured on the plateau: the largest is the effective capacity */
+    size_t first_bytes, capacity;
+    /* the median latency of the points on the plateau */
+    double cycles;
+};
+
+/*
+ * Find the plateaus in the given points, which must be sorted by size. A plateau is a run of points each within
+ * tolerance of the median latency of the points before it in the run, spanning at least a factor of min_width in
+ * size, and the points between plateaus are the transitions from one level to the next. The last plateau is
+ * usually main memory.
+ */
+std::vector<CacheLevel> find_cache_levels(const std::vector<SweepPoint>& points, double tolerance = 0.1, double min_width = 1.5);
+
+/* a data or unified cache as reported in sysfs */
+struct SysfsCache {
+    int level;
+    /* Data or Unified */
+    std::string type;
+    size_t bytes;
+};
+
+/*
+ * Parse a sysfs cache size like 32K or 8M, returning the size in bytes, or 0 if it is malformed.
+ */
+size_t parse_cache_size(const std::string& size);
+
+/* format a size in bytes for display, e.g., 48 KiB or 1.25 MiB */
+std::string format_cache_size(size_t bytes);
+
+/*
+ * The data and unified caches for the given CPU, from /sys/devices/system/cpu/cpuN/cache, sorted by level,
+ * or an empty list if they aren't available.
+ */
+std::vector<SysfsCache> read_sysfs_caches(int cpu);
+
+#endif /* CACHE_LEVELS_HPP_ */
@@ -74,6 +74,7 @@ void register_cacheline_branch(GroupList& list) {
     maker.template make<cacheline_branch_slow>("cacheline_branch_slow",  "cacheline_branch_slow", 1);
     maker.template make<cacheline_branch_fast>("cacheline_branch_fast",  "cacheline_branch_fast", 1);
     list.push_back(group);
+    group->setTags({"core-local"});
 }
 
 #else // #if !UARCH_BENCH_PORTABLE
@@ -35,6 +35,7 @@ void register_call(GroupList& list) {
 #if !UARCH_BENCH_PORTABLE
     std::shared_ptr<BenchmarkGroup> call_group = std::make_shared<BenchmarkGroup>("call", "Call/ret benchmarks");
     list.push_back(call_group);
+    call_group->setTags({"core-local"});
 
     auto default_maker = DeltaMaker<TIMER>(call_group.get());
 
@@ -0,0 +1,294 @@
+/*
+ * coherence-benches.cpp
+ *
+ * The coherence/c2c group: core to core latency, measured by bouncing a single cache line between two threads
+ * pinned to different CPUs, for every pair of CPUs in --cpus. The benchmark thread and a partner thread take
+ * turns at the line, so every turn moves the line from one core's cache to the other's. There is one benchmark
+ * per kind of handoff, each of which runs every pair and then prints an N by N matrix of the one-way latency.
+ * Each pair is only measured one way around, so the matrix is symmetric.
+ *
+ * The coherence/atomics group: atomic read-modify-writes from 1 up to all the CPUs in --cpus at once, either all
+ * on one shared counter (true sharing), on separate counters packed into the same line (false sharing) or on
+ * counters with a line each (no sharing), to show how contended counters scale. For each thread count it reports
+ * the latency of an operation on each thread, and after the results the aggregate throughput of all the threads
+ * together.
+ */
+
+#include "benchmark.hpp"
+#include "cpp-benches.hpp"
+#include "result-sink.hpp"
+#include "simple-timer.hpp"
+#include "table.hpp"
+#include "threaded.hpp"
+#include "util.hpp"
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <thread>
+
+#include <sched.h>
+
+namespace {
+
+struct HandoffKind {
+    const char* id;
+    const char* desc;
+    C2CHandoff handoff;
+};
+
+const HandoffKind HANDOFF_KINDS[] = {
+    {"load-store", "spin on loads, hand off with a plain store", C2CHandoff::LOAD_STORE},
+    {"xadd",       "spin on loads, hand off with lock xadd",     C2CHandoff::XADD},
+    {"cmpxchg",    "spin on lock cmpxchg until it succeeds",     C2CHandoff::CMPXCHG},
+};
+
+/* the line for the pair being measured, only one pair runs at a time */
+c2c_line pair_line;
+std::thread partner_thread;
+
+/* start the partner thread on the given CPU, taking its turns at a fresh line */
+void* start_partner(C2CHandoff handoff, int cpu) {
+    pair_line.value = 0;
+    pair_line.stop = false;
+    partner_thread = std::thread([=]{
+        pin_to_cpu(cpu);
+        c2c_partner(handoff, &pair_line);
+    });
+    return &pair_line;
+}
+
+void stop_partner(void*) {
+    pair_line.stop = true;
+    partner_thread.join();
+}
+
+template <typename TIMER>
+class C2CGroup : public BenchmarkGroup {
+    struct PairInfo {
+        const HandoffKind* kind;
+        int cpu_a, cpu_b;
+    };
+
+    uint32_t round_trips_ = 1000;
+    /* the benchmarks listed for the group, which stand for all the pairs of their kind */
+    std::map<const BenchmarkBase*, const HandoffKind*> kinds_;
+    /* the benchmarks for each pair, created when the group runs */
+    std::vector<std::unique_ptr<BenchmarkBase>> pair_benches_;
+    std::map<const BenchmarkBase*, PairInfo> pairs_;
+
+    Benchmark makePair(const HandoffKind& kind, int cpu_a, int cpu_b) {
+        // two handoffs per round trip, so the results are the one-way latency
+        auto maker = DeltaMaker<TIMER>(this, round_trips_);
+        auto id = string_format("%s-cpu%d-cpu%d", kind.id, cpu_a, cpu_b);
+        auto desc = string_format("CPU %d <-> CPU %d, %s handoff", cpu_a, cpu_b, kind.id);
+        arg_provider_t args{[=, &kind]{ return start_partner(kind.handoff, cpu_b); }, stop_partner};
+        switch (kind.handoff) {
+        case C2CHandoff::LOAD_STORE: return maker.template make_only<c2c_load_store>(id, desc, 2, args);
+        case C2CHandoff::XADD:       return maker.template make_only<c2c_xadd>      (id, desc, 2, args);
+        case C2CHandoff::CMPXCHG:    return maker.template make_only<c2c_cmpxchg>   (id, desc, 2, args);
+        }
+        throw std::logic_error("unknown handoff");
+    }
+
+    /* run every pair of the given CPUs for each selected kind, with the benchmark thread pinned to the first of the pair */
+    void runPairs(Context& c, const predicate_t& predicate, const std::vector<int>& cpus) {
+        SimpleTimer timer;
+        bool header = false;
+        for (auto& b : getBenches()) {
+            if (!predicate(b)) {
+                continue;
+            }
+            if (!header) {
+                c.getSink().groupStart(c, *this);
+                header = true;
+            }
+            auto& kind = *kinds_.at(b);
+            if (cpus.size() < 2) {
+                c.getSink().skipped(c, *b, "needs at least two CPUs in --cpus");
+                continue;
+            }
+            for (size_t i = 0; i < cpus.size(); i++) {
+                for (size_t j = i + 1; j < cpus.size(); j++) {
+                    Benchmark pair = makePair(kind, cpus[i], cpus[j]);
+                    pair_benches_.emplace_back(pair);
+                    pairs_[pair] = PairInfo{&kind, cpus[i], cpus[j]};
+                    pin_to_cpu(cpus[i]);
+                    pair->runAndPrint(c);
+                }
+            }
+        }
+        if (header) {
+            c.getSink().groupEnd(c, *this, timer.elapsed<std::chrono::milliseconds>());
+        }
+    }
+
+    void printMatrix(Context& c, std::ostream& os, const HandoffKind& kind, const std::vector<int>& cpus,
+            const std::vector<ResultRecord>& results) {
+        using namespace table;
+        std::map<std::pair<int, int>, double> latency;
+        for (auto& r : results) {
+            auto pair = pairs_.find(r.bench);
+            if (pair != pairs_.end() && pair->second.kind == &kind && !r.values.empty()) {
+                latency[{pair->second.cpu_a, pair->second.cpu_b}] = r.values[0];
+                latency[{pair->second.cpu_b, pair->second.cpu_a}] = r.values[0];
+            }
+        }
+        if (latency.empty()) {
+            return;
+        }
+        Table t;
+        auto& header = t.newRow().add("CPU");
+        for (int cpu : cpus) {
+            header.add(std::to_string(cpu));
+        }
+        for (int row_cpu : cpus) {
+            auto& row = t.newRow().add(std::to_string(row_cpu));
+            for (int col_cpu : cpus) {
+                auto v = latency.find({row_cpu, col_cpu});
+                row.add(v == latency.end() ? "-" : string_format("%.1f", v->second));
+            }
+        }
+        for (size_t col = 1; col <= cpus.size(); col++) {
+            t.colInfo(col).justify = ColInfo::RIGHT;
+        }
+        os << std::endl << "** Core to core latency, " << kind.desc << " ("
+                << c.getTimerInfo().getMetricNames().at(0) << " per one-way handoff) **" << std::endl << t.str();
+    }
+
+public:
+    C2CGroup() : BenchmarkGroup("coherence/c2c", "Core to core cache line handoff latency") {}
+
+    void setRoundTrips(uint32_t round_trips) {
+        round_trips_ = round_trips;
+    }
+
+    void addKind(Benchmark b, const HandoffKind& kind) {
+        kinds_[b] = &kind;
+        add(b);
+    }
+
+    virtual void runIf(Context& c, const predicate_t& predicate) override {
+        std::vector<int> cpus = c.getThreadCpus();
+        run_with_summary(c, *this, [&]{ runPairs(c, predicate, cpus); },
+                [&](const std::vector<ResultRecord>& results){
+                    std::ostream& os = c.getSink().isText() ? c.out() : c.log();
+                    for (auto& kind : HANDOFF_KINDS) {
+                        printMatrix(c, os, kind, cpus, results);
+                    }
+                });
+    }
+};
+
+/* the lines for the unshared atomics are this far apart, so the adjacent line prefetcher doesn't pair them up */
+constexpr size_t PADDED_STRIDE = 2 * UB_CACHE_LINE_SIZE;
+
+/* the counter every thread hammers in the shared atomics benchmarks */
+void* shared_counter() {
+    return aligned_ptr(UB_CACHE_LINE_SIZE, UB_CACHE_LINE_SIZE, true);
+}
+
+/*
+ * The index of the next thread to get its counter in the unshared and false shared atomics benchmarks. The threads
+ * get their args one at a time, and the group resets this before each run, so each thread gets a different one.
+ */
+size_t next_counter;
+
+/* a counter on a line of its own for each thread */
+void* padded_counter() {
+    char* pool = static_cast<char*>(aligned_ptr(UB_CACHE_LINE_SIZE, PADDED_STRIDE * CPU_SETSIZE, true));
+    return pool + next_counter++ % CPU_SETSIZE * PADDED_STRIDE;
+}
+
+/* a counter for each thread, but with eight of them packed into each line */
+void* false_shared_counter() {
+    auto pool = static_cast<uint64_t*>(aligned_ptr(UB_CACHE_LINE_SIZE, sizeof(uint64_t) * CPU_SETSIZE, true));
+    return pool + next_counter++ % CPU_SETSIZE;
+}
+
+template <typename TIMER>
+class AtomicsGroup : public ThreadScalingGroup<TIMER> {
+    using base_t = ThreadScalingGroup<TIMER>;
+
+    void printTable(std::ostream& os, const std::string& title, const std::vector<size_t>& counts,
+            const typename base_t::results_t& results, std::function<double(const typename base_t::ScalingResult&)> value) {
+        using namespace table;
+        Table t;
+        auto& header = t.newRow().add("Benchmark");
+        for (size_t n : counts) {
+            header.add(string_format("%zu thr", n));
+        }
+        for (auto& b : this->getBenches()) {
+            auto found = results.find(b);
+            if (found == results.end()) {
+                continue;
+            }
+            auto& row = t.newRow().add(b->getId());
+            for (size_t n : counts) {
+                row.add(string_format("%.2f", value(found->second.at(n))));
+            }
+        }
+        for (size_t col = 1; col <= counts.size(); col++) {
+            t.colInfo(col).justify = ColInfo::RIGHT;
+        }
+        os << std::endl << "** " << title << " **" << std::endl << t.str();
+    }
+
+protected:
+    virtual void beforeRun(size_t threads) override {
+        next_counter = 0;
+    }
+
+    virtual void printSummary(Context& c, std::ostream& os, const std::vector<size_t>& counts,
+            const typename base_t::results_t& results) override {
+        auto& names = c.getTimerInfo().getMetricNames();
+        // throughput is per microsecond if the timer has nanos, otherwise per unit of the first metric
+        size_t rate = base_t::rateMetric(c.getTimerInfo());
+        printTable(os, "Per-thread latency (" + names.at(0) + " per operation)", counts, results,
+                [](const typename base_t::ScalingResult& r){ return r.mean.at(0); });
+        printTable(os, "Aggregate throughput (" + (rate ? std::string("Mops/s") : "operations per " + names.at(0)) + ")",
+                counts, results, [=](const typename base_t::ScalingResult& r){ return (rate ? 1000. : 1.) / r.total.at(rate); });
+    }
+
+public:
+    AtomicsGroup() : base_t("coherence/atomics", "Atomic RMW scaling on shared and per-thread lines") {}
+};
+
+}  // namespace
+
+template <typename TIMER>
+void register_coherence(GroupList& list) {
+    auto group = std::make_shared<C2CGroup<TIMER>>();
+    list.push_back(group);
+
+    auto trips_list = group->param("round-trips", "Round trips of the line per sample, for each pair", "1000", 1, 1000 * 1000);
+    if (trips_list.size() != 1) {
+        throw std::runtime_error("coherence/c2c/round-trips must be a single count");
+    }
+    group->setRoundTrips(trips_list.front());
+    // these stand for every pair of their kind, and aren't run themselves
+    auto maker = DeltaMaker<TIMER>(group.get()).setTags({"slow"});
+    group->addKind(maker.template make_only<c2c_load_store>("load-store", "all CPU pairs, load/store handoff", 2), HANDOFF_KINDS[0]);
+    group->addKind(maker.template make_only<c2c_xadd>      ("xadd",       "all CPU pairs, lock xadd handoff",  2), HANDOFF_KINDS[1]);
+    group->addKind(maker.template make_only<c2c_cmpxchg>   ("cmpxchg",    "all CPU pairs, lock cmpxchg handoff", 2), HANDOFF_KINDS[2]);
+
+    auto atomics = std::make_shared<AtomicsGroup<TIMER>>();
+    list.push_back(atomics);
+    auto tmaker = ThreadedDeltaMaker<TIMER>(atomics.get()).setTags({"threaded"});
+    tmaker.template make<atomic_lock_add>("shared-lock-add", "shared lock add", 1, shared_counter);
+    tmaker.template make<atomic_xadd>    ("shared-xadd",     "shared lock xadd", 1, shared_counter);
+    tmaker.template make<atomic_cmpxchg> ("shared-cmpxchg",  "shared lock cmpxchg", 1, shared_counter);
+    tmaker.template make<atomic_xchg>    ("shared-xchg",     "shared xchg", 1, shared_counter);
+    tmaker.template make<atomic_lock_add>("false-lock-add",  "false shared lock add", 1, false_shared_counter);
+    tmaker.template make<atomic_xadd>    ("false-xadd",      "false shared lock xadd", 1, false_shared_counter);
+    tmaker.template make<atomic_cmpxchg> ("false-cmpxchg",   "false shared lock cmpxchg", 1, false_shared_counter);
+    tmaker.template make<atomic_xchg>    ("false-xchg",      "false shared xchg", 1, false_shared_counter);
+    tmaker.template make<atomic_lock_add>("padded-lock-add", "per-thread lock add", 1, padded_counter);
+    tmaker.template make<atomic_xadd>    ("padded-xadd",     "per-thread lock xadd", 1, padded_counter);
+    tmaker.template make<atomic_cmpxchg> ("padded-cmpxchg",  "per-thread lock cmpxchg", 1, padded_counter);
+    tmaker.template make<atomic_xchg>    ("padded-xchg",     "per-thread xchg", 1, padded_counter);
+}
+
+#define REG_DEFAULT(CLOCK) template void register_coherence<CLOCK>(GroupList& list);
+
+ALL_TIMERS_X(REG_DEFAULT)
@@ -3,10 +3,18 @@
  */
 
 #include "context.hpp"
+#include "baseline.hpp"
 #include "benchmark.hpp"
+#include "derived-metrics.hpp"
+#include "freq-monitor.hpp"
 #include "timers.hpp"
 #include "matchers.hpp"
+#include "params.hpp"
+#include "parallel-groups.hpp"
+#include "table.hpp"
+#include "result-sink.hpp"
 
+#include <algorithm>
 #include <iostream>
 
 using namespace std;
@@ -25,6 +33,10 @@ Context::Context(int argc, char **argv, std::ostream *out)
     try {
         addTimerSpecificArgs(parser);
         parser.ParseCLI(argc, argv);
+        sink_ = ResultSink::make(arg_output_format.Get());
+        if (arg_save_baseline || arg_compare_baseline) {
+            sink_.reset(new BaselineSink(std::move(sink_), arg_save_baseline.Get(), arg_compare_baseline.Get()));
+        }
     } catch (args::Help&) {
         log() << parser;
         throw SilentSuccess();
@@ -34,9 +46,34 @@ Context::Context(int argc, char **argv, std::ostream *out)
     } catch (args::UsageError & e) {
         err() << "ERROR: " << e.what() << std::endl;
         throw SilentFailure();
+    } catch (std::runtime_error& e) {
+        // e.g., an unknown output format or a bad baseline file
+        err() << "ERROR: " << e.what() << std::endl;
+        throw SilentFailure();
     }
 
     verbose_ = arg_verbose;
+
+    if (!sink_->isText()) {
+        // keep the result stream clean for structured formats
+        err_ = log_ = &std::cerr;
+    }
+    set_log_stream(log_);
+}
+
+Context::~Context() = default;
+
+std::unique_ptr<ResultSink> Context::redirect(std::ostream* out, std::unique_ptr<ResultSink> sink) {
+    if (err_ == out_) {
+        err_ = out;
+    }
+    if (log_ == out_) {
+        log_ = out;
+        set_log_stream(log_);
+    }
+    out_ = out;
+    std::swap(sink_, sink);
+    return sink;
 }
 
 template <typename TIMER>
@@ -47,6 +84,7 @@ GroupList make_benches() {
     register_branch<TIMER>(groupList);
     register_cacheline_branch<TIMER>(groupList);
     register_call<TIMER>(groupList);
+    register_coherence<TIMER>(groupList);
     register_cpp<TIMER>(groupList);
     register_decode<TIMER>(groupList);
     register_default<TIMER>(groupList);
@@ -67,18 +105,21 @@ GroupList make_benches() {
 
 /*
  * A list of benchmarks which binds together a particular TIMER implementation (and its corresponding ClockInfo object), with all
- * benchmarks.
+ * benchmarks. The benchmarks are only created the first time they are needed, so only the selected timer pays for them.
  */
 class TimeredList {
 
     static std::vector<TimeredList> all_;
 
     std::unique_ptr<TimerInfo> timer_info_;
+    GroupList (*make_groups_)();
+    void (*log_overhead_)(Context&);
     GroupList groups_;
+    bool created_ = false;
 
 public:
-    TimeredList(std::unique_ptr<TimerInfo>&& timer_info, const GroupList& benches)
-: timer_info_(std::move(timer_info)), groups_(benches) {}
+    TimeredList(std::unique_ptr<TimerInfo>&& timer_info, GroupList (*make_groups)(), void (*log_overhead)(Context&))
+: timer_info_(std::move(timer_info)), make_groups_(make_groups), log_overhead_(log_overhead) {}
 
     TimeredList(const TimeredList &) = delete;
     TimeredList(TimeredList &&) = default;
@@ -89,27 +130,41 @@ public:
         return *timer_info_;
     }
 
-    const GroupList& getGroups() const {
+    const GroupList& getGroups() {
+        if (!created_) {
+            groups_ = make_groups_();
+            created_ = true;
+            // all parameters have been declared by now
+            check_param_overrides();
+        }
         return groups_;
     }
 
-    void runIf(Context &c, const predicate_t& predicate) {
-        cout << "Running benchmarks groups using timer " << timer_info_->getName() << endl;
-        for (auto& group : getGroups()) {
-            group->runIf(c, predicate);
+    /* run the groups in order, except those already run by --parallel-groups, whose results are replayed instead */
+    void runIf(Context &c, const GroupList& groups, const predicate_t& predicate, const ParallelResults& parallel) {
+        c.log() << "Running benchmarks groups using timer " << timer_info_->getName() << endl;
+        log_overhead_(c);
+        for (auto& group : groups) {
+            if (!parallel.replay(c, *group)) {
+                group->runIf(c, predicate);
+            }
         }
+        parallel.finish();
     }
 
     template <typename TIMER, typename... Args>
     static TimeredList create(Args&&... args) {
         auto t = new TIMER(std::forward<Args>(args)...);
-        return TimeredList(std::unique_ptr<TIMER>(t), make_benches<TIMER>());
+        return TimeredList(std::unique_ptr<TIMER>(t), make_benches<TIMER>, log_timer_overhead<TIMER>);
     }
 
 
     static std::vector<TimeredList>& getAll(Context& c) {
         if (all_.empty()) {
             all_.push_back(TimeredList::create<DefaultClockTimer>("high_resolution_clock"));
+#if !UARCH_BENCH_PORTABLE
+            all_.push_back(TimeredList::create<TscTimer>());
+#endif
 #if USE_LIBPFC
             all_.push_back(TimeredList::create<LibpfcTimer>(c));
 #endif
@@ -144,12 +199,27 @@ void listBenches(Context& c) {
     for (auto& group : benchList) {
         out << "-------------------------------------\n";
         out << "Benchmark group: " << group->getId() << "\n" << group->getDescription() << endl;
+        if (!group->getTags().empty()) {
+            out << "Group tags: " << container_to_string(group->getTags()) << endl;
+        }
         out << "-------------------------------------\n";
         group->printBenches(out);
         out << endl;
     }
 }
 
+/* list the parameters declared by the benchmark groups */
+void listParams(Context& c) {
+    using namespace table;
+    getForTimer(c).getGroups();
+    Table t;
+    t.newRow().add("Parameter").add("Description").add("Default");
+    for (auto& p : declared_params()) {
+        t.newRow().add(p.group + "/" + p.name).add(p.description).add(p.default_spec);
+    }
+    c.out() << t.str();
+}
+
 
 /* list the avaiable timers on stdout */
 void listTimers(Context& c) {
@@ -170,39 +240,130 @@ void handleTimerSpecificRun(Context& c) {
 }
 
 TimerArgs Context::getTimerArgs() {
-    return { arg_extraevents.Get() };
+    std::string events = arg_extraevents.Get();
+    auto derived = extract_derived_metrics(events);
+    return { events, arg_topdown.Get(), derived };
+}
+
+void Context::initTimer(bool derived_sink) {
+    timer_info_->init(*this);
+    add_derived_metrics(*timer_info_, getTimerArgs().derived_metrics);
+    if (derived_sink && !timer_info_->getDerivedMetrics().empty()) {
+        sink_.reset(new DerivedMetricSink(std::move(sink_)));
+    }
+    if (timer_info_->calibratedGHz() > 0 && arg_freq_check.Get() > 0) {
+        try {
+            freq_monitor_.reset(new FreqMonitor());
+        } catch (std::runtime_error& e) {
+            log() << "Frequency drift checks are off: " << e.what() << endl;
+        }
+    }
 }
 
 /** get the first available CPU based on the affinity mask */
 int getFirstAvailableCpu() {
-    cpu_set_t cpu_set;
-    if (sched_getaffinity(0, sizeof(cpu_set), &cpu_set)) {
-        throw std::runtime_error("failed while getting existing cpu affinity: " + errno_to_str(errno));
+    std::vector<int> cpus = get_allowed_cpus();
+    if (cpus.empty()) {
+        throw std::runtime_error("not allowed to run on any CPUs - impossible?");
+    }
+    return cpus.front();
+}
+
+void pinToThread(Context& c, int cpu) {
+    pin_to_cpu(cpu);
+    c.log() << "Pinned to CPU " << cpu << endl;
+}
+
+/**
+ * The allowed CPUs on the NUMA node given by --cpu-node, which must be called before the main thread is pinned.
+ */
+std::vector<int> Context::allowedNodeCpus() {
+    int node = arg_cpu_node.Get();
+    std::vector<int> allowed = get_allowed_cpus(), node_cpus = numa_node_cpus(node), cpus;
+    for (int cpu : allowed) {
+        if (std::find(node_cpus.begin(), node_cpus.end(), cpu) != node_cpus.end()) {
+            cpus.push_back(cpu);
+        }
+    }
+    if (cpus.empty()) {
+        fatal("none of the allowed CPUs %s are on NUMA node %d from --cpu-node", container_to_string(allowed).c_str(), node);
+    }
+    return cpus;
+}
+
+/**
+ * Determine the CPUs that multi-threaded benchmarks will use, based on the --cpus and --threads
+ * arguments. Must be called before the main thread is pinned, since the default is every CPU
+ * in the original affinity mask.
+ */
+std::vector<int> Context::calcThreadCpus() {
+    std::vector<int> allowed = get_allowed_cpus();
+    std::vector<int> cpus = arg_cpus ? parse_cpu_list(arg_cpus.Get()) : arg_cpu_node ? allowedNodeCpus() : allowed;
+    for (int cpu : cpus) {
+        if (std::find(allowed.begin(), allowed.end(), cpu) == allowed.end()) {
+            fatal("CPU %d from --cpus isn't in the allowed CPU set %s", cpu, container_to_string(allowed).c_str());
+        }
+        if (std::count(cpus.begin(), cpus.end(), cpu) > 1) {
+            fatal("CPU %d appears more than once in --cpus", cpu);
+        }
     }
-    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
-        if (CPU_ISSET(cpu, &cpu_set)) {
-            return cpu;
+    if (arg_threads) {
+        unsigned threads = arg_threads.Get();
+        if (threads == 0 || threads > cpus.size()) {
+            fatal("--threads must be between 1 and the number of available CPUs (%zu)", cpus.size());
         }
+        cpus.resize(threads);
     }
-    throw std::runtime_error("not allowed to run on any CPUs - impossible?");
+    return cpus;
 }
 
-void pinToThread(Context& c, int cpu) {
-    cpu_set_t cpuset;
-    CPU_ZERO(&cpuset);
-    CPU_SET(cpu, &cpuset);
-    if (sched_setaffinity(0, sizeof(cpuset), &cpuset)) {
-        throw std::runtime_error("failed to pin: " + errno_to_str(errno));
+/**
+ * Determine the sampling configuration from the --target-error, --min-samples and --max-samples arguments.
+ */
+SampleConfig Context::calcSampleConfig() {
+    SampleConfig config{arg_min_samples.Get(), arg_max_samples.Get(), 0};
+    if (arg_target_error) {
+        config.target_error = arg_target_error.Get();
+        if (!(config.target_error > 0 && config.target_error < 1)) {
+            fatal("--target-error must be greater than 0 and less than 1, but was %f", config.target_error);
+        }
+        if (config.min_samples > config.max_samples) {
+            fatal("--min-samples (%zu) must not be greater than --max-samples (%zu)", config.min_samples, config.max_samples);
+        }
     }
-    c.log() << "Pinned to CPU " << cpu << endl;
+    return config;
 }
 
 void Context::run() {
 
     handleTimerSpecificRun(*this);
 
+    // parameter overrides must be applied before the benchmarks are created
+    if (arg_param_file) {
+        load_param_file(arg_param_file.Get());
+    }
+    for (auto& assignment : arg_params.Get()) {
+        set_param(assignment);
+    }
+    // likewise the page backing, since some benchmarks allocate their regions when they are created
+    if (arg_page_size) {
+        set_page_backing(parse_page_backing(arg_page_size.Get()));
+    }
+    auto nodes = numa_nodes();
+    for (args::ValueFlag<int>* node : {&arg_mem_node, &arg_cpu_node}) {
+        if (*node && std::find(nodes.begin(), nodes.end(), node->Get()) == nodes.end()) {
+            fatal("NUMA node %d doesn't exist, the nodes are %s", node->Get(), container_to_string(nodes).c_str());
+        }
+    }
+    if (arg_mem_node) {
+        set_mem_node(arg_mem_node.Get());
+        log() << "Memory bound to NUMA node " << arg_mem_node.Get() << endl;
+    }
+
     if (arg_listtimers) {
         listTimers(*this);
+    } else if (arg_listparams) {
+        listParams(*this);
     } else if (arg_listbenches) {
         listBenches(*this);
     } else if (arg_clockoverhead) {
@@ -211,27 +372,69 @@ void Context::run() {
         std::cout << getTimerName();
         throw SilentSuccess();
     } else {
+        thread_cpus_ = calcThreadCpus();
+        if (arg_parallel_groups) {
+            parallel_cpus_ = parse_cpu_list(arg_parallel_groups.Get());
+            check_parallel_cpus(parallel_cpus_, get_allowed_cpus());
+        }
+        sample_config_ = calcSampleConfig();
+        if (arg_freq_check.Get() < 0) {
+            fatal("--freq-check must not be negative, but was %f", arg_freq_check.Get());
+        }
+        if (arg_stats.Get() != "min" && arg_stats.Get() != "full") {
+            fatal("--stats must be min or full, but was '%s'", arg_stats.Get().c_str());
+        }
+        if (arg_characterize_caches && arg_test_name) {
+            fatal("--characterize-caches selects its own tests, so it can't be combined with --test-name");
+        }
+
         // pinning should happen early since some timers rely on it in their init phase
-        pinToThread(*this, arg_pincpu ? arg_pincpu.Get() : getFirstAvailableCpu());
+        if (arg_cpu_node && arg_pincpu) {
+            auto node_cpus = numa_node_cpus(arg_cpu_node.Get());
+            if (std::find(node_cpus.begin(), node_cpus.end(), arg_pincpu.Get()) == node_cpus.end()) {
+                fatal("--pinned-cpu %d isn't on NUMA node %d from --cpu-node", arg_pincpu.Get(), arg_cpu_node.Get());
+            }
+        }
+        int main_cpu = arg_pincpu ? arg_pincpu.Get() : arg_cpu_node ? allowedNodeCpus().front() : getFirstAvailableCpu();
+        pinToThread(*this, main_cpu);
+
+        // large regions are built using only the CPUs we were told to run on, rather than every allowed one
+        std::vector<int> helper_cpus = thread_cpus_;
+        helper_cpus.push_back(main_cpu);
+        std::sort(helper_cpus.begin(), helper_cpus.end());
+        helper_cpus.erase(std::unique(helper_cpus.begin(), helper_cpus.end()), helper_cpus.end());
+        set_helper_cpus(helper_cpus);
+
+        // --characterize-caches is a shortcut for running just the cache characterization group
+        bool by_name = arg_test_name || arg_characterize_caches;
+        std::string test_name = arg_characterize_caches ? "memory/characterize-caches/*" : arg_test_name.Get();
+        if (by_name) {
+            // don't bother creating the benchmarks in groups that can't contain a matching one
+            WildcardMatcher matcher{test_name};
+            set_group_filter([=](const std::string& id){ return matcher.matchesPrefix(id + "/"); });
+        }
 
         TimeredList& toRun = getForTimer(*this);
         timer_info_ = &toRun.getTimerInfo();
+        if (arg_topdown && timer_info_->getName() != "perf") {
+            fatal("--topdown needs the perf timer (--timer=perf), not %s", timer_info_->getName().c_str());
+        }
 
         // after this point, the timer_info_ field is initialized, so if your behavior needs that, put it here
         if (arg_listevents) {
             timer_info_->listEvents(*this);
         } else {
-            timer_info_->init(*this);
             predicate_t pred;
-            if (!arg_test_tag && !arg_test_name) {
+            if (!arg_test_tag && !by_name) {
                 // no predicates specified on the command line, use tag=* as default predicate
                 TagMatcher matcher{"default"};
                 pred = [matcher](const Benchmark& b){ return matcher(b->getTags()); };
             } else {
                 // otherwise AND-together all set predicates
                 pred = [](const Benchmark& b){ return true; };
-                if (arg_test_name) {
-                    pred = [this](const Benchmark& b){ return wildcard_match(b->getPath(), arg_test_name.Get()); };
+                if (by_name) {
+                    WildcardMatcher matcher{test_name};
+                    pred = [=](const Benchmark& b){ return matcher(b->getPath()); };
                 }
                 if (arg_test_tag) {
                     TagMatcher matcher{arg_test_tag.Get()};
@@ -239,7 +442,16 @@ void Context::run() {
                 }
             }
 
-            toRun.runIf(*this, pred);
+            const GroupList& groups = toRun.getGroups();
+            ParallelResults parallel;
+            if (arg_parallel_groups) {
+                // the workers initialize their own timer, so this happens before the timer init below
+                parallel = run_parallel_groups(*this, groups, pred, parallel_cpus_);
+            }
+
+            initTimer();
+            toRun.runIf(*this, groups, pred, parallel);
+            getSink().finish(*this);
         }
     }
 }
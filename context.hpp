@@ -6,11 +6,28 @@
 #define CONTEXT_HPP_
 
 #include <iosfwd>
+#include <memory>
 
 #include "args.hxx"
 #include "timer-info.hpp"
 #include "util.hpp"
 
+class FreqMonitor;
+class ResultSink;
+
+/*
+ * Controls how many samples are taken by benchmarks which support adaptive sampling. If target_error
+ * is zero, sampling isn't adaptive and those benchmarks take their usual fixed number of samples.
+ */
+struct SampleConfig {
+    /* the minimum and maximum number of samples to take, including any warmup samples */
+    size_t min_samples, max_samples;
+    /* stop sampling once the estimate is stable within this relative error */
+    double target_error;
+
+    bool isAdaptive() const { return target_error > 0; }
+};
+
 /* Context object couldn't be created but error information was already emitted */
 class SilentFailure {};
 /* Context object couldn't be created, but we treat it as a success (e.g., when --help is asked for) */
@@ -26,6 +43,8 @@ public:
 
     Context(int argc, char **argv, std::ostream *out);
 
+    ~Context();
+
     /* return the stream for error output */
     std::ostream& err() { return *err_; }
 
@@ -35,6 +54,9 @@ public:
     /* return the stream for benchmark result output */
     std::ostream& out() { return *out_; }
 
+    /* return the sink that benchmark results should be reported to */
+    ResultSink& getSink() { return *sink_; }
+
     /* return the argc origianlly passed to the process */
     int argc() { return argc_; }
 
@@ -70,13 +92,55 @@ public:
     /* get the TimerArgs for the current context */
     TimerArgs getTimerArgs();
 
+    /**
+     * Initialize the selected timer, and add its derived metrics (if any) to the results. With derived_sink false,
+     * the sink isn't wrapped to append the derived values, so results only have the measured metrics: this is for
+     * --parallel-groups workers, whose results get their derived values when they're replayed into the real sink.
+     */
+    void initTimer(bool derived_sink = true);
+
+    /* the sampling configuration to use for benchmarks which support adaptive sampling */
+    const SampleConfig& getSampleConfig() { return sample_config_; }
+
+    /* true if the full distribution of sample results should be reported, rather than only the aggregate */
+    bool fullStats() { return arg_stats.Get() == "full" || getHistogramBuckets(); }
+
+    /* the number of buckets for sample histograms, or 0 if histograms weren't requested */
+    unsigned getHistogramBuckets() { return arg_histogram.Get(); }
+
+    /* the monitor used to check the frequency while each benchmark runs, or nullptr if the check is off */
+    FreqMonitor* getFreqMonitor() { return freq_monitor_.get(); }
+
+    /* the relative difference from the calibrated frequency above which a benchmark's frequency is flagged */
+    double getFreqTolerance() { return arg_freq_check.Get() / 100; }
+
+    /* the number of times to rerun a benchmark whose frequency was flagged */
+    unsigned getFreqReruns() { return arg_freq_reruns.Get(); }
+
+    /* the CPUs, one per thread, that multi-threaded benchmarks should run on */
+    const std::vector<int>& getThreadCpus() { return thread_cpus_; }
+
+    /*
+     * Send the result output (and the error and log output, where they go to the same stream) to out, and
+     * results to sink instead, returning the previous sink. Used to capture the output of --parallel-groups
+     * workers and of each event batch.
+     */
+    std::unique_ptr<ResultSink> redirect(std::ostream* out, std::unique_ptr<ResultSink> sink);
+
 private:
     std::ostream *err_, *log_, *out_;
     TimerInfo *timer_info_;
+    std::unique_ptr<ResultSink> sink_;
+    std::unique_ptr<FreqMonitor> freq_monitor_;
     int argc_;
     char **argv_;
     bool verbose_;
+    std::vector<int> thread_cpus_, parallel_cpus_;
+    SampleConfig sample_config_{};
 
+    std::vector<int> allowedNodeCpus();
+    std::vector<int> calcThreadCpus();
+    SampleConfig calcSampleConfig();
 
     args::ArgumentParser parser{"uarch-bench: A CPU micro-architecture benchmark"};
     args::HelpFlag help{parser, "help", "Display this help menu", {'h', "help"}};
@@ -88,10 +152,50 @@ private:
     args::ValueFlag<unsigned int> arg_default_precision{parser, "PRECISION", "Use the specified number of decimal places"
             " to report values from most benchmarks", {"precision"}, (unsigned int)DEFAULT_PRECISION};
     args::ValueFlag<std::string> arg_test_name{parser, "PATTERN", "Run only tests with name matching the given pattern", {"test-name"}};
+    args::Flag arg_characterize_caches{parser, "characterize-caches", "Find the capacity and latency of each cache level"
+            " with an adaptive sweep of pointer chasing loads over region sizes, then compare them to sysfs (x86 only)", {"characterize-caches"}};
     args::ValueFlag<std::string> arg_test_tag{parser, "PATTERN", "Run only the tests with a tag matching the given pattern", {"test-tag"}};
     args::Flag arg_listevents{parser, "list-events", "Display the extra available events associated with the timer", {"list-events"}};
-    args::ValueFlag<std::string> arg_extraevents{parser, "extra-events", "A comma separated list of extra timer-specific events to track", {"extra-events"}};
+    args::ValueFlag<std::string> arg_extraevents{parser, "extra-events", "A comma separated list of extra timer-specific events to track."
+            " If there are more than fit in the counters, each benchmark runs once per batch of events. With the perf"
+            " timer, an event containing * is a wildcard over the available events. An entry NAME=EXPR adds a metric"
+            " computed from the others, e.g., IPC=INST_RETIRED.ANY/Cycles", {"extra-events"}};
+    args::Flag arg_topdown{parser, "topdown", "With the perf timer, count the events for a level 1 and 2 top-down"
+            " breakdown of each benchmark and report the percentage of pipeline slots in each category", {"topdown"}};
     args::ValueFlag<int> arg_pincpu{parser, "pinned-cpu", "All tests will be pinned this CPU to (defaults to first available CPU)", {'c', "pinned-cpu"}, 0};
+    args::ValueFlag<std::string> arg_output_format{parser, "FORMAT", "Format for benchmark results: text (the default),"
+            " json (one JSON object per line) or csv. Non-result output goes to stderr for json and csv", {"output-format"}, "text"};
+    args::ValueFlagList<std::string> arg_params{parser, "NAME=SPEC", "Override the values of a benchmark parameter, e.g.,"
+            " kib=16..65536:x2 or memory/load-parallel/kib=32,64 (see --list-params)", {"param"}};
+    args::ValueFlag<std::string> arg_param_file{parser, "FILE", "Read parameter overrides from FILE, one NAME=SPEC per line", {"param-file"}};
+    args::Flag arg_listparams{parser, "list-params", "Display the benchmark parameters which can be set with --param", {"list-params"}};
+    args::ValueFlag<std::string> arg_save_baseline{parser, "FILE", "Save the results to FILE, for later use with --compare-baseline", {"save-baseline"}};
+    args::ValueFlag<std::string> arg_compare_baseline{parser, "FILE", "Compare the results against those saved in FILE with"
+            " --save-baseline, and flag results that changed by more than their noise", {"compare-baseline"}};
+    args::ValueFlag<std::string> arg_cpus{parser, "CPU-LIST", "CPUs used by multi-threaded tests, one thread per CPU, as a list like 0-3,8 (defaults to all available CPUs)", {"cpus"}};
+    args::ValueFlag<std::string> arg_stats{parser, "STATS", "Statistics to report: min (the default) reports only the"
+            " aggregated result, full also reports the min, p10, p50, p90, max and stddev of the samples", {"stats"}, "min"};
+    args::ValueFlag<unsigned int> arg_histogram{parser, "BUCKETS", "Also report a histogram of the samples for the"
+            " first metric, with the given number of buckets (implies --stats=full)", {"histogram"}, 0};
+    args::ValueFlag<double> arg_target_error{parser, "ERROR", "Enable adaptive sampling: keep taking samples until the result"
+            " is stable within this relative error (e.g., 0.01 for 1%), rather than taking a fixed number of samples", {"target-error"}};
+    args::ValueFlag<unsigned int> arg_min_samples{parser, "SAMPLES", "Minimum number of samples with --target-error", {"min-samples"}, 10};
+    args::ValueFlag<unsigned int> arg_max_samples{parser, "SAMPLES", "Maximum number of samples with --target-error", {"max-samples"}, 1000};
+    args::ValueFlag<std::string> arg_parallel_groups{parser, "CPU-LIST", "Run groups tagged core-local, which don't use"
+            " resources shared between cores, in parallel, one group at a time on each of the given CPUs, which should be"
+            " on distinct physical cores", {"parallel-groups"}};
+    args::ValueFlag<double> arg_freq_check{parser, "PERCENT", "With the clock and tsc timers, which convert time to"
+            " cycles, warn about benchmarks during which the effective CPU frequency differed from the calibrated"
+            " one by more than PERCENT (default 5), or 0 to turn the check off", {"freq-check"}, 5};
+    args::ValueFlag<unsigned int> arg_freq_reruns{parser, "RERUNS", "Rerun a benchmark flagged by --freq-check up to"
+            " RERUNS times, hoping for a run at the calibrated frequency", {"freq-reruns"}, 0};
+    args::ValueFlag<std::string> arg_page_size{parser, "SIZE", "The pages backing the benchmark regions: thp (transparent"
+            " huge pages, the default), 4k, or 2m or 1g for reserved hugetlbfs pages. Any but the default is checked and"
+            " an error if not obtained", {"page-size"}};
+    args::ValueFlag<int> arg_mem_node{parser, "NODE", "Bind the memory used by the benchmarks to the given NUMA node", {"mem-node"}};
+    args::ValueFlag<int> arg_cpu_node{parser, "NODE", "Run on the CPUs of the given NUMA node: the main thread is pinned to"
+            " the first of them, and multi-threaded tests use them unless --cpus is given", {"cpu-node"}};
+    args::ValueFlag<unsigned int> arg_threads{parser, "THREADS", "Number of threads used by multi-threaded tests, taken from the start of the --cpus list", {"threads"}};
 
 
     // internal flags: these aren't displayed to the user via help, but are used by some wrapper script to interact with the
@@ -46,11 +46,14 @@ void make_strided_stores(M& maker, size_t data_size) {
                             [=]{ return new mem_args(crossingargs); });
     }
 
-    for (size_t stride : {1, 2, 4, 8, 16, 32, 64, 128}) {
-        for (size_t kib : {4, 8, 16, 32, 64, 128, 256, 512, 1024, 2048}) {
+    auto& group = maker.getGroup();
+    for (size_t stride : group.param("stride", "Store stride in bytes", "1..128:x2", 1, 4096)) {
+        for (size_t kib : group.param("kib", "Region size in KiB (power of two)", "4..2048:x2", 1, 1024 * 1024)) {
             size_t region_bytes = kib * 1024;
-            size_t access_per_region = region_bytes / stride;
-            assert(is_pow2(kib));
+            size_t access_per_region = std::max(region_bytes / stride, (size_t)1);
+            if (!is_pow2(kib)) {
+                throw std::runtime_error(string_format("kib for %s must be a power of two, but was %zu", group.getId().c_str(), kib));
+            }
             auto stride_str = std::to_string(stride);
             std::string region = std::to_string(kib) + " KiB";
             mem_args args{(char *)aligned_ptr(64, (kib + 1) * 1024), stride, region_bytes - 1};
@@ -68,6 +71,7 @@ void register_cpp(GroupList& list) {
 
     std::shared_ptr<BenchmarkGroup> cpp_group = std::make_shared<BenchmarkGroup>("cpp", "Tests written in C++");
     list.push_back(cpp_group);
+    cpp_group->setTags({"core-local"});
 
     {
         auto maker = DeltaMaker<TIMER>(cpp_group.get()).useLoopDelta();
@@ -153,6 +157,7 @@ void register_cpp(GroupList& list) {
     {
         std::shared_ptr<BenchmarkGroup> group = std::make_shared<BenchmarkGroup>("transcendental", "Timing math.h functions");
         list.push_back(group);
+        group->setTags({"core-local"});
         auto maker        = DeltaMaker<TIMER>(group.get(), 100000);
 
         #define MAKE_TRAN_BENCH(name) \
@@ -186,6 +186,126 @@ long shuffled_list_sum(uint64_t iters, void *arg) {
     return sum;
 }
 
+long pointer_chase(uint64_t iters, void *arg) {
+    region* r = (region*)arg;
+    void* p = r->start;
+    while (iters-- > 0) {
+        p = *(void**)p;
+    }
+    r->start = p;
+    return (long)p;
+}
+
+long linear_read(uint64_t iters, void *arg) {
+    region* r = (region*)arg;
+    const uint64_t* p = (const uint64_t*)r->start;
+    const size_t words = r->size / sizeof(uint64_t);
+    // a sum per word in the line, so the adds aren't a bottleneck
+    uint64_t s0 = 0, s1 = 0, s2 = 0, s3 = 0, s4 = 0, s5 = 0, s6 = 0, s7 = 0;
+    static_assert(UB_CACHE_LINE_SIZE == 8 * sizeof(uint64_t), "one line per iteration");
+    for (size_t i = 0; iters-- > 0; ) {
+        s0 += p[i + 0]; s1 += p[i + 1]; s2 += p[i + 2]; s3 += p[i + 3];
+        s4 += p[i + 4]; s5 += p[i + 5]; s6 += p[i + 6]; s7 += p[i + 7];
+        i += 8;
+        if (i == words) {
+            i = 0;
+        }
+    }
+    return s0 + s1 + s2 + s3 + s4 + s5 + s6 + s7;
+}
+
+/*
+ * Take the given number of turns at the line, stopping early if stop is set. Our turns are when the value has
+ * the given parity, and each one hands the line to the other side by incrementing it.
+ */
+template <C2CHandoff H>
+static void c2c_turns(c2c_line* line, uint64_t turns, uint64_t parity) {
+    uint64_t v = line->value.load(std::memory_order_relaxed);
+    v += (v & 1) != parity;  // the value at our next turn
+    for (; turns > 0; turns--, v += 2) {
+        if (H == C2CHandoff::CMPXCHG) {
+            uint64_t expected = v;
+            while (!line->value.compare_exchange_weak(expected, v + 1, std::memory_order_acq_rel)) {
+                if (line->stop.load(std::memory_order_relaxed)) {
+                    return;
+                }
+                expected = v;
+            }
+        } else {
+            while (line->value.load(std::memory_order_acquire) != v) {
+                if (line->stop.load(std::memory_order_relaxed)) {
+                    return;
+                }
+            }
+            if (H == C2CHandoff::XADD) {
+                line->value.fetch_add(1, std::memory_order_acq_rel);
+            } else {
+                line->value.store(v + 1, std::memory_order_release);
+            }
+        }
+    }
+}
+
+long c2c_load_store(uint64_t iters, void *arg) {
+    c2c_turns<C2CHandoff::LOAD_STORE>((c2c_line*)arg, iters, 0);
+    return 0;
+}
+
+long c2c_xadd(uint64_t iters, void *arg) {
+    c2c_turns<C2CHandoff::XADD>((c2c_line*)arg, iters, 0);
+    return 0;
+}
+
+long c2c_cmpxchg(uint64_t iters, void *arg) {
+    c2c_turns<C2CHandoff::CMPXCHG>((c2c_line*)arg, iters, 0);
+    return 0;
+}
+
+void c2c_partner(C2CHandoff handoff, c2c_line* line) {
+    const uint64_t forever = std::numeric_limits<uint64_t>::max();
+    switch (handoff) {
+    case C2CHandoff::LOAD_STORE: c2c_turns<C2CHandoff::LOAD_STORE>(line, forever, 1); break;
+    case C2CHandoff::XADD:       c2c_turns<C2CHandoff::XADD>      (line, forever, 1); break;
+    case C2CHandoff::CMPXCHG:    c2c_turns<C2CHandoff::CMPXCHG>   (line, forever, 1); break;
+    }
+}
+
+long atomic_lock_add(uint64_t iters, void *arg) {
+    auto counter = (std::atomic<uint64_t>*)arg;
+    while (iters-- > 0) {
+        counter->fetch_add(1);
+    }
+    return 0;
+}
+
+long atomic_xadd(uint64_t iters, void *arg) {
+    auto counter = (std::atomic<uint64_t>*)arg;
+    uint64_t sum = 0;
+    while (iters-- > 0) {
+        sum += counter->fetch_add(1);
+    }
+    return sum;
+}
+
+long atomic_cmpxchg(uint64_t iters, void *arg) {
+    auto counter = (std::atomic<uint64_t>*)arg;
+    uint64_t v = counter->load(std::memory_order_relaxed);
+    while (iters-- > 0) {
+        // a failure loads the current value into v, so just try again
+        while (!counter->compare_exchange_weak(v, v + 1)) {}
+    }
+    return v;
+}
+
+long atomic_xchg(uint64_t iters, void *arg) {
+    auto counter = (std::atomic<uint64_t>*)arg;
+    uint64_t sum = 0;
+    while (iters-- > 0) {
+        sum += counter->exchange(iters);
+    }
+    return sum;
+}
+
 long gettimeofday_bench(uint64_t iters, void *arg) {
     struct timeval tv;
     for (uint64_t i = 0; i < iters; i++) {
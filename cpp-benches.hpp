@@ -6,7 +6,10 @@
 #define CPP_BENCHES_HPP_
 
 #include "bench-declarations.h"
+#include "util.hpp"
 
+#include <atomic>
+#include <cstdint>
 #include <stdlib.h>
 
 // division benches
@@ -41,6 +44,49 @@ DIV_BENCH_X(DECL_BENCH)
 bench2_f linkedlist_sentinel;
 bench2_f linkedlist_counter;
 bench2_f shuffled_list_sum;
+/*
+ * Chases the pointers starting at region::start, one dependent load per iteration, and leaves region::start
+ * where it stopped, so that the next call carries on around the cycle rather than repeating the same part.
+ */
+bench2_f pointer_chase;
+/* reads one line of the region per iteration, in order, wrapping around at the end */
+bench2_f linear_read;
+
+/*
+ * A cache line bounced between two threads by the c2c benchmarks. The threads take turns: the benchmark thread
+ * moves the value from even to odd and the partner thread from odd to even, so each iteration of a c2c benchmark
+ * is one round trip of the line.
+ */
+struct alignas(UB_CACHE_LINE_SIZE) c2c_line {
+    std::atomic<uint64_t> value{0};
+    // on a line of its own, so that polling it doesn't disturb the handoff
+    alignas(UB_CACHE_LINE_SIZE) std::atomic<bool> stop{false};
+};
+
+enum class C2CHandoff {
+    /* spin on loads until it is our turn, then a plain store */
+    LOAD_STORE,
+    /* spin on loads until it is our turn, then lock xadd */
+    XADD,
+    /* spin on lock cmpxchg until it succeeds */
+    CMPXCHG
+};
+
+bench2_f c2c_load_store;
+bench2_f c2c_xadd;
+bench2_f c2c_cmpxchg;
+
+/* the other side of the c2c benchmark with the given handoff, which takes its turns until c2c_line::stop is set */
+void c2c_partner(C2CHandoff handoff, c2c_line* line);
+
+/*
+ * One atomic read-modify-write per iteration on the 64-bit counter at arg, which other threads may be hammering
+ * too: lock add (the result is unused), lock xadd, a lock cmpxchg increment loop, and xchg.
+ */
+bench2_f atomic_lock_add;
+bench2_f atomic_xadd;
+bench2_f atomic_cmpxchg;
+bench2_f atomic_xchg;
 bench2_f gettimeofday_bench;
 
 constexpr int LIST_COUNT = 4000;
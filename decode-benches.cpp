@@ -94,6 +94,7 @@ void register_decode(GroupList& list) {
     BOOST_PP_REPEAT_FROM_TO(48, 50, MAKE_QUAD, ignore)
 
     list.push_back(group);
+    group->setTags({"core-local"});
 
 
 #endif // #if !UARCH_BENCH_PORTABLE
@@ -71,6 +71,7 @@ void register_default(GroupList& list) {
 #if !UARCH_BENCH_PORTABLE
     std::shared_ptr<BenchmarkGroup> default_group = std::make_shared<BenchmarkGroup>("basic", "Basic Benchmarks");
     list.push_back(default_group);
+    default_group->setTags({"core-local"});
 
     auto maker = DeltaMaker<TIMER>(default_group.get()).setTags({"default"});
 
@@ -0,0 +1,245 @@
+/*
+ * derived-metrics.cpp
+ */
+
+#include "derived-metrics.hpp"
+#include "util.hpp"
+
+#include <cassert>
+#include <cctype>
+#include <cstdlib>
+#include <stdexcept>
+
+using namespace std;
+
+/* characters which can appear in a name in an expression, after the first */
+static bool is_name_char(char c) {
+    return isalnum((unsigned char)c) || c == '_' || c == '.' || c == ':' || c == '%';
+}
+
+/* true if s is a valid NAME for a derived metric, which unlike names in expressions can't contain : */
+static bool is_metric_name(const std::string& s) {
+    if (s.empty() || !(isalpha((unsigned char)s[0]) || s[0] == '_')) {
+        return false;
+    }
+    for (char c : s) {
+        if (!is_name_char(c) || c == ':') {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool equals_ignore_case(const std::string& a, const std::string& b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); i++) {
+        if (tolower((unsigned char)a[i]) != tolower((unsigned char)b[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * A recursive descent parser for:
+ *
+ * expr    := term (('+' | '-') term)*
+ * term    := unary (('*' | '/') unary)*
+ * unary   := '-' unary | primary
+ * primary := number | name | '(' expr ')'
+ *
+ * which appends the ops for each part in postfix order as it goes.
+ */
+class ExprParser {
+    const std::string& text;
+    const MetricExpr::lookup_f& lookup;
+    size_t pos = 0;
+
+    using Op = MetricExpr::Op;
+
+    std::vector<Op>& ops;
+
+    void push(Op::Kind kind, double value = 0, size_t metric = 0) {
+        ops.push_back(Op{kind, value, metric});
+    }
+
+    char peek() {
+        while (pos < text.size() && isspace((unsigned char)text[pos])) {
+            pos++;
+        }
+        return pos < text.size() ? text[pos] : '\0';
+    }
+
+    [[noreturn]] void error(const std::string& what) {
+        throw std::runtime_error(string_format("%s at position %zu in expression '%s'", what.c_str(), pos + 1, text.c_str()));
+    }
+
+public:
+    ExprParser(const std::string& text, const MetricExpr::lookup_f& lookup, std::vector<Op>& ops)
+        : text(text), lookup(lookup), ops(ops) {}
+
+    void parse() {
+        expr();
+        if (peek()) {
+            error(string_format("unexpected '%c'", peek()));
+        }
+    }
+
+    void expr() {
+        term();
+        for (char c; (c = peek()) == '+' || c == '-'; ) {
+            pos++;
+            term();
+            push(c == '+' ? Op::ADD : Op::SUB);
+        }
+    }
+
+    void term() {
+        unary();
+        for (char c; (c = peek()) == '*' || c == '/'; ) {
+            pos++;
+            unary();
+            push(c == '*' ? Op::MUL : Op::DIV);
+        }
+    }
+
+    void unary() {
+        if (peek() == '-') {
+            pos++;
+            unary();
+            push(Op::NEG);
+        } else {
+            primary();
+        }
+    }
+
+    void primary() {
+        char c = peek();
+        if (c == '(') {
+            pos++;
+            expr();
+            if (peek() != ')') {
+                error("missing ')'");
+            }
+            pos++;
+        } else if (isdigit((unsigned char)c) || c == '.') {
+            const char* start = text.c_str() + pos;
+            char* end;
+            double value = strtod(start, &end);
+            if (end == start) {
+                error("bad number");
+            }
+            pos += end - start;
+            push(Op::CONST, value);
+        } else if (isalpha((unsigned char)c) || c == '_') {
+            size_t start = pos;
+            while (pos < text.size() && is_name_char(text[pos])) {
+                pos++;
+            }
+            push(Op::METRIC, 0, lookup(text.substr(start, pos - start)));
+        } else {
+            error(c ? string_format("unexpected '%c'", c) : std::string("unexpected end"));
+        }
+    }
+};
+
+MetricExpr::MetricExpr(const std::string& text, const lookup_f& lookup) {
+    ExprParser(text, lookup, ops).parse();
+}
+
+double MetricExpr::eval(const std::vector<double>& values) const {
+    std::vector<double> stack;
+    for (auto& op : ops) {
+        if (op.kind == Op::CONST) {
+            stack.push_back(op.value);
+        } else if (op.kind == Op::METRIC) {
+            stack.push_back(values.at(op.metric));
+        } else if (op.kind == Op::NEG) {
+            stack.back() = -stack.back();
+        } else {
+            double b = stack.back();
+            stack.pop_back();
+            double& a = stack.back();
+            switch (op.kind) {
+            case Op::ADD: a += b; break;
+            case Op::SUB: a -= b; break;
+            case Op::MUL: a *= b; break;
+            case Op::DIV: a /= b; break;
+            default: assert(false);
+            }
+        }
+    }
+    assert(stack.size() == 1);
+    return stack.back();
+}
+
+std::vector<std::string> extract_derived_metrics(std::string& extra_events) {
+    std::vector<std::string> definitions;
+    std::string events;
+    size_t start = 0;
+    while (start <= extra_events.size()) {
+        // find the end of this entry: for definitions that is the next comma, while for events commas
+        // between / characters don't count, as in parsePerfEvents
+        size_t end = start;
+        auto eq = extra_events.find('=', start);
+        bool is_definition = eq != std::string::npos && is_metric_name(extra_events.substr(start, eq - start));
+        for (bool inslash = false; end < extra_events.size() && (extra_events[end] != ',' || inslash); end++) {
+            if (!is_definition && extra_events[end] == '/') {
+                inslash = !inslash;
+            }
+        }
+        std::string entry = extra_events.substr(start, end - start);
+        if (is_definition) {
+            definitions.push_back(entry);
+        } else if (!entry.empty()) {
+            events += (events.empty() ? "" : ",") + entry;
+        }
+        start = end + 1;
+    }
+    extra_events = events;
+    return definitions;
+}
+
+void add_derived_metrics(TimerInfo& timer, const std::vector<std::string>& definitions) {
+    std::vector<std::string> event_names = timer.getEventNames();
+    for (auto& def : definitions) {
+        auto eq = def.find('=');
+        std::string name = def.substr(0, eq);
+        if (eq == std::string::npos || !is_metric_name(name)) {
+            throw std::runtime_error("derived metric '" + def + "' should look like NAME=EXPR");
+        }
+        // includes the metrics derived so far
+        auto& metric_names = timer.getMetricNames();
+        auto lookup = [&](const std::string& ref) -> size_t {
+            for (size_t i = 0; i < metric_names.size(); i++) {
+                if (equals_ignore_case(ref, metric_names[i])) {
+                    return i;
+                }
+                if (i < event_names.size()) {
+                    // libpfm4 event names have a PMU prefix like skl::, which can be left out
+                    auto& event = event_names[i];
+                    auto colons = event.find("::");
+                    if (equals_ignore_case(ref, event) || (colons != std::string::npos && equals_ignore_case(ref, event.substr(colons + 2)))) {
+                        return i;
+                    }
+                }
+            }
+            throw std::runtime_error("derived metric " + name + " uses '" + ref + "' which isn't a metric or event name,"
+                    " the metrics are: " + container_to_string(metric_names));
+        };
+        MetricExpr expr(def.substr(eq + 1), lookup);
+        timer.addDerivedMetric({name, [expr](const std::vector<double>& values) { return expr.eval(values); }});
+    }
+}
+
+void append_derived_metrics(const TimerInfo& timer, std::vector<double>& values) {
+    if (values.size() != timer.measuredMetricCount()) {
+        throw std::logic_error(string_format("a result has %zu values but the timer measures %zu metrics",
+                values.size(), timer.measuredMetricCount()));
+    }
+    for (auto& d : timer.getDerivedMetrics()) {
+        values.push_back(d.compute(values));
+    }
+}
@@ -0,0 +1,67 @@
+/*
+ * derived-metrics.hpp
+ *
+ * User-defined metrics computed from the measured ones, given in --extra-events as NAME=EXPR alongside the
+ * events, e.g., IPC=INST_RETIRED.ANY/Cycles or L1MPKI=1000*L1D.REPLACEMENT/INST_RETIRED.ANY.
+ *
+ * An EXPR is made of numbers, the operators + - * / and parentheses, and names, which refer to a metric
+ * by its full event name, its column header or the NAME of an earlier derived metric, ignoring case.
+ * The expressions are evaluated on the normalized results, so ratios of events are unaffected by the
+ * normalization, but absolute counts are per operation.
+ */
+
+#ifndef DERIVED_METRICS_HPP_
+#define DERIVED_METRICS_HPP_
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "timer-info.hpp"
+
+/**
+ * An arithmetic expression over the metric values, compiled to a small stack machine.
+ */
+class MetricExpr {
+public:
+    /* returns the index of the metric with the given name, or throws std::runtime_error if there isn't one */
+    using lookup_f = std::function<size_t (const std::string& name)>;
+
+    /* parse the given expression, throwing std::runtime_error if it is malformed */
+    MetricExpr(const std::string& text, const lookup_f& lookup);
+
+    double eval(const std::vector<double>& values) const;
+
+private:
+    friend class ExprParser;
+
+    struct Op {
+        enum Kind { CONST, METRIC, NEG, ADD, SUB, MUL, DIV } kind;
+        double value;
+        size_t metric;
+    };
+    std::vector<Op> ops;
+};
+
+/**
+ * Remove any NAME=EXPR derived metric definitions from the given --extra-events string and return them,
+ * leaving only the events. An entry is a definition if everything before its first = is a valid name,
+ * which distinguishes it from event strings like cpu/event=0x3c/ or INST_RETIRED:ANY_P:c=1.
+ */
+std::vector<std::string> extract_derived_metrics(std::string& extra_events);
+
+/**
+ * Parse the given NAME=EXPR definitions and add them to the timer as derived metrics. The names in each EXPR
+ * are looked up in the timer's metric names and event names (see TimerInfo::getEventNames), and the names of
+ * the definitions before it. Throws std::runtime_error if a definition is malformed or uses an unknown name.
+ */
+void add_derived_metrics(TimerInfo& timer, const std::vector<std::string>& definitions);
+
+/**
+ * Append the values of the timer's derived metrics to the given values of its measured metrics, so that they
+ * line up with TimerInfo::getMetricNames(). Throws std::logic_error if there isn't exactly one value for each
+ * measured metric.
+ */
+void append_derived_metrics(const TimerInfo& timer, std::vector<double>& values);
+
+#endif /* DERIVED_METRICS_HPP_ */
@@ -0,0 +1,87 @@
+/*
+ * freq-monitor.cpp
+ */
+
+#include "freq-monitor.hpp"
+#include "util.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/* open a user-mode only hardware counter for the calling thread, in the group of leader unless it is -1 */
+static int open_counter(uint64_t config, int leader) {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.read_format = PERF_FORMAT_GROUP;
+    // kernel counting usually isn't allowed, and the benchmarks run in user mode anyway
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    int fd = syscall(__NR_perf_event_open, &attr, 0, -1, leader, 0);
+    if (fd < 0) {
+        throw std::runtime_error(string_format("couldn't open the %s counter: %s",
+                config == PERF_COUNT_HW_CPU_CYCLES ? "cycles" : "ref-cycles", errno_to_str(errno).c_str()));
+    }
+    return fd;
+}
+
+FreqMonitor::FreqMonitor() {
+    leader_fd_ = open_counter(PERF_COUNT_HW_CPU_CYCLES, -1);
+    try {
+        ref_fd_ = open_counter(PERF_COUNT_HW_REF_CPU_CYCLES, leader_fd_);
+        // some user mode code has run since the counters were opened, so both should have counted something
+        Counts counts = read();
+        if (counts.cycles == 0 || counts.ref_cycles == 0) {
+            throw std::runtime_error(counts.cycles == 0 ? "the cycles counter isn't counting" : "the ref-cycles counter isn't counting");
+        }
+    } catch (...) {
+        close(leader_fd_);
+        if (ref_fd_ >= 0) {
+            close(ref_fd_);
+        }
+        throw;
+    }
+
+    // the reference rate is measured against the steady clock over a few short busy intervals, taking the
+    // highest since interrupts only lose reference cycles
+    for (int i = 0; i < 5; i++) {
+        auto c0 = read();
+        auto n0 = nanos();
+        while (nanos() - n0 < 10 * 1000 * 1000) {}
+        auto c1 = read();
+        auto n1 = nanos();
+        ref_ghz_ = std::max(ref_ghz_, (double)(c1.ref_cycles - c0.ref_cycles) / (n1 - n0));
+    }
+}
+
+FreqMonitor::~FreqMonitor() {
+    close(ref_fd_);
+    close(leader_fd_);
+}
+
+FreqMonitor::Counts FreqMonitor::read() {
+    // the format for PERF_FORMAT_GROUP: the number of events, then the value of each
+    uint64_t values[3];
+    if (::read(leader_fd_, values, sizeof(values)) != sizeof(values) || values[0] != 2) {
+        throw std::runtime_error("failed to read the frequency monitor counters: " + errno_to_str(errno));
+    }
+    return {values[1], values[2]};
+}
+
+void FreqMonitor::start() {
+    start_ = read();
+}
+
+double FreqMonitor::stop() {
+    auto end = read();
+    uint64_t ref_cycles = end.ref_cycles - start_.ref_cycles;
+    return ref_cycles ? ref_ghz_ * (end.cycles - start_.cycles) / ref_cycles : 0;
+}
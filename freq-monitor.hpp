@@ -0,0 +1,47 @@
+/*
+ * freq-monitor.hpp
+ *
+ * Detection of CPU frequency changes while the benchmarks run, e.g., due to turbo, thermal throttling or an
+ * AVX license change. The clock and tsc timers convert time to cycles using the frequency calibrated at
+ * startup, so if the frequency shifts mid-run, the cycle counts of every later benchmark are silently wrong.
+ *
+ * The monitor counts core cycles and reference cycles (the perf cycles and ref-cycles events) across each
+ * benchmark. Reference cycles tick at a fixed rate regardless of the core frequency, so the ratio of the two
+ * gives the effective frequency while the benchmark ran.
+ */
+
+#ifndef FREQ_MONITOR_HPP_
+#define FREQ_MONITOR_HPP_
+
+#include <cinttypes>
+
+class FreqMonitor {
+public:
+    /* open the counters and measure the reference cycle rate, throws std::runtime_error if they aren't available */
+    FreqMonitor();
+
+    FreqMonitor(const FreqMonitor&) = delete;
+    FreqMonitor& operator=(const FreqMonitor&) = delete;
+
+    ~FreqMonitor();
+
+    void start();
+
+    /* the effective frequency in GHz since the last start() */
+    double stop();
+
+private:
+    struct Counts {
+        uint64_t cycles, ref_cycles;
+    };
+
+    Counts read();
+
+    /* the group leader counts cycles, the other fd ref-cycles */
+    int leader_fd_ = -1, ref_fd_ = -1;
+    /* the rate of the reference cycles, in GHz */
+    double ref_ghz_ = 0;
+    Counts start_{};
+};
+
+#endif /* FREQ_MONITOR_HPP_ */
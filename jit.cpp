@@ -0,0 +1,81 @@
+/*
+ * jit.cpp
+ */
+
+#include "jit.hpp"
+#include "util.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace jit {
+
+namespace insn {
+const code_bytes ret            = {0xC3};
+const code_bytes lfence         = {0x0F, 0xAE, 0xE8};
+const code_bytes popcnt_rax_rax = {0xF3, 0x48, 0x0F, 0xB8, 0xC0};
+const code_bytes vsqrtss_xmm0   = {0xC5, 0xFA, 0x51, 0xC0};
+const code_bytes vxorps_xmm0    = {0xC5, 0xF8, 0x57, 0xC0};
+const code_bytes movq_rax_xmm0  = {0x66, 0x48, 0x0F, 0x7E, 0xC0};
+const code_bytes store_rsp_zero = {0xC7, 0x04, 0x24, 0x00, 0x00, 0x00, 0x00};
+const code_bytes vzeroupper     = {0xC5, 0xF8, 0x77};
+}
+
+Emitter& Emitter::emit(const code_bytes& bytes, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        code_.insert(code_.end(), bytes.begin(), bytes.end());
+    }
+    return *this;
+}
+
+Emitter& Emitter::loopTo(size_t top) {
+    emit({0x48, 0xFF, 0xCF});  // dec rdi
+    // the displacement is relative to the end of the jnz, which is 2 bytes in the rel8 form and 6 in the rel32 form
+    int64_t disp8 = (int64_t)top - (int64_t)(offset() + 2);
+    if (disp8 >= INT8_MIN) {
+        emit({0x75, (uint8_t)disp8});
+    } else {
+        int64_t disp32 = (int64_t)top - (int64_t)(offset() + 6);
+        if (disp32 < INT32_MIN) {
+            throw std::runtime_error("jit: loop body too large");
+        }
+        uint32_t d = (uint32_t)(int32_t)disp32;
+        emit({0x0F, 0x85, (uint8_t)d, (uint8_t)(d >> 8), (uint8_t)(d >> 16), (uint8_t)(d >> 24)});
+    }
+    return *this;
+}
+
+bench2_f* Emitter::finish() const {
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t size = (code_.size() + page - 1) / page * page;
+    // the buffer is written while it is only writable, and then flipped to only executable, rather than
+    // being writable and executable at once, which some kernels forbid
+    void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        throw std::runtime_error("jit: mmap failed: " + errno_to_str(errno));
+    }
+    memcpy(p, code_.data(), code_.size());
+    if (mprotect(p, size, PROT_READ | PROT_EXEC)) {
+        std::string error = errno_to_str(errno);
+        munmap(p, size);
+        throw std::runtime_error("jit: mprotect failed: " + error);
+    }
+    return reinterpret_cast<bench2_f*>(p);
+}
+
+bench2_f* make_loop(const code_bytes& prologue, const code_bytes& body, size_t unroll, const code_bytes& epilogue) {
+    Emitter e;
+    e.emit(prologue);
+    size_t top = e.offset();
+    e.emit(body, unroll);
+    e.loopTo(top);
+    e.emit(epilogue);
+    e.emit(insn::ret);
+    return e.finish();
+}
+
+}
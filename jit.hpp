@@ -0,0 +1,71 @@
+/*
+ * jit.hpp
+ *
+ * A very small x86-64 code emitter for benchmark kernels whose shape is only known at runtime. The kernels
+ * in the .asm files are fixed when they are assembled, so families of kernels which vary in some count
+ * (e.g., the number of stores between two sqrt chains) are pre-generated up to some maximum and the runtime
+ * parameters can only select among those. A kernel built here is just a sequence of pre-encoded instructions,
+ * each repeated some number of times, wrapped in the usual dec rdi/jnz loop, so it can be any length.
+ *
+ * There is no assembler here: the instructions are given as their encoded bytes, and the only
+ * instruction the emitter itself knows how to encode is the loop branch.
+ */
+
+#ifndef JIT_HPP_
+#define JIT_HPP_
+
+#include <cinttypes>
+#include <cstddef>
+#include <vector>
+
+#include "bench-declarations.h"
+
+namespace jit {
+
+using code_bytes = std::vector<uint8_t>;
+
+/* encodings of the instructions used by the generated kernels */
+namespace insn {
+extern const code_bytes ret;
+extern const code_bytes lfence;
+extern const code_bytes popcnt_rax_rax;
+extern const code_bytes vsqrtss_xmm0;       // vsqrtss xmm0, xmm0, xmm0
+extern const code_bytes vxorps_xmm0;        // vxorps  xmm0, xmm0, xmm0
+extern const code_bytes movq_rax_xmm0;
+extern const code_bytes store_rsp_zero;     // mov DWORD [rsp], 0
+extern const code_bytes vzeroupper;
+}
+
+/**
+ * Accumulates the bytes of a kernel, which are copied into executable memory by finish().
+ */
+class Emitter {
+    code_bytes code_;
+public:
+    /* append count copies of the given instruction(s) */
+    Emitter& emit(const code_bytes& bytes, size_t count = 1);
+
+    /* the current offset, i.e., where the next instruction will be emitted */
+    size_t offset() const { return code_.size(); }
+
+    /* append dec rdi; jnz top where top is an offset returned by offset() */
+    Emitter& loopTo(size_t top);
+
+    const code_bytes& code() const { return code_; }
+
+    /**
+     * Copy the code into a new executable mapping and return it as a function. The mapping is never freed,
+     * like benchmarks themselves. Throws std::runtime_error if the memory can't be mapped.
+     */
+    bench2_f* finish() const;
+};
+
+/**
+ * Generate a kernel which runs prologue, then loops iters times over body repeated unroll times, then
+ * runs epilogue and returns. The prologue and epilogue must leave rdi (the iteration count) alone.
+ */
+bench2_f* make_loop(const code_bytes& prologue, const code_bytes& body, size_t unroll, const code_bytes& epilogue);
+
+}
+
+#endif /* JIT_HPP_ */
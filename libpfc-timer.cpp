@@ -2,6 +2,7 @@
  * libpfc-timer.cpp
  */
 
+#include <limits>
 #include <vector>
 #include <assert.h>
 
@@ -37,15 +38,53 @@ LibpfcNow LibpfcTimer::delta(const LibpfcNow& a, const LibpfcNow& b) {
 
 
 TimingResult LibpfcTimer::to_result(const LibpfcTimer& ti, LibpfcNow delta) {
-    vector<double> results;
-    results.reserve(ti.all_events.size());
-    for (auto& event : ti.all_events) {
-        unsigned slot = event.slot;
-        results.push_back(delta.cnt[slot]);
+    // events which aren't in the selected batch are NaN
+    vector<double> results(ti.all_events.size(), std::numeric_limits<double>::quiet_NaN());
+    for (size_t i = 0; i < ti.all_events.size(); i++) {
+        auto& event = ti.all_events[i];
+        if (event.slot < FIXED_COUNTERS || ti.batchOf(i) == ti.batch_) {
+            results[i] = delta.cnt[event.slot];
+        }
     }
     return TimingResult(std::move(results));
 }
 
+size_t LibpfcTimer::batchOf(size_t i) const {
+    // the fixed counter events come first, followed by the general purpose events, GP_COUNTERS per batch
+    return (i - 1) / GP_COUNTERS;
+}
+
+std::vector<std::string> LibpfcTimer::getEventNames() const {
+    std::vector<std::string> names;
+    for (auto& e : all_events) {
+        names.push_back(e.full_name);
+    }
+    return names;
+}
+
+size_t LibpfcTimer::batchCount() const {
+    return all_events.size() <= 1 ? 1 : batchOf(all_events.size() - 1) + 1;
+}
+
+void LibpfcTimer::selectBatch(Context& c, size_t batch) {
+    PFC_CFG  cfg[7] = {};
+
+    for (size_t i = 0; i < all_events.size(); i++) {
+        auto& event = all_events[i];
+        assert(event.slot < TOTAL_COUNTERS);
+        if (event.slot < FIXED_COUNTERS || batchOf(i) == batch) {
+            cfg[event.slot] = event.code;
+        }
+    }
+
+    auto err = pfcWrCfgs(0, sizeof(cfg)/sizeof(cfg[0]), cfg);
+    if (err) {
+        const char* msg = pfcErrorString(err);
+        throw std::runtime_error(std::string("pfcWrCfgs() failed (error ") + std::to_string(err) + ": " + msg + ")");
+    }
+    batch_ = batch;
+}
+
 void LibpfcTimer::init(Context& c) {
     const TimerArgs &args = c.getTimerArgs();
     auto err = pfcInit();
@@ -59,34 +98,24 @@ void LibpfcTimer::init(Context& c) {
     auto extra_events = parseExtraEvents(c, args.extra_events);
     unsigned ecount = 0;
     for (auto& event : extra_events) {
-        if (ecount >= GP_COUNTERS) {
-            c.err() << "Too many events requested, event " << event.full_name << " won't be recorded" << std::endl;
-        } else {
-            // assign slots consecutively starting after FIXED_COUNTERS slots
-            event.slot = FIXED_COUNTERS + ecount;
-            all_events.push_back(event);
-            ecount++;
-        }
+        // assign slots consecutively starting after FIXED_COUNTERS slots, wrapping around for each batch
+        event.slot = FIXED_COUNTERS + ecount % GP_COUNTERS;
+        all_events.push_back(event);
+        ecount++;
     }
 
     for (auto& e : all_events) {
         metric_names_.push_back(e.short_name);
     }
 
-    PFC_CFG  cfg[7] = {};
-
-    for (auto& event : all_events) {
-        assert(event.slot < TOTAL_COUNTERS);
-        cfg[event.slot] = event.code;
+    if (batchCount() > 1) {
+        c.log() << "The " << ecount << " extra events don't fit in the " << GP_COUNTERS << " counters at once, so they are "
+                "split into " << batchCount() << " batches and each benchmark runs once per batch" << endl;
     }
 
-    err = pfcWrCfgs(0, sizeof(cfg)/sizeof(cfg[0]), cfg);
-    if (err) {
-        const char* msg = pfcErrorString(err);
-        throw std::runtime_error(std::string("pfcWrCfgs() failed (error ") + std::to_string(err) + ": " + msg + ")");
-    }
+    selectBatch(c, 0);
 
-    c.out()   << "libpfc timer init OK" << endl;
+    c.log()   << "libpfc timer init OK" << endl;
 
     //    /* calculate CPU frequency using reference cycles */
     //    for (int i = 0; i < 100; i++) {
@@ -75,8 +75,18 @@ public:
     /////////////////////////
 
     virtual void listEvents(Context& c) override;
+
+    virtual std::vector<std::string> getEventNames() const override;
+
+    virtual size_t batchCount() const override;
+
+    virtual void selectBatch(Context& c, size_t batch) override;
 private:
+    /* the batch of the event at index i in all_events, which must be one of the general purpose events */
+    size_t batchOf(size_t i) const;
+
     std::vector<PmuEvent> all_events;
+    size_t batch_ = 0;
 };
 
 #endif
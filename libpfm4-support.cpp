@@ -20,7 +20,7 @@ void init() {
         if (ret != PFM_SUCCESS) {
             throw std::runtime_error("libpfm4 init failed (" + std::to_string(ret) + "): " + pfm_strerror(ret));
         }
-        printf("libpfm4 initialized successfully\n");
+        fprintf(stderr, "libpfm4 initialized successfully\n");
         pfmIsInit = true;
     }
 }
@@ -147,7 +147,7 @@ std::vector<PmuEvent> parseExtraEvents(Context& c, const std::string& event_list
                     for (int code_idx = 0; code_idx < encode_info.count; code_idx++) {
                         uint64_t code = encode_info.codes[code_idx];
                         PmuEvent e(name, code);
-                        c.out() << "Event '" << event_str << "' resolved to '" << name <<
+                        c.log() << "Event '" << event_str << "' resolved to '" << name <<
                                 ", short name: '" << e.short_name << "' with code 0x" << std::hex << e.code << std::dec << "\n";
                         all_codes.push_back(e);
                         if (code_idx == 1) {
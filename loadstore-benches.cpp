@@ -14,6 +14,7 @@
 #include "timers.hpp"
 #include "table.hpp"
 #include "isa-support.hpp"
+#include "result-sink.hpp"
 
 extern "C" {
 bench2_f  store16_any;
@@ -56,6 +57,7 @@ public:
     template<typename TIMER, bench2_f METHOD>
     static shared_ptr<LoadStoreGroup> make(const string& id, unsigned op_size, featurelist_t features = {}) {
         shared_ptr<LoadStoreGroup> group = make_group(id, id, op_size);
+        group->setTags({"core-local"});
         auto maker = DeltaMaker<TIMER>(group.get(), 1000).setFeatures(features);
         for (ssize_t misalign = 0; misalign < 64; misalign++) {
             maker.template make<METHOD>(group->make_id(misalign), group->make_name(misalign), 128,
@@ -79,6 +81,23 @@ public:
             return;
         }
 
+        assert(benches.size() == rows_ * cols_);
+
+        // collect all the results up front, before any output
+        vector<TimingResult> results;
+        for (size_t i = 0; i < benches.size(); i++) {
+            Benchmark& b = benches[i];
+            results.push_back(b->run(c));
+        }
+
+        if (!c.getSink().isText()) {
+            // structured formats get the usual one record per benchmark, rather than the grid
+            for (size_t i = 0; i < benches.size(); i++) {
+                printResultLine(c, benches[i], results[i]);
+            }
+            return;
+        }
+
         std::ostream& os = c.out();
         os << endl << "** Inverse throughput for " << getDescription() << " **" << endl;
 
@@ -89,19 +108,10 @@ public:
         }
         os << endl;
 
-        assert(benches.size() == rows_ * cols_);
-
-        // collect all the results up front, before any output
-        vector<double> results(benches.size());
-        for (size_t i = 0; i < benches.size(); i++) {
-            Benchmark& b = benches[i];
-            results[i] = b->run(c.getTimerInfo()).getCycles();
-        }
-
         for (unsigned row = 0, i = 0; row < rows_; row++) {
             os << setw(3) << (row * cols_) << " :   ";
             for (unsigned col = 0; col < cols_; col++, i++) {
-                os << setprecision(1) << fixed << setw(5) << results[i];
+                os << setprecision(1) << fixed << setw(5) << results[i].getCycles();
             }
             os << endl;
         }
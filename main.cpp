@@ -44,11 +44,10 @@ backward::SignalHandling sh;
 #endif
 
 int main(int argc, char **argv) {
-    cout << "Welcome to uarch-bench (" << GIT_VERSION << ")" << endl;
-    cout << "Supported CPU features: " + support_string() << endl;
-
     try {
         Context context(argc, argv, &std::cout);
+        context.log() << "Welcome to uarch-bench (" << GIT_VERSION << ")" << endl;
+        context.log() << "Supported CPU features: " + support_string() << endl;
         context.run();
     } catch (SilentSuccess& e) {
     } catch (SilentFailure& e) {
@@ -9,16 +9,72 @@
 #include <string>
 #include <vector>
 
+/**
+ * Matches strings against a pattern where * matches any number of characters. The pattern is examined once
+ * when the matcher is created, and the common cases of no wildcard, or a single trailing wildcard, are simple
+ * comparisons.
+ */
+class WildcardMatcher {
+    std::string pattern;
+    /* the part of the pattern before the first *, and whether that * is the last character */
+    std::string literal;
+    bool has_star, trailing_star;
+
+    /* match target against pattern, if prefix is true the target only needs to match the start of the pattern */
+    static bool match(const char* t, const char* p, bool prefix) {
+        for (; *p != '*'; t++, p++) {
+            if (!*t) {
+                return prefix || !*p;
+            }
+            if (*p != *t) {
+                return false;
+            }
+        }
+        // at a *, which can match any number of characters
+        for (; ; t++) {
+            if (match(t, p + 1, prefix)) {
+                return true;
+            }
+            if (!*t) {
+                return false;
+            }
+        }
+    }
+
+public:
+    WildcardMatcher(std::string pattern) : pattern{std::move(pattern)} {
+        auto star = this->pattern.find('*');
+        has_star = star != std::string::npos;
+        trailing_star = has_star && star == this->pattern.size() - 1;
+        literal = this->pattern.substr(0, star);
+    }
+
+    /* true if the whole target matches the pattern */
+    bool operator()(const std::string& target) const {
+        if (!has_star) {
+            return target == pattern;
+        } else if (trailing_star) {
+            return target.compare(0, literal.size(), literal) == 0;
+        }
+        return match(target.c_str(), pattern.c_str(), false);
+    }
+
+    /* true if some string starting with prefix could match the pattern */
+    bool matchesPrefix(const std::string& prefix) const {
+        return match(prefix.c_str(), pattern.c_str(), true);
+    }
+};
+
 class TagMatcher {
-    std::vector<std::string> yes_patterns, no_patterns;
+    std::vector<WildcardMatcher> yes_patterns, no_patterns;
 public:
     TagMatcher(std::string pattern_list) {
         // filter the list like "foo,~bar" into positive patterns (foo) and negative (bar)
         for (auto& p : split_on_string(pattern_list, ",")) {
             if (!p.empty() && p[0] == '~') {
-                no_patterns.push_back(p.substr(1, p.size()));
+                no_patterns.emplace_back(p.substr(1, p.size()));
             } else {
-                yes_patterns.push_back(p);
+                yes_patterns.emplace_back(p);
             }
         }
     }
@@ -33,10 +89,10 @@ public:
         return (pos_match || yes_patterns.empty()) && !neg_match;
     };
 
-    bool static matches(const std::vector<std::string>& tags, const std::vector<std::string> &patterns) {
+    bool static matches(const std::vector<std::string>& tags, const std::vector<WildcardMatcher> &patterns) {
         for (auto& tag : tags) {
             for (auto& pattern : patterns) {
-                if (wildcard_match(tag, pattern)) {
+                if (pattern(tag)) {
                     return true;
                 }
             }
@@ -78,6 +78,7 @@ void register_matt(GroupList& list) {
     maker.template make<BM_mov_imm_inline>("BM_mov_imm_inline",  "BM_mov_imm_inline", 1);
 
     list.push_back(group);
+    group->setTags({"core-local"});
 }
 
 #else // #if !UARCH_BENCH_PORTABLE
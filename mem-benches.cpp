@@ -7,8 +7,16 @@
 #include "cpp-benches.hpp"
 #include "util.hpp"
 
+#include <cmath>
+#include <map>
 #include <random>
+#include <sched.h>
 #include "benchmark.hpp"
+#include "cache-levels.hpp"
+#include "result-sink.hpp"
+#include "simple-timer.hpp"
+#include "table.hpp"
+#include "threaded.hpp"
 #include "fmt/format.h"
 
 #define LOAD_LOOP_UNROLL    8
@@ -140,6 +148,23 @@ bench2_f nt_store_partial_bandwidth_64;
 bench2_f nt_store_partial_bandwidth_128;
 bench2_f nt_store_partial_bandwidth_256;
 
+// the STREAM kernels, with the number of arrays each one touches
+#define STREAM_KERNEL_X(f, bits) \
+    f(copy,  bits, 2)            \
+    f(scale, bits, 2)            \
+    f(add,   bits, 3)            \
+    f(triad, bits, 3)            \
+
+#define STREAM_X(f)            \
+    STREAM_KERNEL_X(f,  32)    \
+    STREAM_KERNEL_X(f,  64)    \
+    STREAM_KERNEL_X(f, 128)    \
+    STREAM_KERNEL_X(f, 256)    \
+    STREAM_KERNEL_X(f, 512)    \
+
+#define DECLARE_STREAM(name, bits, arrays) bench2_f stream_##name##_##bits;
+STREAM_X(DECLARE_STREAM)
+
 bench2_f gatherdd_xmm;
 bench2_f gatherdd_ymm;
 bench2_f gatherdd_lat_xmm;
@@ -162,6 +187,12 @@ void register_mem_oneshot(GroupList& list);
 template <typename TIMER>
 void register_mem_studies(GroupList& list);
 
+template <typename TIMER>
+void register_tlb(GroupList& list);
+
+template <typename TIMER>
+void register_numa(GroupList& list);
+
 
 template <bench2_f F, typename M>
 static void make_load_bench(M& maker, int kib, const char* id_prefix, const char *desc_suffix, uint32_t ops, size_t offset = 0, bool sizecheck = true) {
@@ -181,11 +212,260 @@ static void make_load_bench(M& maker, int kib, const char* id_prefix, const char
     );
 }
 
+/* the largest region in KiB that make_load_bench allows for the given maker and ops */
+template <typename M>
+static int64_t max_load_kib(M& maker, uint32_t ops) {
+    return std::min<int64_t>((uint64_t)maker.getLoopCount() * UB_CACHE_LINE_SIZE / 1024 * ops, MAX_SIZE / 1024);
+}
+
+static const std::string ALL_SIZES_SPEC  = to_param_spec(ALL_SIZES_ARRAY);
+static const std::string SLOW_SIZES_SPEC = string_format("%d..%d:x2", MAX_KIB * 2, MAX_SIZE / 1024);
+
 #define MAKE_SERIALO(kib, test, off)       make_load_bench<test>             (maker, kib, "serial-loads",   "serial loads", 1, off);
 #define MAKE_SERIAL(kib, test)  MAKE_SERIALO(kib, test, 0)
 #define MAKEP_LOAD(l,kib) make_load_bench<parallel_mem_bench_##l>(maker, kib, "parallel-" #l, "parallel " #l, LOAD_LOOP_UNROLL);
 #define MAKEP_ALL(kib) LOADTYPE_X(MAKEP_LOAD,kib)
 
+#if !UARCH_BENCH_PORTABLE
+
+/*
+ * Characterizes the cache hierarchy. Rather than running a fixed list of benchmarks, this group runs the
+ * serial_load_bench pointer chase over a sweep of region sizes which is refined wherever the latency jumps,
+ * then finds the plateaus and knees in the results to get the effective capacity and load-to-use latency of
+ * each level (see find_cache_levels), and compares them to the cache sizes in sysfs. Its only benchmark is a
+ * placeholder for selecting the group, as with --characterize-caches.
+ */
+template <typename TIMER>
+class CacheCharacterizationGroup : public BenchmarkGroup {
+    /* the initial sweep sizes are this factor apart */
+    static constexpr double STEP = 1.189207115;  // 2^(1/4)
+    /* a gap between neighboring points is refined if the latency rises by more than this, relative... */
+    static constexpr double TOLERANCE = 0.1;
+    /* ... and the sizes are more than this factor apart */
+    static constexpr double MIN_STEP = 1.06;
+    /* the most points in the sweep, including the refinements */
+    static constexpr size_t MAX_POINTS = 120;
+    /* the fewest loads per sample, for small regions */
+    static constexpr size_t MIN_LOOPS = 16 * 1024;
+
+    struct Point {
+        std::unique_ptr<BenchmarkBase> bench;
+        TimingResult result;
+        size_t samples;
+    };
+
+    int64_t min_kib_, max_kib_;
+
+    /* time the pointer chase over a region of the given size, adding it to points if it isn't there already */
+    void measure(Context& c, std::map<int64_t, Point>& points, int64_t kib) {
+        if (points.count(kib)) {
+            return;
+        }
+        // each sample chases through the whole region at least once
+        uint32_t loops = std::max<size_t>(kib * 1024 / UB_CACHE_LINE_SIZE, MIN_LOOPS);
+        Benchmark b = DeltaMaker<TIMER>(this, loops).template make_only<serial_load_bench>(
+                string_format("%" PRId64 "-kib", kib), string_format("%" PRId64 "-KiB serial loads", kib), 1,
+                [=]{ return &shuffled_region(kib * 1024); });
+        if (c.verbose()) {
+            c.log() << "Measuring serial load latency for " << kib << " KiB" << std::endl;
+        }
+        size_t samples;
+        TimingResult result = static_cast<BenchTemplate<TIMER, DeltaAlgo<TIMER>>*>(b)->run(c, samples);
+        points.emplace(kib, Point{std::unique_ptr<BenchmarkBase>(b), result, samples});
+    }
+
+    void printLevels(Context& c, std::ostream& os, const std::vector<SweepPoint>& sweep) {
+        using namespace table;
+        auto levels = find_cache_levels(sweep, TOLERANCE);
+        auto sysfs = read_sysfs_caches(sched_getcpu());
+
+        Table t;
+        t.newRow().add("Level").add("Capacity").add("Latency").add("sysfs").add("Difference");
+        size_t caches = levels.size();
+        if (caches > 1 && levels.back().capacity == sweep.back().bytes) {
+            caches--;  // the sweep ended on this plateau, so it is (probably) memory
+        }
+        for (size_t i = 0; i < levels.size(); i++) {
+            auto& level = levels[i];
+            auto& row = t.newRow();
+            if (i < caches) {
+                row.add(string_format("L%zu", i + 1)).add(format_cache_size(level.capacity));
+            } else {
+                row.add("Memory").add("-");
+            }
+            row.add(string_format("%.1f", level.cycles));
+            if (i < caches && i < sysfs.size()) {
+                row.add(string_format("L%d %s", sysfs[i].level, format_cache_size(sysfs[i].bytes).c_str()));
+                row.add(string_format("%+.0f%%", 100. * level.capacity / sysfs[i].bytes - 100));
+            }
+        }
+        for (size_t col = 1; col < 5; col++) {
+            t.colInfo(col).justify = ColInfo::RIGHT;
+        }
+
+        os << std::endl << "** Cache levels found in the latency sweep (latency in cycles) **" << std::endl << t.str();
+        if (sysfs.empty()) {
+            os << "No cache information in sysfs to compare against" << std::endl;
+        } else if (caches != sysfs.size()) {
+            os << "NOTE: found " << caches << " cache levels, but sysfs lists " << sysfs.size() << " data caches" << std::endl;
+        }
+    }
+
+public:
+    CacheCharacterizationGroup() : BenchmarkGroup("memory/characterize-caches", "Cache hierarchy from an adaptive latency sweep") {
+        // by default the sweep goes well past the largest cache, and to at least 64 MiB
+        size_t largest = 0;
+        for (auto& cache : read_sysfs_caches(sched_getcpu())) {
+            largest = std::max(largest, cache.bytes);
+        }
+        int64_t default_max = std::min<int64_t>(std::max<size_t>(4 * largest / 1024, 64 * 1024), MAX_SIZE / 1024);
+        auto min = param("min-kib", "Smallest region size in KiB", "4", 1, MAX_SIZE / 1024);
+        auto max = param("max-kib", "Largest region size in KiB, by default 4x the largest cache", std::to_string(default_max), 1, MAX_SIZE / 1024);
+        min_kib_ = min.empty() ? 4 : min.front();
+        max_kib_ = std::max(min_kib_, max.empty() ? default_max : max.front());
+    }
+
+    virtual void runIf(Context& c, const predicate_t& predicate) override {
+        auto& benches = getBenches();
+        if (benches.empty() || !predicate(benches.front())) {
+            return;
+        }
+        SimpleTimer timer;
+        c.getSink().groupStart(c, *this);
+
+        std::map<int64_t, Point> points;
+        for (double kib = min_kib_; kib < max_kib_; kib *= STEP) {
+            measure(c, points, std::llround(kib));
+        }
+        measure(c, points, max_kib_);
+
+        // bisect (geometrically) every gap where the latency jumps, until the jumps are resolved
+        for (bool refined = true; refined && points.size() < MAX_POINTS; ) {
+            refined = false;
+            for (auto it = points.begin(), next = std::next(it); next != points.end() && points.size() < MAX_POINTS; it = next++) {
+                int64_t mid = std::llround(std::sqrt((double)it->first * next->first));
+                if (next->second.result.getCycles() > it->second.result.getCycles() * (1 + TOLERANCE)
+                        && next->first > it->first * MIN_STEP && mid != it->first && mid != next->first) {
+                    measure(c, points, mid);
+                    refined = true;
+                }
+            }
+        }
+
+        std::vector<SweepPoint> sweep;
+        for (auto& p : points) {
+            Benchmark b = p.second.bench.get();
+            // the sample count fills the Samples column the header has with adaptive sampling
+            ResultRecord record{b, b->getDescription(), {}, {}, p.second.result.getResults()};
+            addSampleCount(c, record, p.second.samples);
+            c.getSink().result(c, record);
+            sweep.push_back(SweepPoint{(size_t)p.first * 1024, p.second.result.getCycles()});
+        }
+        // the summary isn't a benchmark result, so it only goes to the result stream in the text format
+        printLevels(c, c.getSink().isText() ? c.out() : c.log(), sweep);
+
+        c.getSink().groupEnd(c, *this, timer.elapsed<std::chrono::milliseconds>());
+    }
+};
+
+template <typename TIMER>
+constexpr double CacheCharacterizationGroup<TIMER>::STEP;
+template <typename TIMER>
+constexpr double CacheCharacterizationGroup<TIMER>::TOLERANCE;
+template <typename TIMER>
+constexpr double CacheCharacterizationGroup<TIMER>::MIN_STEP;
+
+/* the arrays for the STREAM kernels, mirrored in x86-methods.asm */
+struct stream_args {
+    /* the size of each array */
+    size_t size;
+    char *a, *b, *c;
+};
+
+/*
+ * The STREAM arrays of the given size for the CPU of the calling thread, allocated on first use. The threads
+ * of the memory/bandwidth/stream group are pinned before they get their args, so each one owns its arrays, and
+ * they are first touched on the CPU that uses them.
+ */
+static stream_args* stream_arrays(size_t size) {
+    static std::map<std::pair<size_t, int>, stream_args> arrays;
+    stream_args& args = arrays[{size, sched_getcpu()}];
+    if (!args.size) {
+        // the arrays are a few lines more than their size apart, so they don't all map to the same cache sets
+        size_t stride = size + 17 * UB_CACHE_LINE_SIZE;
+        char* p = static_cast<char*>(new_huge_ptr(3 * stride));
+        args = stream_args{size, p, p + stride, p + 2 * stride};
+    }
+    return &args;
+}
+
+/*
+ * STREAM-style copy, scale, add and triad kernels at each load/store width, run on 1, 2, 4, ... and all the CPUs
+ * from --cpus, with every thread on its own arrays. After the results, which are the time per line of each array,
+ * it prints the aggregate bandwidth of all the threads for each kernel, array size and width, by thread count, so
+ * the points where more threads stop adding bandwidth show up for each level of the memory hierarchy.
+ */
+template <typename TIMER>
+class StreamGroup : public ThreadScalingGroup<TIMER> {
+    using base_t = ThreadScalingGroup<TIMER>;
+
+    struct StreamInfo {
+        std::string kernel;
+        int bits;
+        int kib;
+        /* the number of arrays read or written */
+        int arrays;
+    };
+
+    std::map<const BenchmarkBase*, StreamInfo> info_;
+
+protected:
+    virtual void printSummary(Context& c, std::ostream& os, const std::vector<size_t>& counts,
+            const typename base_t::results_t& results) override {
+        using namespace table;
+        auto& names = c.getTimerInfo().getMetricNames();
+        size_t rate = base_t::rateMetric(c.getTimerInfo());
+        for (const char* kernel : {"copy", "scale", "add", "triad"}) {
+            Table t;
+            auto& header = t.newRow().add("Array").add("Width");
+            for (size_t n : counts) {
+                header.add(string_format("%zu thr", n));
+            }
+            bool any = false;
+            for (auto& b : this->getBenches()) {
+                auto& info = info_.at(b);
+                auto found = results.find(b);
+                if (info.kernel != kernel || found == results.end()) {
+                    continue;
+                }
+                auto& row = t.newRow().add(string_format("%d KiB", info.kib)).add(string_format("%d-bit", info.bits));
+                for (size_t n : counts) {
+                    row.add(string_format("%.2f", info.arrays * UB_CACHE_LINE_SIZE / found->second.at(n).total.at(rate)));
+                }
+                any = true;
+            }
+            if (!any) {
+                continue;
+            }
+            for (size_t col = 0; col < counts.size() + 2; col++) {
+                t.colInfo(col).justify = ColInfo::RIGHT;
+            }
+            os << std::endl << "** " << kernel << " bandwidth (" << (rate ? std::string("GB/s") : "bytes per " + names.at(0))
+                    << ", all threads) **" << std::endl << t.str();
+        }
+    }
+
+public:
+    StreamGroup() : base_t("memory/bandwidth/stream", "STREAM kernels scaled over threads") {}
+
+    void addStream(Benchmark b, const char* kernel, int bits, int kib, int arrays) {
+        info_[b] = StreamInfo{kernel, bits, kib, arrays};
+        this->add(b);
+    }
+};
+
+#endif // #if !UARCH_BENCH_PORTABLE
+
 template <typename TIMER>
 void register_mem(GroupList& list) {
 #if !UARCH_BENCH_PORTABLE
@@ -193,13 +473,27 @@ void register_mem(GroupList& list) {
         std::shared_ptr<BenchmarkGroup> group = std::make_shared<BenchmarkGroup>("memory/load-parallel", "Random(ish) parallel loads from fixed-size regions");
         list.push_back(group);
         auto maker = DeltaMaker<TIMER>(group.get(), 1000 * 1000).setTags({"default"});
+        auto max_kib = max_load_kib(maker, LOAD_LOOP_UNROLL);
 
-        for (auto kib : ALL_SIZES_ARRAY) {
+        for (int kib : group->param("kib", "Region sizes in KiB", ALL_SIZES_SPEC, 1, max_kib)) {
             MAKEP_LOAD(load, kib);
         }
 
-        for (int kib = MAX_KIB * 2; kib <= MAX_SIZE / 1024; kib *= 2) {
-            maker = maker.setTags({"slow"});
+        maker = maker.setTags({"slow"});
+        for (int kib : group->param("slow-kib", "Region sizes in KiB for the slow tests", SLOW_SIZES_SPEC, 1, max_kib)) {
+            MAKEP_LOAD(load, kib);
+        }
+    }
+
+    {
+        // the same loads as memory/load-parallel, but run on all the threads selected by --cpus and --threads at once,
+        // with every thread reading the same shared region
+        std::shared_ptr<BenchmarkGroup> group = std::make_shared<BenchmarkGroup>("memory/threaded/load-parallel",
+                "Parallel loads from a shared region on multiple threads");
+        list.push_back(group);
+        auto maker = ThreadedDeltaMaker<TIMER>(group.get(), 1000 * 1000).setTags({"threaded"});
+
+        for (int kib : group->param("kib", "Region sizes in KiB", "16..65536:x4", 1, max_load_kib(maker, LOAD_LOOP_UNROLL))) {
             MAKEP_LOAD(load, kib);
         }
     }
@@ -208,13 +502,14 @@ void register_mem(GroupList& list) {
         std::shared_ptr<BenchmarkGroup> group = std::make_shared<BenchmarkGroup>("memory/store-parallel", "Parallel stores to fixed-size regions");
         list.push_back(group);
         auto maker = DeltaMaker<TIMER>(group.get(), 1000 * 1000).setTags({"default"});
+        auto max_kib = max_load_kib(maker, LOAD_LOOP_UNROLL);
 
-        for (auto kib : ALL_SIZES_ARRAY) {
+        for (int kib : group->param("kib", "Region sizes in KiB", ALL_SIZES_SPEC, 1, max_kib)) {
             MAKEP_LOAD(store, kib);
         }
 
-        for (int kib = MAX_KIB * 2; kib <= MAX_SIZE / 1024; kib *= 2) {
-            maker = maker.setTags({"slow"});
+        maker = maker.setTags({"slow"});
+        for (int kib : group->param("slow-kib", "Region sizes in KiB for the slow tests", SLOW_SIZES_SPEC, 1, max_kib)) {
             MAKEP_LOAD(store, kib);
         }
     }
@@ -229,7 +524,7 @@ void register_mem(GroupList& list) {
         list.push_back(group);
         auto maker = DeltaMaker<TIMER>(group.get(), 100000).setTags({"default"});
 
-        for (auto kib : {16, 32, 64, 128, 256, 512, 2048, 4096, 8192, 8192 * 4}) {
+        for (int kib : group->param("kib", "Region sizes in KiB", "16..512:x2,2048..8192:x2,32768", 1, max_load_kib(maker, LOAD_LOOP_UNROLL))) {
             PFTYPE_X(MAKEP_LOAD,kib)
         }
     }
@@ -260,12 +555,14 @@ void register_mem(GroupList& list) {
 
         {
             auto maker = DeltaMaker<TIMER>(group.get(), 100 * 1000).setTags({"default"});
-            ALL_SIZES_X_ARG(MAKE_SERIAL, serial_load_bench)
+            for (int kib : group->param("kib", "Region sizes in KiB", ALL_SIZES_SPEC, 1, max_load_kib(maker, 1))) {
+                MAKE_SERIAL(kib, serial_load_bench);
+            }
         }
 
         {
             auto maker = DeltaMaker<TIMER>(group.get(), 7 * 1000 * 1000).setTags({"slow"});
-            for (int kib = MAX_KIB * 2; kib <= MAX_SIZE / 1024; kib *= 2) {
+            for (int kib : group->param("slow-kib", "Region sizes in KiB for the slow tests", SLOW_SIZES_SPEC, 1, max_load_kib(maker, 1))) {
                 MAKE_SERIAL(kib, serial_load_bench);
             }
         }
@@ -362,6 +659,35 @@ void register_mem(GroupList& list) {
         }
     }
 
+    {
+        auto group = std::make_shared<StreamGroup<TIMER>>();
+        list.push_back(group);
+
+        auto kib_list = group->param("kib", "Array sizes in KiB for each thread", "16..16384:x4", 1, 1024 * 1024);
+        for (int kib : group->isSelected() ? kib_list : std::vector<int64_t>{}) {
+            // at least 16K lines of each array per sample, as for the single-threaded bandwidth tests
+            uint32_t loop_count = std::max(16, 16 * 1024 / kib);
+            auto maker = ThreadedDeltaMaker<TIMER>(group.get(), loop_count).setTags({"threaded"});
+            if (kib > 1024) {
+                maker = maker.setTags({"threaded", "slow"});
+            }
+            std::map<int, ThreadedDeltaMaker<TIMER>> makers{
+                {32,  maker.setFeatures({AVX})},
+                {64,  maker.setFeatures({AVX})},
+                {128, maker.setFeatures({AVX})},
+                {256, maker.setFeatures({AVX2})},
+                {512, maker.setFeatures({AVX512F})},
+            };
+            size_t size = kib * 1024;
+#define MAKE_STREAM(name, bits, arrays)                                                                           \
+            group->addStream(makers.at(bits).template make_only<stream_##name##_##bits>(                          \
+                    string_format("%s-%db-%d", #name, bits, kib),                                                 \
+                    string_format("%d-KiB %s, %d-bit (time per CL)", kib, #name, bits), size / UB_CACHE_LINE_SIZE, \
+                    [=]{ return stream_arrays(size); }), #name, bits, kib, arrays);
+            STREAM_X(MAKE_STREAM)
+        }
+    }
+
     {
         std::shared_ptr<BenchmarkGroup> group = std::make_shared<BenchmarkGroup>("memory/gather", "Gather tests");
         list.push_back(group);
@@ -447,6 +773,13 @@ void register_mem(GroupList& list) {
         maker.setLoopCount(1000).template make<shuffled_list_sum>("list-traversal", "Linked list traversal + sum",  128 * 1024 / UB_CACHE_LINE_SIZE, []{ return &shuffled_region(128 * 1024); });
     }
 
+    {
+        auto group = std::make_shared<CacheCharacterizationGroup<TIMER>>();
+        list.push_back(group);
+        DeltaMaker<TIMER>(group.get(), 1000).setTags({"slow"}).template make<serial_load_bench>("sweep",
+                "Adaptive serial load latency sweep", 1, []{ return &shuffled_region(4 * 1024); });
+    }
+
     {
         std::shared_ptr<BenchmarkGroup> fwd_group = std::make_shared<BenchmarkGroup>("memory/store-fwd", "Store forwaring latency and throughput");
 
@@ -490,6 +823,8 @@ void register_mem(GroupList& list) {
 
     register_mem_oneshot<TIMER>(list);
     register_mem_studies<TIMER>(list);
+    register_tlb<TIMER>(list);
+    register_numa<TIMER>(list);
 
 }
 
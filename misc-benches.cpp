@@ -193,6 +193,7 @@ void register_misc(GroupList& list) {
 
     misc_group->add(benches);
     list.push_back(misc_group);
+    misc_group->setTags({"core-local"});
 
     // Tests from https://dendibakh.github.io/blog/2018/02/04/Micro-ops-fusion
     std::shared_ptr<BenchmarkGroup> dendibakh = std::make_shared<BenchmarkGroup>("dendibakh", "Fusion tests from dendibakh blog");
@@ -216,10 +217,12 @@ void register_misc(GroupList& list) {
 
     });
     list.push_back(dendibakh);
+    dendibakh->setTags({"core-local"});
 
     {
         std::shared_ptr<BenchmarkGroup> bmi_group = std::make_shared<BenchmarkGroup>("bmi", "BMI false-dependency tests");
         list.push_back(bmi_group);
+        bmi_group->setTags({"core-local"});
         auto bmi_maker = DeltaMaker<TIMER>(bmi_group.get()).setTags({"default"});
 
         bmi_maker.template make<bmi_tzcnt>("dep-tzcnt", "dest-dependent tzcnt", 128);
@@ -239,10 +242,12 @@ void register_misc(GroupList& list) {
         default_maker::template make_bench<retpoline_sparse_dep_call_lfence,retpoline_sparse_call_base>(retpoline_group.get(),   "retp-sparse-dep-call-lfence", "Sparse retpo dep call lfence", 8)
     });
     list.push_back(retpoline_group);
+    retpoline_group->setTags({"core-local"});
 
     {
         std::shared_ptr<BenchmarkGroup> group = std::make_shared<BenchmarkGroup>("avx512", "AVX512 stuff");
         list.push_back(group);
+        group->setTags({"core-local"});
         auto maker = DeltaMaker<TIMER>(group.get()).setTags({"default"}).setFeatures({AVX512F});
 
         maker.template make<kreg_lat>( "kreg_lat",   "kreg-GP rountrip latency", 128);
@@ -254,6 +259,7 @@ void register_misc(GroupList& list) {
     {
         std::shared_ptr<BenchmarkGroup> group = std::make_shared<BenchmarkGroup>("studies/vzeroall", "VZEROALL weirdness");
         list.push_back(group);
+        group->setTags({"core-local"});
         auto maker = DeltaMaker<TIMER>(group.get()).setTags({"default"});
         auto maker256 = maker.setFeatures({AVX2});
         auto maker512 = maker.setFeatures({AVX512F});
@@ -273,6 +279,7 @@ void register_misc(GroupList& list) {
     {
         std::shared_ptr<BenchmarkGroup> group = std::make_shared<BenchmarkGroup>("studies/movd", "movd weirdness");
         list.push_back(group);
+        group->setTags({"core-local"});
         auto maker = DeltaMaker<TIMER>(group.get()).setFeatures({AVX});
 
         maker.template make<movd_xmm>("movd-xmm", "roundtrip mov + vpor xmm", 100);
@@ -282,6 +289,7 @@ void register_misc(GroupList& list) {
     {
         std::shared_ptr<BenchmarkGroup> group = std::make_shared<BenchmarkGroup>("studies/repm", "repm");
         list.push_back(group);
+        group->setTags({"core-local"});
         auto maker = DeltaMaker<TIMER>(group.get(), 100);
         maker = maker.useLoopDelta();
 
@@ -291,6 +299,7 @@ void register_misc(GroupList& list) {
     {
         std::shared_ptr<BenchmarkGroup> group = std::make_shared<BenchmarkGroup>("studies/nested", "Nested loop mispredicts");
         list.push_back(group);
+        group->setTags({"core-local"});
         auto maker = DeltaMaker<TIMER>(group.get());
         // maker = maker.useLoopDelta();
 
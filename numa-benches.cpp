@@ -0,0 +1,189 @@
+/*
+ * numa-benches.cpp
+ *
+ * The memory/numa group: a node by node matrix of memory latency and bandwidth, with the benchmark thread on a
+ * CPU of one node (the row) and the region it accesses bound to another (the column). Each cell is a pointer
+ * chase and a linear read over the same region from a single thread, so the bandwidth is what one core can
+ * pull from the node, not the total the node can supply. With only one node, it is a 1x1 matrix.
+ */
+
+#include "benchmark.hpp"
+#include "cpp-benches.hpp"
+#include "result-sink.hpp"
+#include "simple-timer.hpp"
+#include "table.hpp"
+#include "util.hpp"
+
+#include <algorithm>
+#include <map>
+#include <numeric>
+#include <random>
+
+namespace {
+
+/* the regions for one memory node: both cover the same lines, which are linked into a random cycle */
+struct NodeRegion {
+    region chase, linear;
+};
+
+/* the region bound to the given node, created on first use and shared by the benchmarks for that node */
+NodeRegion* node_region(int node, size_t size) {
+    static std::map<int, NodeRegion> regions;
+    auto found = regions.find(node);
+    if (found == regions.end()) {
+        char* storage = static_cast<char*>(new_huge_ptr(size, true, node));
+        std::vector<size_t> order(size / UB_CACHE_LINE_SIZE);
+        std::iota(order.begin(), order.end(), 0);
+        std::shuffle(order.begin(), order.end(), std::mt19937_64{123});
+        for (size_t i = 0; i < order.size(); i++) {
+            *(void**)(storage + order[i] * UB_CACHE_LINE_SIZE) = storage + order[(i + 1) % order.size()] * UB_CACHE_LINE_SIZE;
+        }
+        NodeRegion r{{size, storage + order[0] * UB_CACHE_LINE_SIZE}, {size, storage}};
+        found = regions.emplace(node, r).first;
+    }
+    return &found->second;
+}
+
+class NumaGroup : public BenchmarkGroup {
+    struct Cell {
+        int cpu_node, mem_node;
+        bool bandwidth;
+    };
+
+    std::vector<int> nodes_;
+    std::map<const BenchmarkBase*, Cell> cells_;
+
+    /* a CPU on the given node which the multi-threaded benchmarks may use, or -1 if there isn't one */
+    static int nodeCpu(Context& c, int node) {
+        auto& allowed = c.getThreadCpus();
+        for (int cpu : numa_node_cpus(node)) {
+            if (std::find(allowed.begin(), allowed.end(), cpu) != allowed.end()) {
+                return cpu;
+            }
+        }
+        return -1;
+    }
+
+    /* as BenchmarkGroup::runIf, but running each benchmark on a CPU of its CPU node */
+    void runCells(Context& c, const predicate_t& predicate) {
+        SimpleTimer timer;
+        bool header = false;
+        for (auto& b : getBenches()) {
+            if (!predicate(b)) {
+                continue;
+            }
+            if (!header) {
+                c.getSink().groupStart(c, *this);
+                header = true;
+            }
+            int node = cells_.at(b).cpu_node;
+            int cpu = nodeCpu(c, node);
+            if (cpu < 0) {
+                c.getSink().skipped(c, *b, string_format("no CPU on node %d in --cpus", node));
+                continue;
+            }
+            pin_to_cpu(cpu);
+            b->runAndPrint(c);
+        }
+        if (header) {
+            c.getSink().groupEnd(c, *this, timer.elapsed<std::chrono::milliseconds>());
+        }
+    }
+
+    void printMatrix(std::ostream& os, const std::string& title, const std::map<std::pair<int, int>, double>& values) {
+        using namespace table;
+        if (values.empty()) {
+            return;
+        }
+        Table t;
+        auto& header = t.newRow().add("CPU \\ Mem");
+        for (int node : nodes_) {
+            header.add(string_format("node %d", node));
+        }
+        for (int cpu_node : nodes_) {
+            auto& row = t.newRow().add(string_format("node %d", cpu_node));
+            for (int mem_node : nodes_) {
+                auto v = values.find({cpu_node, mem_node});
+                row.add(v == values.end() ? "-" : string_format("%.2f", v->second));
+            }
+        }
+        for (size_t col = 1; col <= nodes_.size(); col++) {
+            t.colInfo(col).justify = ColInfo::RIGHT;
+        }
+        os << std::endl << "** " << title << " **" << std::endl << t.str();
+    }
+
+    void printSummary(Context& c, const std::vector<ResultRecord>& results) {
+        auto& names = c.getTimerInfo().getMetricNames();
+        // bandwidth is per nanosecond if the timer has it, otherwise per unit of the first metric
+        auto nanos = std::find(names.begin(), names.end(), "Nanos");
+        size_t bw_metric = nanos == names.end() ? 0 : nanos - names.begin();
+        std::map<std::pair<int, int>, double> latency, bandwidth;
+        for (auto& r : results) {
+            auto cell = cells_.find(r.bench);
+            if (cell == cells_.end() || r.values.size() <= bw_metric) {
+                continue;
+            }
+            auto key = std::make_pair(cell->second.cpu_node, cell->second.mem_node);
+            if (cell->second.bandwidth) {
+                bandwidth[key] = UB_CACHE_LINE_SIZE / r.values[bw_metric];
+            } else {
+                latency[key] = r.values[0];
+            }
+        }
+        std::ostream& os = c.getSink().isText() ? c.out() : c.log();
+        printMatrix(os, "Latency (" + names.at(0) + " per load, rows are the CPU node, columns the memory node)", latency);
+        printMatrix(os, "Single-thread read bandwidth (" + (bw_metric ? std::string("GB/s") : "bytes per " + names.at(0))
+                + ", rows are the CPU node, columns the memory node)", bandwidth);
+    }
+
+public:
+    NumaGroup(std::vector<int> nodes) : BenchmarkGroup("memory/numa", "NUMA node to node latency and bandwidth"), nodes_(nodes) {}
+
+    void addCell(Benchmark b, int cpu_node, int mem_node, bool bandwidth) {
+        cells_[b] = Cell{cpu_node, mem_node, bandwidth};
+        add(b);
+    }
+
+    virtual void runIf(Context& c, const predicate_t& predicate) override {
+        run_with_summary(c, *this, [&]{ runCells(c, predicate); },
+                [&](const std::vector<ResultRecord>& results){ printSummary(c, results); });
+    }
+};
+
+}  // namespace
+
+template <typename TIMER>
+void register_numa(GroupList& list) {
+    std::vector<int> nodes = numa_nodes();
+    auto group = std::make_shared<NumaGroup>(nodes);
+    list.push_back(group);
+
+    auto kib_list = group->param("region-kib", "Region size in KiB for each memory node", "262144", 1024, 16 * 1024 * 1024);
+    if (kib_list.size() != 1) {
+        throw std::runtime_error("memory/numa/region-kib must be a single size");
+    }
+    if (!group->isSelected()) {
+        return;
+    }
+    size_t size = kib_list.front() * 1024;
+    // the chase carries on around the cycle from one sample to the next, so it needn't cover the region each time,
+    // while the linear read does, so it always misses in the cache
+    auto chase_maker  = DeltaMaker<TIMER>(group.get(), 250 * 1000).setTags({"slow"});
+    auto linear_maker = chase_maker.setLoopCount(size / UB_CACHE_LINE_SIZE);
+
+    for (int cpu_node : nodes) {
+        for (int mem_node : nodes) {
+            auto suffix = string_format("cpu%d-mem%d", cpu_node, mem_node);
+            auto desc = string_format("node %d reading node %d", cpu_node, mem_node);
+            group->addCell(chase_maker.template make_only<pointer_chase>("latency-" + suffix, desc + " latency", 1,
+                    [=]{ return &node_region(mem_node, size)->chase; }), cpu_node, mem_node, false);
+            group->addCell(linear_maker.template make_only<linear_read>("bandwidth-" + suffix, desc + " linear", 1,
+                    [=]{ return &node_region(mem_node, size)->linear; }), cpu_node, mem_node, true);
+        }
+    }
+}
+
+#define REG_DEFAULT(CLOCK) template void register_numa<CLOCK>(GroupList& list);
+
+ALL_TIMERS_X(REG_DEFAULT)
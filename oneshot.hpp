@@ -22,6 +22,7 @@
 #define ONESHOT_HPP_
 
 #include "benchmark.hpp"
+#include "result-sink.hpp"
 
 class OneshotGroup : public BenchmarkGroup {
 public:
@@ -64,18 +65,22 @@ template <typename TIMER, typename F>
 static typename TIMER::delta_t rawToOverhead(Context &c, F f, const std::string &name) {
     auto raw = f();
 
-    c.out() << "\n---------- Oneshot calibration start (" << name << ") --------------\n";
-
-    printResultHeader(c);
-
     assert(raw.size() > ONESHOT_OVERHEAD_WARMUP);
     auto b = std::begin(raw) + ONESHOT_OVERHEAD_WARMUP;
     auto e = std::end(raw);
-    printOne<TIMER>(c, "min   ", TimerHelper<TIMER>::min(b,e));
-    printOne<TIMER>(c, "median (used)", TimerHelper<TIMER>::median(b,e));
-    printOne<TIMER>(c, "max   ", TimerHelper<TIMER>::max(b,e));
 
-    c.out() << "---------- Oneshot calibration end   (" << name << ") --------------\n\n";
+    // the calibration details are only shown in the text format, they aren't benchmark results
+    if (c.getSink().isText()) {
+        c.out() << "\n---------- Oneshot calibration start (" << name << ") --------------\n";
+
+        printResultHeader(c);
+
+        printOne<TIMER>(c, "min   ", TimerHelper<TIMER>::min(b,e));
+        printOne<TIMER>(c, "median (used)", TimerHelper<TIMER>::median(b,e));
+        printOne<TIMER>(c, "max   ", TimerHelper<TIMER>::max(b,e));
+
+        c.out() << "---------- Oneshot calibration end   (" << name << ") --------------\n\n";
+    }
     return TimerHelper<TIMER>::median(b,e);
 }
 
@@ -114,7 +119,7 @@ public:
                 {}
 
 
-    virtual TimingResult run(const TimerInfo& ti) override {
+    virtual TimingResult run(Context& c) override {
         throw std::logic_error("oneshot doesn't do run()");
     }
 
@@ -126,14 +131,12 @@ public:
         c.out() << std::endl;
     }
 
-    template <typename M>
-    void printOneSample(Context& c, const typename TIMER::delta_t& raw, const M& sampleNum) {
-        const TimingResult& result = normalize(TIMER::to_result(static_cast<const TIMER &>(c.getTimerInfo()), raw),
-                this->args, loop_count);
-        printBenchName(c, this);
-        printOneMetric(c, sampleNum);
-        printAlignedMetrics(c, result.getResults());
-        c.out() << std::endl;
+    TimingResult toResult(Context& c, const typename TIMER::delta_t& raw) {
+        return normalize(TIMER::to_result(static_cast<const TIMER &>(c.getTimerInfo()), raw), this->args, loop_count);
+    }
+
+    void printOneSample(Context& c, const TimingResult& result, const std::string& sampleNum) {
+        c.getSink().result(c, ResultRecord{this, getDescription(), {{"sample", sampleNum}}, {}, result.getResults()});
     }
 
     virtual void runAndPrintInner(Context& c) override {
@@ -141,16 +144,30 @@ public:
         raw_result raw = raw_func(loop_count, arg);
         arg_provider.free(arg);
 
+        bool text = c.getSink().isText();
         removeOverhead(c, raw);
-        printHeader(c);
+        if (text) {
+            printHeader(c);
+        }
+        std::vector<TimingResult> results;
         for (int i = 0; i < samples; i++) {
-            printOneSample(c, raw[i], i + 1);
+            results.push_back(toResult(c, raw[i]));
+            printOneSample(c, results.back(), std::to_string(i + 1));
         }
 
         // include median
-        printOneSample(c, TimerHelper<TIMER>::median(std::begin(raw), std::end(raw)), "median");
+        printOneSample(c, toResult(c, TimerHelper<TIMER>::median(std::begin(raw), std::end(raw))), "median");
 
-        c.out() << std::endl;
+        if (c.fullStats()) {
+            for (auto& stat : distribution(c.getTimerInfo(), results)) {
+                printOneSample(c, stat.second, stat.first);
+            }
+            printHistogram(c, this, results);
+        }
+
+        if (text) {
+            c.out() << std::endl;
+        }
     }
 
     /**
@@ -272,6 +289,9 @@ private:
             void* f_addr,
             const arg_provider_t& arg_provider = null_provider)
     {
+        if (!this->parent->isSelected()) {
+            return;
+        }
         Benchmark b = new OneshotBench<TIMER, samples>(args, this->loop_count, f, f_addr, arg_provider, overhead);
         this->parent->add(b);
     }
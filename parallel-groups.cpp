@@ -0,0 +1,428 @@
+/*
+ * parallel-groups.cpp
+ */
+
+#include "parallel-groups.hpp"
+#include "context.hpp"
+#include "result-sink.hpp"
+#include "stats.hpp"
+#include "util.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <new>
+#include <sstream>
+#include <stdexcept>
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std;
+
+bool is_core_local_group(const BenchmarkGroup& group) {
+    auto& tags = group.getTags();
+    return std::find(tags.begin(), tags.end(), "core-local") != tags.end();
+}
+
+/* read a single integer from the sysfs topology file for the given CPU, returning -1 if it can't be read */
+static int read_topology(int cpu, const char* name) {
+    std::ifstream in(string_format("/sys/devices/system/cpu/cpu%d/topology/%s", cpu, name));
+    int value;
+    return in >> value ? value : -1;
+}
+
+void check_parallel_cpus(const std::vector<int>& cpus, const std::vector<int>& allowed) {
+    if (cpus.empty()) {
+        throw std::runtime_error("--parallel-groups needs at least one CPU");
+    }
+    std::map<std::pair<int, int>, int> cores;  // (package, core) -> first CPU seen on that core
+    for (int cpu : cpus) {
+        if (std::find(allowed.begin(), allowed.end(), cpu) == allowed.end()) {
+            throw std::runtime_error(string_format("CPU %d from --parallel-groups isn't in the allowed CPU set %s",
+                    cpu, container_to_string(allowed).c_str()));
+        }
+        std::pair<int, int> core{read_topology(cpu, "physical_package_id"), read_topology(cpu, "core_id")};
+        if (core.first < 0 || core.second < 0) {
+            continue;  // no topology info, so trust the user
+        }
+        auto found = cores.find(core);
+        if (found != cores.end()) {
+            throw std::runtime_error(string_format("CPUs %d and %d from --parallel-groups are on the same physical core,"
+                    " so groups running on them would interfere", found->second, cpu));
+        }
+        cores[core] = cpu;
+    }
+}
+
+/*
+ * The output of each group is recorded to its own file as a sequence of events, each a one byte type
+ * followed by its fields. Pointers to groups and benchmarks are recorded as-is, which works since the workers
+ * are forked after the benchmarks are created, so they are valid in the parent too.
+ */
+enum EventType : int {
+    TEXT        = 'T',  // text written directly to Context::out()
+    GROUP_START = 'S',
+    GROUP_END   = 'E',
+    RESULT      = 'R',
+    HISTOGRAM   = 'H',
+    SKIPPED     = 'K',
+    FAILED      = 'X',  // the group threw an exception, with the message
+    DONE        = 'D',  // the group ran to completion, always the last event for a group which did
+};
+
+class EventWriter {
+    FILE* f_;
+public:
+    explicit EventWriter(FILE* f) : f_{f} {}
+
+    void bytes(const void* p, size_t n) {
+        if (fwrite(p, 1, n, f_) != n) {
+            throw std::runtime_error("failed to record parallel group output: " + errno_to_str(errno));
+        }
+    }
+
+    template <typename T>
+    void value(T v) { bytes(&v, sizeof(v)); }
+
+    void str(const std::string& s) {
+        value<uint64_t>(s.size());
+        bytes(s.data(), s.size());
+    }
+
+    void attrs(const attr_list& list) {
+        value<uint64_t>(list.size());
+        for (auto& a : list) {
+            str(a.first);
+            str(a.second);
+        }
+    }
+
+    template <typename T>
+    void vec(const std::vector<T>& v) {
+        value<uint64_t>(v.size());
+        bytes(v.data(), v.size() * sizeof(T));
+    }
+};
+
+class EventReader {
+    FILE* f_;
+public:
+    explicit EventReader(FILE* f) : f_{f} {}
+
+    /* the type of the next event, or EOF */
+    int next() { return fgetc(f_); }
+
+    void bytes(void* p, size_t n) {
+        if (fread(p, 1, n, f_) != n) {
+            throw std::runtime_error("truncated parallel group output");
+        }
+    }
+
+    template <typename T>
+    T value() {
+        T v;
+        bytes(&v, sizeof(v));
+        return v;
+    }
+
+    std::string str() {
+        std::string s(value<uint64_t>(), '\0');
+        bytes(&s[0], s.size());
+        return s;
+    }
+
+    attr_list attrs() {
+        attr_list list(value<uint64_t>());
+        for (auto& a : list) {
+            a.first  = str();
+            a.second = str();
+        }
+        return list;
+    }
+
+    template <typename T>
+    std::vector<T> vec() {
+        std::vector<T> v(value<uint64_t>());
+        bytes(v.data(), v.size() * sizeof(T));
+        return v;
+    }
+};
+
+/**
+ * The sink used in the workers, which records everything reported to it, along with any text written to the
+ * context output stream in between, to the file for the group currently running.
+ */
+class RecordingSink : public ResultSink {
+    bool is_text_;
+    std::ostringstream& text_;
+    EventWriter w_{nullptr};
+
+public:
+    RecordingSink(bool is_text, std::ostringstream& text) : is_text_{is_text}, text_(text) {}
+
+    /* start recording to the given file, discarding any text written since the last group */
+    void startGroup(FILE* f) {
+        w_ = EventWriter{f};
+        text_.str("");
+    }
+
+    /* record any pending text, must be called before every other event so that the order is kept */
+    void flushText() {
+        if (!text_.str().empty()) {
+            w_.value<char>(TEXT);
+            w_.str(text_.str());
+            text_.str("");
+        }
+    }
+
+    void done() {
+        flushText();
+        w_.value<char>(DONE);
+    }
+
+    void failed(const std::string& message) {
+        flushText();
+        w_.value<char>(FAILED);
+        w_.str(message);
+    }
+
+    virtual bool isText() const override { return is_text_; }
+
+    virtual void groupStart(Context& c, BenchmarkGroup& group) override {
+        flushText();
+        w_.value<char>(GROUP_START);
+        w_.value(&group);
+    }
+
+    virtual void groupEnd(Context& c, BenchmarkGroup& group, int64_t elapsed_ms) override {
+        flushText();
+        w_.value<char>(GROUP_END);
+        w_.value(&group);
+        w_.value(elapsed_ms);
+    }
+
+    virtual void result(Context& c, const ResultRecord& record) override {
+        flushText();
+        w_.value<char>(RESULT);
+        w_.value(record.bench);
+        w_.str(record.name);
+        w_.attrs(record.columns);
+        w_.attrs(record.attrs);
+        w_.vec(record.values);
+        w_.value(record.noise);
+    }
+
+    virtual void histogram(Context& c, const BenchmarkBase& bench, const std::string& metric, const Stats::Histogram& histogram) override {
+        flushText();
+        w_.value<char>(HISTOGRAM);
+        w_.value(&bench);
+        w_.str(metric);
+        w_.value(histogram.lo);
+        w_.value(histogram.width);
+        w_.vec(histogram.counts);
+    }
+
+    virtual void skipped(Context& c, const BenchmarkBase& bench, const std::string& reason) override {
+        flushText();
+        w_.value<char>(SKIPPED);
+        w_.value(&bench);
+        w_.str(reason);
+    }
+};
+
+/*
+ * Replay the events recorded in f for group into the context, throwing std::runtime_error if the group failed
+ * or its recording is incomplete, e.g., because its worker crashed.
+ */
+static void replay(Context& c, const BenchmarkGroup& group, FILE* f) {
+    rewind(f);
+    EventReader r{f};
+    ResultSink& sink = c.getSink();
+    for (int type; (type = r.next()) != EOF; ) {
+        switch (type) {
+        case TEXT:
+            c.out() << r.str();
+            break;
+        case GROUP_START:
+            sink.groupStart(c, *r.value<BenchmarkGroup*>());
+            break;
+        case GROUP_END: {
+            auto group = r.value<BenchmarkGroup*>();
+            sink.groupEnd(c, *group, r.value<int64_t>());
+            break;
+        }
+        case RESULT: {
+            ResultRecord record;
+            record.bench   = r.value<const BenchmarkBase*>();
+            record.name    = r.str();
+            record.columns = r.attrs();
+            record.attrs   = r.attrs();
+            record.values  = r.vec<double>();
+            record.noise   = r.value<double>();
+            sink.result(c, record);
+            break;
+        }
+        case HISTOGRAM: {
+            auto bench = r.value<const BenchmarkBase*>();
+            std::string metric = r.str();
+            Stats::Histogram h;
+            h.lo     = r.value<double>();
+            h.width  = r.value<double>();
+            h.counts = r.vec<size_t>();
+            sink.histogram(c, *bench, metric, h);
+            break;
+        }
+        case SKIPPED: {
+            auto bench = r.value<const BenchmarkBase*>();
+            sink.skipped(c, *bench, r.str());
+            break;
+        }
+        case DONE:
+            return;
+        case FAILED:
+            throw std::runtime_error(r.str());
+        default:
+            throw std::runtime_error("corrupt parallel group output");
+        }
+    }
+    throw std::runtime_error("group " + group.getId() + " didn't finish, its parallel worker exited early");
+}
+
+bool ParallelResults::replay(Context& c, const BenchmarkGroup& group) const {
+    auto found = files_.find(&group);
+    if (found == files_.end()) {
+        return false;
+    }
+    ::replay(c, group, found->second.get());
+    return true;
+}
+
+void ParallelResults::finish() const {
+    if (!worker_failure_.empty()) {
+        throw std::runtime_error(worker_failure_);
+    }
+}
+
+
+/*
+ * The body of a worker process: pin to cpu, then keep taking the next group which hasn't been started by
+ * any worker and run it, until there are none left. Returns the exit status for the worker.
+ */
+static int run_worker(Context& c, int cpu, const GroupList& groups, const std::vector<FILE*>& files,
+        std::atomic<size_t>& next, const predicate_t& predicate) {
+    std::ostringstream text;
+    RecordingSink* recorder = new RecordingSink(c.getSink().isText(), text);
+    c.redirect(&text, std::unique_ptr<ResultSink>(recorder));
+
+    size_t i = next.fetch_add(1);
+    if (i < groups.size()) {
+        recorder->startGroup(files[i]);
+    }
+    try {
+        pin_to_cpu(cpu);
+        // helper threads would disturb the groups being measured by the other workers
+        set_helper_cpus({});
+        // the results are recorded with only the measured metrics, and the parent's sink appends the derived ones
+        c.initTimer(false);
+        for (; i < groups.size(); i = next.fetch_add(1)) {
+            recorder->startGroup(files[i]);
+            groups[i]->runIf(c, predicate);
+            recorder->done();
+            fflush(files[i]);
+        }
+    } catch (std::exception& e) {
+        if (i < groups.size()) {
+            recorder->failed(string_format("group %s failed on CPU %d: %s", groups[i]->getId().c_str(), cpu, e.what()));
+            fflush(files[i]);
+        }
+        return EXIT_FAILURE;
+    } catch (...) {
+        if (i < groups.size()) {
+            recorder->failed(string_format("group %s failed on CPU %d", groups[i]->getId().c_str(), cpu));
+            fflush(files[i]);
+        }
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+ParallelResults run_parallel_groups(Context& c, const GroupList& groups, const predicate_t& predicate, const std::vector<int>& cpus) {
+    GroupList parallel;
+    for (auto& group : groups) {
+        auto& benches = group->getBenches();
+        if (is_core_local_group(*group) && std::any_of(benches.begin(), benches.end(), predicate)) {
+            parallel.push_back(group);
+        }
+    }
+    ParallelResults results;
+    if (parallel.empty()) {
+        return results;
+    }
+
+    c.log() << "Running " << parallel.size() << " core-local groups in parallel on CPUs " << container_to_string(cpus)
+            << ", the remaining groups will run serially afterwards" << endl;
+
+    std::vector<FILE*> files;
+    for (auto& group : parallel) {
+        FILE* f = tmpfile();
+        if (!f) {
+            throw std::runtime_error("couldn't create temporary file for parallel groups: " + errno_to_str(errno));
+        }
+        results.files_[group.get()] = std::shared_ptr<FILE>(f, fclose);
+        files.push_back(f);
+    }
+
+    // the index of the next group to run, shared by all the workers
+    void* shared = mmap(nullptr, sizeof(std::atomic<size_t>), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+        throw std::runtime_error("mmap failed for parallel groups: " + errno_to_str(errno));
+    }
+    auto next = new (shared) std::atomic<size_t>{0};
+
+    // anything still buffered would otherwise be written again by every worker
+    c.out().flush();
+    c.log().flush();
+    c.err().flush();
+    fflush(nullptr);
+
+    std::vector<std::pair<pid_t, int>> workers;  // (pid, cpu)
+    for (int cpu : cpus) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            int status = run_worker(c, cpu, parallel, files, *next, predicate);
+            fflush(nullptr);
+            _exit(status);
+        } else if (pid < 0) {
+            // the workers already started will still run every group
+            c.err() << "WARNING: fork failed for parallel group worker on CPU " << cpu << ": " << errno_to_str(errno) << endl;
+            if (workers.empty()) {
+                throw std::runtime_error("couldn't start any parallel group workers");
+            }
+            break;
+        }
+        workers.emplace_back(pid, cpu);
+    }
+
+    for (auto& worker : workers) {
+        int status;
+        while (waitpid(worker.first, &status, 0) < 0 && errno == EINTR) {}
+        if (!results.worker_failure_.empty()) {
+            continue;
+        }
+        if (WIFSIGNALED(status)) {
+            results.worker_failure_ = string_format("the parallel group worker on CPU %d was killed by signal %d",
+                    worker.second, WTERMSIG(status));
+        } else if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+            results.worker_failure_ = string_format("the parallel group worker on CPU %d failed with exit status %d",
+                    worker.second, WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+        }
+    }
+    munmap(shared, sizeof(std::atomic<size_t>));
+
+    return results;
+}
@@ -0,0 +1,69 @@
+/*
+ * parallel-groups.hpp
+ *
+ * Support for --parallel-groups, which runs independent benchmark groups at the same time in worker processes,
+ * one per CPU in the given list, to cut the time of a full run. Each group still runs entirely on one pinned CPU,
+ * so groups limited by core-local resources (decode, the execution ports, branch prediction, etc.) give the same
+ * results as a serial run as long as the CPUs are on distinct physical cores.
+ *
+ * Only groups tagged "core-local" (see BenchmarkGroup::setTags) are run in parallel, since running anything
+ * which touches resources shared between cores (the L3, memory bandwidth, the uncore, etc.) alongside other
+ * groups would skew its results. The rest run serially afterwards as usual.
+ *
+ * Workers don't write their output directly: everything a group reports is recorded, and once all the workers
+ * are done the recordings are replayed into the real sink in the usual group order, interleaved with the groups
+ * run serially, so the output is the same as a serial run regardless of which worker ran which group, or when.
+ */
+
+#ifndef PARALLEL_GROUPS_HPP_
+#define PARALLEL_GROUPS_HPP_
+
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "benchmark.hpp"
+
+/* true if the group only uses resources private to its core, and so can run in parallel with other groups */
+bool is_core_local_group(const BenchmarkGroup& group);
+
+/**
+ * Check that the given CPUs are suitable for --parallel-groups: at least one, each allowed, and all on
+ * different physical cores. Throws std::runtime_error if not.
+ */
+void check_parallel_cpus(const std::vector<int>& cpus, const std::vector<int>& allowed);
+
+/**
+ * The recorded output of the groups run by run_parallel_groups.
+ */
+class ParallelResults {
+    friend ParallelResults run_parallel_groups(Context& c, const GroupList& groups, const predicate_t& predicate,
+            const std::vector<int>& cpus);
+
+    std::map<const BenchmarkGroup*, std::shared_ptr<FILE>> files_;
+    // describes the first worker which didn't exit cleanly, if any
+    std::string worker_failure_;
+
+public:
+    /**
+     * If the group was run in parallel, replay its recorded output into the context and return true, otherwise
+     * return false and the caller should run it. Throws std::runtime_error if the group failed or didn't finish.
+     */
+    bool replay(Context& c, const BenchmarkGroup& group) const;
+
+    /* call after all groups have been replayed, throws std::runtime_error if any worker didn't exit cleanly */
+    void finish() const;
+};
+
+/**
+ * Run the core-local groups with benchmarks matching predicate in parallel across the given CPUs, one worker
+ * process per CPU, and return their recorded output, to be replayed in group order as the groups are reached.
+ *
+ * Must be called before the timer is initialized, since each worker initializes its own copy after forking.
+ */
+ParallelResults run_parallel_groups(Context& c, const GroupList& groups, const predicate_t& predicate,
+        const std::vector<int>& cpus);
+
+#endif /* PARALLEL_GROUPS_HPP_ */
@@ -0,0 +1,159 @@
+/*
+ * params.cpp
+ */
+
+#include "params.hpp"
+#include "util.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <stdexcept>
+
+using namespace std;
+
+/* parameter overrides, keyed by NAME or GROUP/NAME, and whether each one matched a declared parameter */
+struct Override {
+    std::string spec;
+    param_values values;
+    bool used;
+};
+
+static std::map<std::string, Override> overrides;
+static std::vector<ParamInfo> declared;
+
+static int64_t parse_param_value(const std::string& str, const std::string& spec) {
+    size_t idx = 0;
+    long long value;
+    try {
+        value = std::stoll(str, &idx);
+    } catch (std::logic_error&) {
+        idx = 0;
+    }
+    if (str.empty() || idx != str.size()) {
+        throw std::runtime_error("bad value '" + str + "' in parameter spec '" + spec + "'");
+    }
+    return value;
+}
+
+param_values parse_param_spec(const std::string& spec) {
+    param_values values;
+    for (auto& item : split_on_string(spec, ",")) {
+        auto dots = item.find("..");
+        if (dots == std::string::npos) {
+            values.push_back(parse_param_value(item, spec));
+            continue;
+        }
+
+        std::string hi_step = item.substr(dots + 2);
+        auto colon = hi_step.find(':');
+        int64_t lo = parse_param_value(item.substr(0, dots), spec);
+        int64_t hi = parse_param_value(hi_step.substr(0, colon), spec);
+        char op = '+';
+        int64_t step = 1;
+        if (colon != std::string::npos) {
+            std::string step_str = hi_step.substr(colon + 1);
+            op = step_str.empty() ? 0 : step_str[0];
+            if (op != '+' && op != 'x') {
+                throw std::runtime_error("range step must be +N or xN in parameter spec '" + spec + "'");
+            }
+            step = parse_param_value(step_str.substr(1), spec);
+        }
+        if (lo > hi || step < (op == '+' ? 1 : 2) || (op == 'x' && lo < 1)) {
+            throw std::runtime_error("bad range '" + item + "' in parameter spec '" + spec + "'");
+        }
+        for (int64_t v = lo; v <= hi; ) {
+            values.push_back(v);
+            if ((op == '+' && v > hi - step) || (op == 'x' && v > hi / step)) {
+                break;  // the next value would be past hi (and might overflow)
+            }
+            v = op == '+' ? v + step : v * step;
+        }
+    }
+    return values;
+}
+
+std::string to_param_spec(const param_values& values) {
+    std::string spec;
+    for (auto v : values) {
+        spec += (spec.empty() ? "" : ",") + std::to_string(v);
+    }
+    return spec;
+}
+
+void set_param(const std::string& assignment) {
+    auto eq = assignment.find('=');
+    if (eq == std::string::npos || eq == 0) {
+        throw std::runtime_error("parameter override '" + assignment + "' should look like NAME=SPEC");
+    }
+    std::string spec = assignment.substr(eq + 1);
+    overrides[assignment.substr(0, eq)] = Override{spec, parse_param_spec(spec), false};
+}
+
+/* strip leading and trailing whitespace */
+static std::string trim(const std::string& s) {
+    auto start = s.find_first_not_of(" \t\r");
+    auto end   = s.find_last_not_of(" \t\r");
+    return start == std::string::npos ? "" : s.substr(start, end - start + 1);
+}
+
+void load_param_file(const std::string& filename) {
+    std::ifstream in(filename);
+    if (!in) {
+        throw std::runtime_error("couldn't open parameter file " + filename + ": " + errno_to_str(errno));
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+        line = trim(line.substr(0, line.find('#')));
+        if (!line.empty()) {
+            auto eq = line.find('=');
+            set_param(eq == std::string::npos ? line : trim(line.substr(0, eq)) + "=" + trim(line.substr(eq + 1)));
+        }
+    }
+}
+
+param_values get_param(const std::string& group, const std::string& name, const std::string& description,
+        const std::string& default_spec, int64_t min, int64_t max) {
+    if (std::none_of(declared.begin(), declared.end(),
+            [&](const ParamInfo& p){ return p.group == group && p.name == name; })) {
+        declared.push_back(ParamInfo{group, name, description, default_spec, min, max});
+    }
+
+    param_values values;
+    auto o = overrides.find(group + "/" + name);
+    if (o != overrides.end()) {
+        values = o->second.values;
+    } else if ((o = overrides.find(name)) != overrides.end()) {
+        // a generic override applies to groups with different allowed ranges, so each group just takes the values
+        // within its range
+        std::copy_if(o->second.values.begin(), o->second.values.end(), std::back_inserter(values),
+                [=](int64_t v){ return v >= min && v <= max; });
+    } else {
+        values = parse_param_spec(default_spec);
+    }
+    if (o != overrides.end()) {
+        o->second.used = true;
+    }
+
+    for (auto v : values) {
+        if (v < min || v > max) {
+            throw std::runtime_error(string_format("value %lld for parameter %s of group %s is outside the allowed range [%lld, %lld]",
+                    (long long)v, name.c_str(), group.c_str(), (long long)min, (long long)max));
+        }
+    }
+    return values;
+}
+
+const std::vector<ParamInfo>& declared_params() {
+    return declared;
+}
+
+void check_param_overrides() {
+    for (auto& o : overrides) {
+        if (!o.second.used) {
+            throw std::runtime_error("parameter override " + o.first + " doesn't match any parameter (see --list-params)");
+        }
+    }
+}
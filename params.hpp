@@ -0,0 +1,61 @@
+/*
+ * params.hpp
+ *
+ * Runtime benchmark parameters. A benchmark group can declare a named parameter, such as the region sizes
+ * or strides it tests, along with its default values. The user can then override the values from the command
+ * line with --param NAME=SPEC, or from a file with --param-file, without recompiling.
+ *
+ * A SPEC is a comma separated list of values and ranges. A range is LO..HI with an optional step, either
+ * LO..HI:+N which adds N each time (the default is +1) or LO..HI:xN which multiplies by N each time, and
+ * includes every value up to and including HI. For example: 16..65536:x2 or 0,1,2,8..64:+8.
+ *
+ * The NAME in an override is either just the parameter name, which applies to every group that declares a
+ * parameter with that name, or GROUP/NAME which applies only to the group with the given ID and takes
+ * precedence, e.g., --param kib=16..64:x2 or --param memory/load-parallel/kib=32.
+ */
+
+#ifndef PARAMS_HPP_
+#define PARAMS_HPP_
+
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
+
+/* a parameter declared by a benchmark group */
+struct ParamInfo {
+    std::string group, name, description, default_spec;
+    int64_t min, max;
+};
+
+using param_values = std::vector<int64_t>;
+
+constexpr int64_t PARAM_MAX = std::numeric_limits<int64_t>::max();
+
+/* parse the given SPEC into its values, in order, throwing std::runtime_error if it is malformed */
+param_values parse_param_spec(const std::string& spec);
+
+/* format the given values as a SPEC, as a plain list of values */
+std::string to_param_spec(const param_values& values);
+
+/* apply an override of the form NAME=SPEC, throwing std::runtime_error if it is malformed */
+void set_param(const std::string& assignment);
+
+/* apply the overrides in the given file, one NAME=SPEC per line, ignoring blank lines and # comments */
+void load_param_file(const std::string& filename);
+
+/**
+ * Declare a parameter for the given group, returning the overridden values if there is an override, otherwise the
+ * values of default_spec. Values from a GROUP/NAME override must be within [min, max] or std::runtime_error is
+ * thrown, while a plain NAME override contributes only the values within [min, max] for the group.
+ */
+param_values get_param(const std::string& group, const std::string& name, const std::string& description,
+        const std::string& default_spec, int64_t min = 0, int64_t max = PARAM_MAX);
+
+/* all parameters declared so far, in declaration order */
+const std::vector<ParamInfo>& declared_params();
+
+/* throw std::runtime_error if any override didn't match a declared parameter, which is probably a typo */
+void check_param_overrides();
+
+#endif /* PARAMS_HPP_ */
@@ -6,7 +6,9 @@
 
 #include "perf-timer.hpp"
 
+#include <algorithm>
 #include <cassert>
+#include <limits>
 #include <stdexcept>
 #include <string>
 #include <vector>
@@ -22,6 +24,7 @@ extern "C" {
 #include "pmu-tools/jevents/rdpmc.h"
 }
 
+#include "matchers.hpp"
 #include "table.hpp"
 #include "timers.hpp"
 #include "util.hpp"
@@ -38,12 +41,24 @@ struct PerfEvent {
 struct RunningEvent {
     rdpmc_ctx ctx;
     NamedEvent name;
+    /* the index of this event in the metrics */
+    size_t metric;
 
-    RunningEvent(const rdpmc_ctx& ctxx, const NamedEvent& name) : ctx(ctxx), name{name} {}
+    RunningEvent(const rdpmc_ctx& ctxx, const NamedEvent& name, size_t metric) : ctx(ctxx), name{name}, metric{metric} {}
+};
+
+/* an extra event, which is programmed when its batch is selected */
+struct BatchedEvent {
+    NamedEvent name;
+    perf_event_attr attr;
+    size_t metric;
 };
 
 static int init_count;
+/* the cycles event, followed by the extra events in the selected batch */
 static vector<RunningEvent> running_events;
+static vector<vector<BatchedEvent>> batches;
+static size_t selected_batch;
 
 static std::string make_header(std::string name) {
     return name.substr(0, std::min((size_t)6, name.length()));
@@ -127,20 +142,44 @@ PerfTimer::PerfTimer(Context& c) : TimerInfo(
         {})
 {}
 
+PerfCounters PerfTimer::counters;
+
+/*
+ * Resolve the counters for the running events for now(). There is an unfortunate mismatch between the one
+ * TimerInfo instance that is created, and the fact that ::now is static, see issue #62, so they are static.
+ */
+static void update_counters(PerfCounters& counters) {
+    counters.count = running_events.size();
+    counters.width = 64;
+    for (size_t i = 0; i < running_events.size(); i++) {
+        auto buf = running_events[i].ctx.buf;
+        // the index in the mmap page is one more than the counter number that rdpmc takes
+        counters.index[i] = buf->index - 1;
+        counters.lock[i] = &buf->lock;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3,12,0)
+        counters.width = std::min(counters.width, (unsigned)buf->pmc_width);
+#else
+        counters.width = 40;
+#endif
+    }
+}
+
 PerfNow PerfTimer::delta(const PerfNow& a, const PerfNow& b) {
+    // the raw counter values are only width bits, so the delta is sign extended from there, which also
+    // handles the counter wrapping around
+    unsigned shift = 64 - counters.width;
     PerfNow ret;
     for (unsigned i = 0; i < PerfNow::READING_COUNT; i++) {
-        ret.readings[i] = a.readings[i] - b.readings[i];
+        ret.readings[i] = (int64_t)((uint64_t)(a.readings[i] - b.readings[i]) << shift) >> shift;
     }
     return ret;
 }
 
 TimingResult PerfTimer::to_result(const PerfTimer& ti, PerfNow delta) {
-    size_t count = running_events.size();
-    vector<double> results;
-    results.resize(count);
-    for (size_t i = 0; i < count; i++) {
-        results[i] = delta.readings[i];
+    // events which aren't in the selected batch are NaN, and the derived metrics are added later by the sink
+    vector<double> results(ti.measuredMetricCount(), std::numeric_limits<double>::quiet_NaN());
+    for (size_t i = 0; i < running_events.size(); i++) {
+        results.at(running_events[i].metric) = delta.readings[i];
     }
     return { results };
 }
@@ -201,6 +240,105 @@ std::vector<NamedEvent> parsePerfEvents(const std::string& event_string) {
     return events;
 }
 
+std::vector<NamedEvent> expandPerfEvents(Context& c, const std::vector<NamedEvent>& events) {
+    std::vector<NamedEvent> ret;
+    std::vector<PerfEvent> all;
+    for (auto& e : events) {
+        if (e.name.find('*') == std::string::npos) {
+            ret.push_back(e);
+            continue;
+        }
+        if (all.empty()) {
+            all = get_all_events();
+        }
+        WildcardMatcher matcher{e.name};
+        size_t before = ret.size();
+        for (auto& pe : all) {
+            if (matcher(pe.name) && std::find(ret.begin(), ret.end(), NamedEvent{pe.name}) == ret.end()) {
+                ret.emplace_back(pe.name);
+            }
+        }
+        if (ret.size() == before) {
+            c.err() << "No events match '" << e.name << "' - check the available events with --list-events" << endl;
+        }
+    }
+    return ret;
+}
+
+/*
+ * The events for the top-down breakdown, using the Intel event names from Skylake (which most later cores
+ * also have), in the order of the TD_ constants below.
+ */
+static const std::vector<std::string> topdown_events = {
+    "IDQ_UOPS_NOT_DELIVERED.CORE",
+    "UOPS_ISSUED.ANY",
+    "UOPS_RETIRED.RETIRE_SLOTS",
+    "INT_MISC.RECOVERY_CYCLES",
+    "IDQ_UOPS_NOT_DELIVERED.CYCLES_0_UOPS_DELIV.CORE",
+    "BR_MISP_RETIRED.ALL_BRANCHES",
+    "MACHINE_CLEARS.COUNT",
+    "CYCLE_ACTIVITY.STALLS_MEM_ANY",
+    "EXE_ACTIVITY.BOUND_ON_STORES",
+    "CYCLE_ACTIVITY.STALLS_TOTAL",
+    "EXE_ACTIVITY.1_PORTS_UTIL",
+    "EXE_ACTIVITY.2_PORTS_UTIL",
+};
+
+enum {
+    TD_FE_NOT_DELIVERED, TD_UOPS_ISSUED, TD_RETIRE_SLOTS, TD_RECOVERY_CYCLES, TD_FE_0_DELIVERED, TD_BR_MISP,
+    TD_MACHINE_CLEARS, TD_STALLS_MEM, TD_BOUND_ON_STORES, TD_STALLS_TOTAL, TD_1_PORTS, TD_2_PORTS
+};
+
+/* the top-down categories as fractions of the pipeline slots, level 1 followed by level 2 */
+struct Topdown {
+    double retiring, bad_spec, frontend, backend;
+    double fe_latency, fe_bandwidth, branch_mispredicts, machine_clears, memory_bound, core_bound;
+
+    /* cycles is the cycle count, and events are the counts of topdown_events, in order */
+    Topdown(double cycles, const std::vector<double>& e) {
+        // each cycle has 4 issue slots
+        double slots = 4 * cycles;
+        retiring = e[TD_RETIRE_SLOTS] / slots;
+        bad_spec = (e[TD_UOPS_ISSUED] - e[TD_RETIRE_SLOTS] + 4 * e[TD_RECOVERY_CYCLES]) / slots;
+        frontend = e[TD_FE_NOT_DELIVERED] / slots;
+        backend  = 1 - (retiring + bad_spec + frontend);
+
+        fe_latency   = 4 * e[TD_FE_0_DELIVERED] / slots;
+        fe_bandwidth = frontend - fe_latency;
+
+        branch_mispredicts = bad_spec * e[TD_BR_MISP] / (e[TD_BR_MISP] + e[TD_MACHINE_CLEARS]);
+        machine_clears     = bad_spec - branch_mispredicts;
+
+        // the share of the backend stall cycles which are waiting on memory
+        double stall_cycles = e[TD_STALLS_TOTAL] + e[TD_1_PORTS] + (retiring > 0.1 ? e[TD_2_PORTS] : 0) + e[TD_BOUND_ON_STORES];
+        memory_bound = backend * (e[TD_STALLS_MEM] + e[TD_BOUND_ON_STORES]) / stall_cycles;
+        core_bound   = backend - memory_bound;
+    }
+};
+
+/* add the top-down metrics as derived metrics, given the metric index of each of the topdown_events */
+static void add_topdown_metrics(TimerInfo& timer, const std::vector<size_t>& metrics) {
+    auto add = [&](const char* name, double Topdown::* field) {
+        timer.addDerivedMetric({name, [=](const std::vector<double>& values) {
+            std::vector<double> events;
+            for (size_t m : metrics) {
+                events.push_back(values.at(m));
+            }
+            return 100 * (Topdown{values.at(0), events}.*field);
+        }});
+    };
+    add("Retire%", &Topdown::retiring);
+    add("BadSp%",  &Topdown::bad_spec);
+    add("FEnd%",   &Topdown::frontend);
+    add("BEnd%",   &Topdown::backend);
+    add("FELat%",  &Topdown::fe_latency);
+    add("FEBw%",   &Topdown::fe_bandwidth);
+    add("BrMsp%",  &Topdown::branch_mispredicts);
+    add("MClr%",   &Topdown::machine_clears);
+    add("Mem%",    &Topdown::memory_bound);
+    add("Core%",   &Topdown::core_bound);
+}
+
 void PerfTimer::init(Context &c) {
     assert(init_count++ == 0);
 
@@ -225,54 +363,164 @@ void PerfTimer::init(Context &c) {
             if (rdpmc_open_attr(&cycles_attr, &ctx, nullptr)) {
                 throw std::runtime_error("rdpmc_open cycles failed, checked stderr for more");
             } else {
-                c.out() << "Counting user-mode events only: set /proc/sys/kernel/perf_event_paranoid to 1 or less to count kernel events\n";
+                c.log() << "Counting user-mode events only: set /proc/sys/kernel/perf_event_paranoid to 1 or less to count kernel events\n";
                 user_only = true;
             }
         }
 
-        c.out() << "Programmed cycles event, ";
-        print_caps(c.out(), ctx);
+        c.log() << "Programmed cycles event, ";
+        print_caps(c.log(), ctx);
 
-        running_events.emplace_back(ctx, NamedEvent{"Cycles"});
+        running_events.emplace_back(ctx, NamedEvent{"Cycles"}, 0);
     }
 
-    for (auto& named_event : parsePerfEvents(args.extra_events)) {
+    // the extra events are programmed as they are resolved, and when one can't be scheduled alongside the
+    // events before it, those events are closed and form a batch, and a new batch is started
+    vector<BatchedEvent> batch;
+    auto end_batch = [&batch]{
+        for (size_t i = 1; i < running_events.size(); i++) {
+            rdpmc_close(&running_events[i].ctx);
+        }
+        running_events.erase(running_events.begin() + 1, running_events.end());
+        batches.push_back(std::move(batch));
+        batch.clear();
+    };
+
+    auto events = expandPerfEvents(c, parsePerfEvents(args.extra_events));
+    if (args.topdown) {
+        for (auto& e : topdown_events) {
+            if (std::find(events.begin(), events.end(), NamedEvent{e}) == events.end()) {
+                events.emplace_back(e);
+            }
+        }
+    }
+
+    for (auto& named_event : events) {
         auto& e = named_event.name;
         if (e.empty()) {
             continue;
         }
-        if (running_events.size() == PerfNow::READING_COUNT) {
-            c.err() << "Event '" << e << " could not be programmed since at most " << MAX_EXTRA_EVENTS << " are allowed" << endl;
-            continue;
-        }
 
         perf_event_attr attr = {};
         if (resolve_event(e.c_str(), &attr)) {
-            c.out() << "Unable to resolve event '" << e << "' - check the available events with --list-events" << endl;
-        } else {
-            fixup_event(&attr, user_only);
-            rdpmc_ctx ctx{};
+            c.err() << "Unable to resolve event '" << e << "' - check the available events with --list-events" << endl;
+            continue;
+        }
+        fixup_event(&attr, user_only);
+
+        if (batch.size() == MAX_EXTRA_EVENTS) {
+            end_batch();
+        }
+        rdpmc_ctx ctx{};
+        if (rdpmc_open_attr(&attr, &ctx, nullptr)) {
+            c.err() << "Failed to program event '" << e << "' (resolved to '" << perf_attr_to_string(&attr) << "')\n";
+            continue;
+        }
+        if (ctx.buf->index == 0 && !batch.empty()) {
+            // probably no free counter, so try again in a new batch
+            rdpmc_close(&ctx);
+            end_batch();
+            ctx = {};
             if (rdpmc_open_attr(&attr, &ctx, nullptr)) {
                 c.err() << "Failed to program event '" << e << "' (resolved to '" << perf_attr_to_string(&attr) << "')\n";
-            } else {
-                c.out() << "Resolved and programmed event '" << e << "' to '" << perf_attr_to_string(&attr) << "', ";
-                print_caps(c.out(), ctx);
-
-                if (ctx.buf->index == 0) {
-                    c.err() << "Failed to program event '" << e << "' (index == 0, rdpmc not available)" << endl;
-                    rdpmc_close(&ctx);
-                } else {
-                    running_events.emplace_back(ctx, named_event);
-                }
+                continue;
             }
         }
+        c.log() << "Resolved and programmed event '" << e << "' to '" << perf_attr_to_string(&attr) << "', ";
+        print_caps(c.log(), ctx);
+
+        if (ctx.buf->index == 0) {
+            c.err() << "Failed to program event '" << e << "' (index == 0, rdpmc not available)" << endl;
+            rdpmc_close(&ctx);
+        } else {
+            size_t metric = 1 + batch.size();  // after cycles and the events before it
+            for (auto& b : batches) {
+                metric += b.size();
+            }
+            running_events.emplace_back(ctx, named_event, metric);
+            batch.push_back(BatchedEvent{named_event, attr, metric});
+        }
+    }
+    if (!batch.empty()) {
+        // the last batch is left programmed
+        batches.push_back(std::move(batch));
+        selected_batch = batches.size() - 1;
     }
 
     assert(running_events.size() <= PerfNow::READING_COUNT);
 
-    for (auto& e : running_events) {
-        metric_names_.push_back(e.name.header);
+    metric_names_.push_back(running_events.front().name.header);
+    for (auto& b : batches) {
+        for (auto& e : b) {
+            metric_names_.push_back(e.name.header);
+        }
+    }
+
+    if (args.topdown) {
+        // the metric for each of the topdown events, which must have been programmed
+        std::vector<size_t> metrics;
+        std::string missing;
+        for (auto& e : topdown_events) {
+            size_t metric = 0;
+            for (auto& b : batches) {
+                for (auto& be : b) {
+                    if (!metric && be.name.name == e) {
+                        metric = be.metric;
+                    }
+                }
+            }
+            if (metric) {
+                metrics.push_back(metric);
+            } else {
+                missing += " " + e;
+            }
+        }
+        if (!missing.empty()) {
+            throw std::runtime_error("--topdown needs events which couldn't be programmed on this CPU:" + missing);
+        }
+        add_topdown_metrics(*this, metrics);
     }
+
+    update_counters(counters);
+
+    if (batches.size() > 1) {
+        c.log() << "The " << (metric_names_.size() - derived_metrics_.size() - 1) << " extra events don't fit in the counters at once, so they are "
+                "split into " << batches.size() << " batches and each benchmark runs once per batch" << endl;
+        selectBatch(c, 0);
+    }
+}
+
+std::vector<std::string> PerfTimer::getEventNames() const {
+    std::vector<std::string> names{running_events.front().name.name};
+    for (auto& b : batches) {
+        for (auto& e : b) {
+            names.push_back(e.name.name);
+        }
+    }
+    return names;
+}
+
+size_t PerfTimer::batchCount() const {
+    return std::max(batches.size(), (size_t)1);
+}
+
+void PerfTimer::selectBatch(Context& c, size_t batch) {
+    if (batches.empty() || batch == selected_batch) {
+        return;
+    }
+    for (size_t i = 1; i < running_events.size(); i++) {
+        rdpmc_close(&running_events[i].ctx);
+    }
+    running_events.erase(running_events.begin() + 1, running_events.end());
+    for (auto& e : batches.at(batch)) {
+        rdpmc_ctx ctx{};
+        if (rdpmc_open_attr(&e.attr, &ctx, nullptr) || ctx.buf->index == 0) {
+            throw std::runtime_error("Failed to program event '" + e.name.name + "' for event batch " + std::to_string(batch));
+        }
+        running_events.emplace_back(ctx, e.name, e.metric);
+    }
+    update_counters(counters);
+    selected_batch = batch;
 }
 
 template <typename E>
@@ -302,18 +550,6 @@ void PerfTimer::listEvents(Context& c) {
     printEvents(c, get_raw_events);
 }
 
-PerfTimer::now_t PerfTimer::now() {
-    // there is an unfortunate mismatch between the one TimerInfo instance that is created, and the fact
-    // that ::now is static, see issue #62
-    PerfNow ret;
-
-    unsigned i = 0;
-    for (RunningEvent& e : running_events) {
-        ret.readings[i++] = rdpmc_read(&e.ctx);
-    }
-    return ret;
-}
-
 PerfTimer::~PerfTimer() = default;
 
 #endif // USE_PERF_TIMER
@@ -9,6 +9,7 @@
 
 #include <limits>
 #include <memory>
+#include <type_traits>
 
 #include "hedley.h"
 
@@ -23,12 +24,62 @@ struct PerfNow {
      * given event than the actual run) which if unsigned produces a large nonsense value.
      */
     int64_t readings[READING_COUNT];
+    /* the sum of the mmap page locks of the events, read before and after the readings, see PerfTimer::valid */
+    uint32_t lock_before, lock_after;
     /* return the unhalted clock cycles value (PFC_FIXEDCNT_CPU_CLK_UNHALTED) */
     uint64_t getClk() const { return readings[0]; }
 };
 
+/*
+ * The hardware counters for the programmed events, resolved once when they are programmed so that now()
+ * can read them directly with rdpmc.
+ */
+struct PerfCounters {
+    /* the number of programmed events, including cycles */
+    unsigned count;
+    /* the rdpmc counter index for each event */
+    uint32_t index[PerfNow::READING_COUNT];
+    /* the width in bits of the counter values */
+    unsigned width;
+    /* the seqlock in the perf mmap page of each event, which the kernel bumps whenever it updates the page */
+    const volatile uint32_t* lock[PerfNow::READING_COUNT];
+};
+
 class PerfTimer : public TimerInfo {
 
+    static PerfCounters counters;
+
+    HEDLEY_ALWAYS_INLINE
+    static int64_t rdpmc(uint32_t index) {
+        uint32_t lo, hi;
+        asm volatile ("rdpmc" : "=a" (lo), "=d" (hi) : "c" (index));
+        return ((int64_t)hi << 32) | lo;
+    }
+
+    template <unsigned N>
+    using count_t = std::integral_constant<unsigned, N>;
+
+    /* read the first N counters, fully unrolled */
+    template <unsigned N>
+    HEDLEY_ALWAYS_INLINE
+    static void read_counters(PerfNow& now, count_t<N>) {
+        read_counters(now, count_t<N - 1>{});
+        now.readings[N - 1] = rdpmc(counters.index[N - 1]);
+    }
+
+    HEDLEY_ALWAYS_INLINE
+    static void read_counters(PerfNow& now, count_t<0>) {}
+
+    HEDLEY_ALWAYS_INLINE
+    static uint32_t lock_sum() {
+        uint32_t sum = 0;
+        for (unsigned i = 0; i < counters.count; i++) {
+            sum += *counters.lock[i];
+        }
+        asm volatile ("" ::: "memory");
+        return sum;
+    }
+
 public:
 
     typedef PerfNow   now_t;
@@ -38,8 +89,38 @@ public:
 
     virtual void init(Context &) override;
 
-//    HEDLEY_ALWAYS_INLINE
-    static now_t now();
+    /*
+     * Unlike rdpmc_read(), this doesn't retry until the mmap page is stable or add the kernel's offset for the
+     * event. Pinning the events only keeps them scheduled while we run: when we're switched out or migrated the
+     * kernel saves the count into the offset and may reprogram the event on another counter (changing its index),
+     * so the raw values aren't comparable across that. Instead the page locks are summed around the readings, and
+     * valid() rejects any sample in which they changed.
+     */
+    HEDLEY_ALWAYS_INLINE
+    static now_t now() {
+        PerfNow ret;
+        ret.lock_before = lock_sum();
+        switch (counters.count) {
+        case 1: read_counters(ret, count_t<1>{}); break;
+        case 2: read_counters(ret, count_t<2>{}); break;
+        case 3: read_counters(ret, count_t<3>{}); break;
+        case 4: read_counters(ret, count_t<4>{}); break;
+        case 5: read_counters(ret, count_t<5>{}); break;
+        case 6: read_counters(ret, count_t<6>{}); break;
+        case 7: read_counters(ret, count_t<7>{}); break;
+        case 8: read_counters(ret, count_t<8>{}); break;
+        case 9: read_counters(ret, count_t<9>{}); break;
+        }
+        static_assert(PerfNow::READING_COUNT == 9, "update the cases above");
+        asm volatile ("" ::: "memory");
+        ret.lock_after = lock_sum();
+        return ret;
+    }
+
+    /* false if the kernel updated the page of any event, e.g., on a context switch, during the sample */
+    static bool valid(const PerfNow& t0, const PerfNow& t1) {
+        return t0.lock_before == t1.lock_after;
+    }
 
     static TimingResult to_result(const PerfTimer& ti, PerfNow delta);
 
@@ -56,6 +137,12 @@ public:
 
     virtual void listEvents(Context& c) override;
 
+    virtual std::vector<std::string> getEventNames() const override;
+
+    virtual size_t batchCount() const override;
+
+    virtual void selectBatch(Context& c, size_t batch) override;
+
     virtual ~PerfTimer();
 };
 
@@ -81,6 +168,9 @@ struct NamedEvent {
  */
 std::vector<NamedEvent> parsePerfEvents(const std::string& event_string);
 
+/* replace any events containing a * with all the available events whose names match it as a wildcard */
+std::vector<NamedEvent> expandPerfEvents(Context& c, const std::vector<NamedEvent>& events);
+
 #endif
 
 #endif /* PERF_TIMER_HPP_ */
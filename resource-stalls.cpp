@@ -7,6 +7,7 @@
 #include "benchmark.hpp"
 #include "boost/preprocessor/repetition/repeat_from_to.hpp"
 #include "hedley.h"
+#include "jit.hpp"
 #include "util.hpp"
 
 
@@ -18,7 +19,12 @@ bench2_f rs_dep_imul;
 bench2_f rs_split_stores;
 bench2_f rs_dep_fsqrt;
 
-#define MAX_RATIO 10
+#define MAX_RATIO     10
+#define MAX_LOADCHAIN 120
+#define MAX_STOREBUF   80
+// the larger loadchain and storebuf kernels are generated at runtime, up to these limits
+#define MAX_JIT_LOADCHAIN 1024
+#define MAX_JIT_STOREBUF  1024
 #define DECL_MANY(fname, op) BOOST_PP_REPEAT_FROM_TO(0, MAX_RATIO, DECL_BENCH2, fname ## op)
 
 DECL_MANY(rs_fsqrt_,nop)
@@ -34,9 +40,9 @@ DECL_MANY(rs_fsqrt_,load_dep)
 DECL_MANY(rs_load_,nop)
 DECL_MANY(rs_load_,add)
 
-BOOST_PP_REPEAT_FROM_TO(0, 120, DECL_BENCH2, rs_loadchain)
+BOOST_PP_REPEAT_FROM_TO(0, MAX_LOADCHAIN, DECL_BENCH2, rs_loadchain)
 
-BOOST_PP_REPEAT_FROM_TO(0, 80, DECL_BENCH2, rs_storebuf)
+BOOST_PP_REPEAT_FROM_TO(0, MAX_STOREBUF, DECL_BENCH2, rs_storebuf)
 
 }
 
@@ -49,20 +55,61 @@ long indirect_thunk(uint64_t iters, void *arg) {
     return thunk_arg.underlying(iters, nullptr);
 }
 
+// expands to a brace-enclosed list of the functions fname0, fname1, ... fname(count - 1)
+#define FN_ENTRY(z, n, fname) fname ## n,
+#define FN_ARRAY(fname, count) { BOOST_PP_REPEAT_FROM_TO(0, count, FN_ENTRY, fname) }
+
 template <typename M>
 HEDLEY_NEVER_INLINE
-void makei(bench2_f* fn, M& maker, const char* name, const char* desc, uint32_t ops_per_loop) {
+void makei(bench2_f* fn, M& maker, const std::string& name, const std::string& desc, uint32_t ops_per_loop) {
     thunk_args args{fn};
     arg_provider_t ap = [=]{ return (void *)&args; };
     maker.template make<indirect_thunk>(name, desc, ops_per_loop, ap);
 }
 
+#if !UARCH_BENCH_PORTABLE
+
+/* the same kernel as rs_loadchainN in x86-resource-stalls.asm */
+static bench2_f* jit_loadchain(int n) {
+    using namespace jit;
+    code_bytes prologue = {
+        0x55,                                           // push rbp
+        0x48, 0x89, 0xE5,                               // mov  rbp, rsp
+        0x48, 0x83, 0xE4, 0xC0,                         // and  rsp, -64
+        0x48, 0x81, 0xEC, 0x80, 0x00, 0x00, 0x00,       // sub  rsp, 128
+        0x48, 0xC7, 0x04, 0x24, 0x00, 0x00, 0x00, 0x00, // mov  QWORD [rsp], 0
+        0x31, 0xC0,                                     // xor  eax, eax
+        0x31, 0xC9,                                     // xor  ecx, ecx
+        0x48, 0x89, 0xE2,                               // mov  rdx, rsp
+    };
+    code_bytes epilogue = {
+        0x48, 0x89, 0xEC,                               // mov  rsp, rbp
+        0x5D,                                           // pop  rbp
+    };
+    epilogue.insert(epilogue.end(), insn::vzeroupper.begin(), insn::vzeroupper.end());
+    code_bytes body = Emitter().emit(insn::popcnt_rax_rax, n).emit(insn::lfence).code();
+    return make_loop(prologue, body, 32, epilogue);
+}
+
+/* the same kernel as rs_storebufN in x86-resource-stalls.asm */
+static bench2_f* jit_storebuf(int n) {
+    using namespace jit;
+    code_bytes prologue = {0x48, 0x83, 0xEC, 0x08};  // sub rsp, 8
+    prologue.insert(prologue.end(), insn::vxorps_xmm0.begin(), insn::vxorps_xmm0.end());
+    code_bytes body = Emitter().emit(insn::vsqrtss_xmm0, 10).emit(insn::movq_rax_xmm0)
+            .emit(insn::store_rsp_zero, n).emit(insn::vxorps_xmm0).code();
+    return make_loop(prologue, body, 32, {0x48, 0x83, 0xC4, 0x08});  // add rsp, 8
+}
+
+#endif
+
 template <typename TIMER>
 void register_rstalls(GroupList& list) {
 #if !UARCH_BENCH_PORTABLE
 
     std::shared_ptr<BenchmarkGroup> group = std::make_shared<BenchmarkGroup>("studies/resource-stalls", "Test RESOURCE_STALLS events");
     list.push_back(group);
+    group->setTags({"core-local"});
 
     auto maker = DeltaMaker<TIMER>(group.get(), 1000).setTags({"slow"});
 
@@ -72,36 +119,49 @@ void register_rstalls(GroupList& list) {
     makei(rs_split_stores, maker, "split-store", "Split stores (SB limit)",    128);
     makei(rs_dep_fsqrt   , maker, "fsqrt",       "Dependent fqrt (RS limit)",  128);
 
-    // a macro to call maker.make on test that mix fsqrt and antoher op in a variery of ratios
-#define MAKE_FSQRT_OP(z, n, op) makei(rs_fsqrt_ ## op ## n, maker, "fsqrt-" #op "-" #n, \
-        "fsqrt:" #op " in 1:" #n " ratio", 32);
-
-    BOOST_PP_REPEAT_FROM_TO(0, MAX_RATIO, MAKE_FSQRT_OP, nop)
-    BOOST_PP_REPEAT_FROM_TO(0, MAX_RATIO, MAKE_FSQRT_OP, add)
-    BOOST_PP_REPEAT_FROM_TO(0, MAX_RATIO, MAKE_FSQRT_OP, xorzero)
-    BOOST_PP_REPEAT_FROM_TO(0, MAX_RATIO, MAKE_FSQRT_OP, load)
-    BOOST_PP_REPEAT_FROM_TO(0, MAX_RATIO, MAKE_FSQRT_OP, store)
-    BOOST_PP_REPEAT_FROM_TO(0, MAX_RATIO, MAKE_FSQRT_OP, paddb)
-    BOOST_PP_REPEAT_FROM_TO(0, MAX_RATIO, MAKE_FSQRT_OP, vpaddb)
-    BOOST_PP_REPEAT_FROM_TO(0, MAX_RATIO, MAKE_FSQRT_OP, add_padd)
-    BOOST_PP_REPEAT_FROM_TO(0, MAX_RATIO, MAKE_FSQRT_OP, load_dep)
-
-#define MAKE_LOAD_OP(z, n, op) makei(rs_load_ ## op ## n, maker, "load-" #op "-" #n, \
-        "load:" #op " in 1:" #n " ratio", 32);
-
-    BOOST_PP_REPEAT_FROM_TO(0, MAX_RATIO, MAKE_LOAD_OP, nop)
-    BOOST_PP_REPEAT_FROM_TO(0, MAX_RATIO, MAKE_LOAD_OP, add)
-
-#define MAKE_LOADCHAIN(z, n, _) makei(rs_loadchain ## n, maker, "loadchain-" #n, \
-        "loadchain: " #n " loads", 32);
-
-    BOOST_PP_REPEAT_FROM_TO(0, 120, MAKE_LOADCHAIN, _)
-
-#define MAKE_STOREBUF(z, n, _) makei(rs_storebuf ## n, maker, "storebuf-" #n, \
-        "storebuf: " #n " stores", 32);
-
-    BOOST_PP_REPEAT_FROM_TO(0, 80, MAKE_STOREBUF, _)
-
+    // the kernels for each ratio are generated when the asm is assembled, so the runtime parameter
+    // can only select among the existing ones
+    struct ratio_op {
+        const char* prefix;
+        const char* op;
+        bench2_f* fns[MAX_RATIO];
+    };
+
+    const ratio_op ratio_ops[] = {
+        {"fsqrt", "nop",      FN_ARRAY(rs_fsqrt_nop,      MAX_RATIO)},
+        {"fsqrt", "add",      FN_ARRAY(rs_fsqrt_add,      MAX_RATIO)},
+        {"fsqrt", "xorzero",  FN_ARRAY(rs_fsqrt_xorzero,  MAX_RATIO)},
+        {"fsqrt", "load",     FN_ARRAY(rs_fsqrt_load,     MAX_RATIO)},
+        {"fsqrt", "store",    FN_ARRAY(rs_fsqrt_store,    MAX_RATIO)},
+        {"fsqrt", "paddb",    FN_ARRAY(rs_fsqrt_paddb,    MAX_RATIO)},
+        {"fsqrt", "vpaddb",   FN_ARRAY(rs_fsqrt_vpaddb,   MAX_RATIO)},
+        {"fsqrt", "add_padd", FN_ARRAY(rs_fsqrt_add_padd, MAX_RATIO)},
+        {"fsqrt", "load_dep", FN_ARRAY(rs_fsqrt_load_dep, MAX_RATIO)},
+        {"load",  "nop",      FN_ARRAY(rs_load_nop,       MAX_RATIO)},
+        {"load",  "add",      FN_ARRAY(rs_load_add,       MAX_RATIO)},
+    };
+
+    // tests that mix fsqrt or a load and another op in a variety of ratios
+    auto ratios = group->param("ratio", "Ratios N for the fsqrt:op and load:op 1:N tests", string_format("0..%d", MAX_RATIO - 1), 0, MAX_RATIO - 1);
+    for (auto& rop : ratio_ops) {
+        for (auto n : ratios) {
+            makei(rop.fns[n], maker, string_format("%s-%s-%d", rop.prefix, rop.op, (int)n),
+                    string_format("%s:%s in 1:%d ratio", rop.prefix, rop.op, (int)n), 32);
+        }
+    }
+
+    // counts beyond the pre-assembled kernels use an equivalent kernel generated at runtime
+    bench2_f* const loadchain_fns[] = FN_ARRAY(rs_loadchain, MAX_LOADCHAIN);
+    for (auto n : group->param("loadchain", "Number of loads for the loadchain tests", string_format("0..%d", MAX_LOADCHAIN - 1), 0, MAX_JIT_LOADCHAIN)) {
+        makei(n < MAX_LOADCHAIN ? loadchain_fns[n] : jit_loadchain(n), maker,
+                string_format("loadchain-%d", (int)n), string_format("loadchain: %d loads", (int)n), 32);
+    }
+
+    bench2_f* const storebuf_fns[] = FN_ARRAY(rs_storebuf, MAX_STOREBUF);
+    for (auto n : group->param("storebuf", "Number of stores for the storebuf tests", string_format("0..%d", MAX_STOREBUF - 1), 0, MAX_JIT_STOREBUF)) {
+        makei(n < MAX_STOREBUF ? storebuf_fns[n] : jit_storebuf(n), maker,
+                string_format("storebuf-%d", (int)n), string_format("storebuf: %d stores", (int)n), 32);
+    }
 
 #endif // #if !UARCH_BENCH_PORTABLE
 
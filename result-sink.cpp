@@ -0,0 +1,251 @@
+/*
+ * result-sink.cpp
+ */
+
+#include "result-sink.hpp"
+#include "benchmark.hpp"
+#include "context.hpp"
+#include "derived-metrics.hpp"
+#include "stats.hpp"
+#include "util.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+using namespace std;
+
+/* enough digits that no precision is lost for any reasonable metric */
+static std::string format_value(double v) {
+    return string_format("%.10g", v);
+}
+
+/**
+ * The original human-readable output: a header per group and aligned columns.
+ */
+class TextSink : public ResultSink {
+public:
+    virtual bool isText() const override { return true; }
+
+    virtual void groupStart(Context& c, BenchmarkGroup& group) override {
+        c.out() << std::endl << "** Running group " << group.getId() << " : " << group.getDescription() << " **" << std::endl;
+        group.printGroupHeader(c);
+    }
+
+    virtual void groupEnd(Context& c, BenchmarkGroup& group, int64_t elapsed_ms) override {
+        c.out() << "Finished in " << elapsed_ms << " ms (" << group.getId() << ")" << endl;
+    }
+
+    virtual void result(Context& c, const ResultRecord& record) override {
+        printBenchName(c, record.name);
+        for (auto& column : record.columns) {
+            printOneMetric(c, column.second);
+        }
+        printAlignedMetrics(c, record.values);
+        c.out() << endl;
+    }
+
+    virtual void histogram(Context& c, const BenchmarkBase& bench, const std::string& metric, const Stats::Histogram& histogram) override {
+        constexpr size_t BAR_WIDTH = 50;
+        printBenchName(c, metric + " histogram");
+        c.out() << endl;
+        size_t max_count = *std::max_element(histogram.counts.begin(), histogram.counts.end());
+        int precision = c.getPrecision();
+        for (size_t i = 0; i < histogram.counts.size(); i++) {
+            size_t count = histogram.counts[i];
+            c.out() << string_format("%*s[%10.*f, %10.*f) %5zu ", DESC_WIDTH - 24, "",
+                    precision, histogram.bound(i), precision, histogram.bound(i + 1), count)
+                    << std::string(max_count ? count * BAR_WIDTH / max_count : 0, '#') << endl;
+        }
+    }
+
+    virtual void skipped(Context& c, const BenchmarkBase& bench, const std::string& reason) override {
+        printBenchName(c, bench.getDescription());
+        printOneMetric(c, std::string("Skipped because ") + reason);
+        c.out() << endl;
+    }
+};
+
+/**
+ * Common parent for the structured formats, which only write result records to Context::out(), and
+ * send the group progress messages to the log instead.
+ */
+class StructuredSink : public ResultSink {
+public:
+    virtual void groupEnd(Context& c, BenchmarkGroup& group, int64_t elapsed_ms) override {
+        c.log() << "Finished in " << elapsed_ms << " ms (" << group.getId() << ")" << endl;
+    }
+
+protected:
+    static attr_list all_attrs(const ResultRecord& record) {
+        attr_list all(record.columns);
+        all.insert(all.end(), record.attrs.begin(), record.attrs.end());
+        if (record.name != record.bench->getDescription()) {
+            all.emplace_back("name", record.name);
+        }
+        return all;
+    }
+};
+
+/**
+ * Writes one JSON object per result, one per line, like:
+ *
+ * {"group":"basic","id":"dep-add","path":"basic/dep-add","description":"Dependent add chain","tags":["default"],
+ *  "loop_count":10000,"ops_per_loop":128,"attrs":{},"metrics":{"Cycles":1.00,"Nanos":0.31}}
+ */
+class JsonSink : public StructuredSink {
+    void start(Context& c, const BenchmarkBase& b, const attr_list& attrs) {
+        std::ostream& os = c.out();
+        os << "{\"group\":" << json_quote(b.getGroup().getId())
+           << ",\"id\":" << json_quote(b.getId())
+           << ",\"path\":" << json_quote(b.getPath())
+           << ",\"description\":" << json_quote(b.getDescription())
+           << ",\"tags\":[";
+        auto tags = b.getTags();
+        for (size_t i = 0; i < tags.size(); i++) {
+            os << (i ? "," : "") << json_quote(tags[i]);
+        }
+        os << "],\"loop_count\":" << b.getLoopCount()
+           << ",\"ops_per_loop\":" << b.getOpsPerLoop()
+           << ",\"attrs\":{";
+        for (size_t i = 0; i < attrs.size(); i++) {
+            os << (i ? "," : "") << json_quote(attrs[i].first) << ":" << json_value(attrs[i].second);
+        }
+        os << "}";
+    }
+
+public:
+    virtual void result(Context& c, const ResultRecord& record) override {
+        start(c, *record.bench, all_attrs(record));
+        auto& names = c.getTimerInfo().getMetricNames();
+        assert(names.size() == record.values.size());
+        c.out() << ",\"metrics\":{";
+        for (size_t i = 0; i < names.size(); i++) {
+            double v = record.values[i];
+            c.out() << (i ? "," : "") << json_quote(names[i]) << ":" << (std::isfinite(v) ? format_value(v) : "null");
+        }
+        c.out() << "}}" << endl;
+    }
+
+    virtual void histogram(Context& c, const BenchmarkBase& bench, const std::string& metric, const Stats::Histogram& histogram) override {
+        start(c, bench, {});
+        c.out() << ",\"histogram\":{\"metric\":" << json_quote(metric) << ",\"bounds\":[";
+        for (size_t i = 0; i <= histogram.counts.size(); i++) {
+            c.out() << (i ? "," : "") << format_value(histogram.bound(i));
+        }
+        c.out() << "],\"counts\":[";
+        for (size_t i = 0; i < histogram.counts.size(); i++) {
+            c.out() << (i ? "," : "") << histogram.counts[i];
+        }
+        c.out() << "]}}" << endl;
+    }
+
+    virtual void skipped(Context& c, const BenchmarkBase& bench, const std::string& reason) override {
+        start(c, bench, {});
+        c.out() << ",\"skipped\":" << json_quote(reason) << "}" << endl;
+    }
+};
+
+/**
+ * Writes CSV in "long" form, one row per metric, so that the columns don't depend on the timer or
+ * benchmark. Tags are separated by ';' and attributes are written as 'key=value' pairs separated by ';'.
+ * Every field is quoted as needed and rows end in CRLF, per RFC 4180.
+ */
+class CsvSink : public StructuredSink {
+    bool header_done = false;
+
+    static void write_row(std::ostream& os, const std::vector<std::string>& fields) {
+        for (size_t i = 0; i < fields.size(); i++) {
+            os << (i ? "," : "") << csv_quote(fields[i]);
+        }
+        os << "\r\n";
+    }
+
+    void row(Context& c, const BenchmarkBase& b, const attr_list& attrs, const std::string& metric, const std::string& value) {
+        std::ostream& os = c.out();
+        if (!header_done) {
+            write_row(os, {"group", "id", "path", "description", "tags", "loop_count", "ops_per_loop", "attrs", "metric", "value"});
+            header_done = true;
+        }
+        std::string tags, attr_str;
+        for (auto& t : b.getTags()) {
+            tags += (tags.empty() ? "" : ";") + t;
+        }
+        for (auto& a : attrs) {
+            attr_str += (attr_str.empty() ? "" : ";") + a.first + "=" + a.second;
+        }
+        write_row(os, {b.getGroup().getId(), b.getId(), b.getPath(), b.getDescription(), tags,
+                std::to_string(b.getLoopCount()), std::to_string(b.getOpsPerLoop()), attr_str, metric, value});
+        os.flush();
+    }
+
+public:
+    virtual void result(Context& c, const ResultRecord& record) override {
+        auto& names = c.getTimerInfo().getMetricNames();
+        assert(names.size() == record.values.size());
+        attr_list attrs = all_attrs(record);
+        for (size_t i = 0; i < names.size(); i++) {
+            double v = record.values[i];
+            row(c, *record.bench, attrs, names[i], std::isfinite(v) ? format_value(v) : "");
+        }
+    }
+
+    /* one row per bucket, with the bucket bounds as attributes and the count as the value */
+    virtual void histogram(Context& c, const BenchmarkBase& bench, const std::string& metric, const Stats::Histogram& histogram) override {
+        for (size_t i = 0; i < histogram.counts.size(); i++) {
+            row(c, bench, {{"stat", "histogram"}, {"lo", format_value(histogram.bound(i))}, {"hi", format_value(histogram.bound(i + 1))}},
+                    metric, std::to_string(histogram.counts[i]));
+        }
+    }
+
+    virtual void skipped(Context& c, const BenchmarkBase& bench, const std::string& reason) override {
+        row(c, bench, {{"skipped", reason}}, "", "");
+    }
+};
+
+std::unique_ptr<ResultSink> ResultSink::make(const std::string& format) {
+    if (format == "text") {
+        return std::unique_ptr<ResultSink>(new TextSink());
+    } else if (format == "json") {
+        return std::unique_ptr<ResultSink>(new JsonSink());
+    } else if (format == "csv") {
+        return std::unique_ptr<ResultSink>(new CsvSink());
+    }
+    throw std::runtime_error("unknown output format '" + format + "', should be one of text, json or csv");
+}
+
+void DerivedMetricSink::result(Context& c, const ResultRecord& record) {
+    if (record.values.size() == c.getTimerInfo().getMetricNames().size()) {
+        inner_->result(c, record);
+        return;
+    }
+    ResultRecord with_derived(record);
+    append_derived_metrics(c.getTimerInfo(), with_derived.values);
+    inner_->result(c, with_derived);
+}
+
+void run_with_summary(Context& c, BenchmarkGroup& group, const std::function<void ()>& body,
+        const std::function<void (const std::vector<ResultRecord>& results)>& summary) {
+    SummarySink* summary_sink = new SummarySink;
+    std::ostream* out = &c.out();
+    std::vector<int> home_cpus = get_allowed_cpus();
+    auto restore = [&]{
+        if (home_cpus.size() == 1) {
+            pin_to_cpu(home_cpus.front());
+        }
+        return c.redirect(out, std::move(summary_sink->inner));
+    };
+    summary_sink->inner = c.redirect(out, std::unique_ptr<ResultSink>(summary_sink));
+    try {
+        body();
+    } catch (...) {
+        restore();
+        throw;
+    }
+    // keeps the summary sink alive until we are done with its results
+    auto owned = restore();
+    if (summary_sink->started) {
+        summary(summary_sink->results);
+        c.getSink().groupEnd(c, group, summary_sink->elapsed_ms);
+    }
+}
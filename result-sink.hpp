@@ -0,0 +1,150 @@
+/*
+ * result-sink.hpp
+ *
+ * Benchmark results are reported to the ResultSink owned by the Context, which decides how they are written:
+ * as the usual aligned text tables, or in a structured format (JSON lines or CSV) that is easy to consume
+ * from scripts. The format is chosen with --output-format.
+ */
+
+#ifndef RESULT_SINK_HPP_
+#define RESULT_SINK_HPP_
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+class Context;
+class BenchmarkBase;
+class BenchmarkGroup;
+namespace Stats { struct Histogram; }
+
+using attr_list = std::vector<std::pair<std::string, std::string>>;
+
+/**
+ * One row of results, produced by a benchmark.
+ */
+struct ResultRecord {
+    /* the benchmark which produced this result */
+    const BenchmarkBase* bench;
+    /* the name shown in the first column of the text output, usually the benchmark description */
+    std::string name;
+    /* extra attributes which the text format also shows as columns before the metrics, e.g., the oneshot sample number */
+    attr_list columns;
+    /* extra attributes which appear only in the structured formats, e.g., the thread and cpu for threaded benchmarks */
+    attr_list attrs;
+    /* the metric values, in the same order as TimerInfo::getMetricNames() */
+    std::vector<double> values;
+    /* the relative noise in the first metric (see relative_noise()), or 0 if unknown */
+    double noise;
+};
+
+class ResultSink {
+public:
+    virtual ~ResultSink() = default;
+
+    /* true for the human-readable text format, which lets benchmarks with their own text layout use it */
+    virtual bool isText() const { return false; }
+
+    /* called before the first benchmark in a group which is selected to run */
+    virtual void groupStart(Context& c, BenchmarkGroup& group) {}
+
+    /* called after the last benchmark in a group has run, if any ran */
+    virtual void groupEnd(Context& c, BenchmarkGroup& group, int64_t elapsed_ms) {}
+
+    virtual void result(Context& c, const ResultRecord& record) = 0;
+
+    /* a histogram of the samples for the given metric, reported after the results for the benchmark */
+    virtual void histogram(Context& c, const BenchmarkBase& bench, const std::string& metric, const Stats::Histogram& histogram) = 0;
+
+    /* called once after all benchmarks have run */
+    virtual void finish(Context& c) {}
+
+    /* the benchmark couldn't be run, e.g., because the hardware doesn't support it */
+    virtual void skipped(Context& c, const BenchmarkBase& bench, const std::string& reason) = 0;
+
+    /* create the sink for the given --output-format name, throws std::runtime_error for unknown formats */
+    static std::unique_ptr<ResultSink> make(const std::string& format);
+};
+
+/**
+ * A sink which appends the values of the timer's derived metrics (see TimerInfo::getDerivedMetrics) to every
+ * result, and passes everything through to another sink. Results which already have a value for every metric
+ * (e.g., the --stats=full rows, see distribution) are passed through as they are.
+ */
+class DerivedMetricSink : public ResultSink {
+    std::unique_ptr<ResultSink> inner_;
+
+public:
+    DerivedMetricSink(std::unique_ptr<ResultSink> inner) : inner_{std::move(inner)} {}
+
+    virtual bool isText() const override { return inner_->isText(); }
+
+    virtual void groupStart(Context& c, BenchmarkGroup& group) override { inner_->groupStart(c, group); }
+
+    virtual void groupEnd(Context& c, BenchmarkGroup& group, int64_t elapsed_ms) override {
+        inner_->groupEnd(c, group, elapsed_ms);
+    }
+
+    virtual void result(Context& c, const ResultRecord& record) override;
+
+    virtual void histogram(Context& c, const BenchmarkBase& bench, const std::string& metric, const Stats::Histogram& histogram) override {
+        inner_->histogram(c, bench, metric, histogram);
+    }
+
+    virtual void finish(Context& c) override { inner_->finish(c); }
+
+    virtual void skipped(Context& c, const BenchmarkBase& bench, const std::string& reason) override {
+        inner_->skipped(c, bench, reason);
+    }
+};
+
+/**
+ * A sink which passes everything through to another sink while keeping a copy of the results, for groups
+ * which print a summary of their results, and holds back the end of the group so that the summary can come
+ * before it.
+ */
+class SummarySink : public ResultSink {
+public:
+    std::unique_ptr<ResultSink> inner;
+    std::vector<ResultRecord> results;
+    bool started = false;
+    int64_t elapsed_ms = 0;
+
+    virtual bool isText() const override { return inner->isText(); }
+
+    virtual void groupStart(Context& c, BenchmarkGroup& group) override {
+        started = true;
+        inner->groupStart(c, group);
+    }
+
+    virtual void groupEnd(Context& c, BenchmarkGroup& group, int64_t elapsed_ms) override {
+        this->elapsed_ms = elapsed_ms;
+    }
+
+    virtual void result(Context& c, const ResultRecord& record) override {
+        results.push_back(record);
+        inner->result(c, record);
+    }
+
+    virtual void histogram(Context& c, const BenchmarkBase& bench, const std::string& metric, const Stats::Histogram& histogram) override {
+        inner->histogram(c, bench, metric, histogram);
+    }
+
+    virtual void finish(Context& c) override { inner->finish(c); }
+
+    virtual void skipped(Context& c, const BenchmarkBase& bench, const std::string& reason) override {
+        inner->skipped(c, bench, reason);
+    }
+};
+
+/**
+ * Run body, which runs the benchmarks of group, with the results going through a SummarySink, then if the group
+ * was started, call summary with its results and end the group, so the summary comes before the end. The calling
+ * thread is pinned back to its CPU afterwards (if it was pinned to one), since these groups often move it.
+ */
+void run_with_summary(Context& c, BenchmarkGroup& group, const std::function<void ()>& body,
+        const std::function<void (const std::vector<ResultRecord>& results)>& summary);
+
+#endif /* RESULT_SINK_HPP_ */
@@ -11,6 +11,8 @@
 #include <iomanip>
 #include <sstream>
 #include <algorithm>
+#include <cassert>
+#include <cmath>
 #include <limits>
 #include <iterator>
 #include <functional>
@@ -117,6 +119,61 @@ DescriptiveStats get_stats(iter_type first, iter_type last) {
 
 
 
+/**
+ * Return the p-th percentile (0 <= p <= 100) of an already sorted, non-empty vector, interpolating
+ * linearly between the two closest ranks.
+ */
+inline double percentile_sorted(const std::vector<double>& sorted, double p) {
+    assert(!sorted.empty() && p >= 0 && p <= 100);
+    double rank = p / 100 * (sorted.size() - 1);
+    size_t lo = (size_t)rank, hi = std::min(lo + 1, sorted.size() - 1);
+    return sorted[lo] + (rank - lo) * (sorted[hi] - sorted[lo]);
+}
+
+/* the sample standard deviation of the given values, or 0 if there are fewer than two values */
+template <typename iter_type>
+double stddev(iter_type first, iter_type last) {
+    double count = 0, total = 0, total_sq = 0;
+    for (iter_type itr = first; itr != last; itr++) {
+        double vald = *itr;
+        count++;
+        total += vald;
+    }
+    if (count < 2) {
+        return 0;
+    }
+    double mean = total / count;
+    for (iter_type itr = first; itr != last; itr++) {
+        double diff = *itr - mean;
+        total_sq += diff * diff;
+    }
+    return std::sqrt(total_sq / (count - 1));
+}
+
+/**
+ * A histogram with equal-width buckets spanning the min and max of the values it was built from.
+ */
+struct Histogram {
+    double lo, width;
+    std::vector<size_t> counts;
+
+    /* the lower bound of bucket i, and the upper bound of bucket i - 1 */
+    double bound(size_t i) const { return lo + i * width; }
+};
+
+template <typename iter_type>
+Histogram make_histogram(iter_type first, iter_type last, size_t buckets) {
+    assert(first != last && buckets > 0);
+    auto minmax = std::minmax_element(first, last);
+    double lo = *minmax.first, hi = *minmax.second;
+    Histogram h{lo, (hi - lo) / buckets, std::vector<size_t>(buckets)};
+    for (iter_type itr = first; itr != last; itr++) {
+        size_t i = h.width > 0 ? (size_t)((*itr - lo) / h.width) : 0;
+        h.counts[std::min(i, buckets - 1)]++;  // the max value lands in the last bucket
+    }
+    return h;
+}
+
 inline std::ostream& operator<<(std::ostream &os, const DescriptiveStats &stats) {
 	os << "min=" << stats.getMin() << ", median=" << stats.getMedian() << ", avg=" << stats.getAvg()
 			<< ", max=" << stats.getMax() << ", n=" << stats.getCount();
@@ -8,11 +8,24 @@
 #include "../matchers.hpp"
 #include "../simple-timer.hpp"
 #include "../perf-timer.hpp"
+#include "../stats.hpp"
+#include "../params.hpp"
+#include "../jit.hpp"
+#include "../derived-metrics.hpp"
+#include "../cache-levels.hpp"
+#include "../benchmark.hpp"
+#include "../timers.hpp"
+#include "../context.hpp"
+#include "../baseline.hpp"
 
 #include "catch.hpp"
 
+#include <cstdio>
+#include <sstream>
 #include <thread>
 
+#include <unistd.h>
+
 
 TEST_CASE( "string_format", "[util]" ) {
     REQUIRE( string_format("foo") == "foo" );
@@ -92,6 +105,324 @@ TEST_CASE( "split_on_any", "[util]") {
     CHECK(split_on_any("xxayyybzzzz", "ab") == sv{"xx", "yyy", "zzzz"});
 }
 
+TEST_CASE( "json_quote", "[util]") {
+    CHECK(json_quote("")            == "\"\"");
+    CHECK(json_quote("foo bar")     == "\"foo bar\"");
+    CHECK(json_quote("a\"b")        == "\"a\\\"b\"");
+    CHECK(json_quote("a\\b")        == "\"a\\\\b\"");
+    CHECK(json_quote("a\nb\tc")     == "\"a\\nb\\tc\"");
+    CHECK(json_quote(std::string("\x01")) == "\"\\u0001\"");
+}
+
+TEST_CASE( "json_value", "[util]") {
+    CHECK(json_value("4")       == "4");
+    CHECK(json_value("-0.5e+3") == "-0.5e+3");
+    CHECK(json_value("0")       == "0");
+    CHECK(json_value("")        == "\"\"");
+    CHECK(json_value("012")     == "\"012\"");
+    CHECK(json_value("1.")      == "\"1.\"");
+    CHECK(json_value("-")       == "\"-\"");
+    CHECK(json_value("nan")     == "\"nan\"");
+    CHECK(json_value("min")     == "\"min\"");
+}
+
+TEST_CASE( "csv_quote", "[util]") {
+    CHECK(csv_quote("")           == "");
+    CHECK(csv_quote("foo bar")    == "foo bar");
+    CHECK(csv_quote("a,b")        == "\"a,b\"");
+    CHECK(csv_quote("say \"hi\"") == "\"say \"\"hi\"\"\"");
+    CHECK(csv_quote("a\nb")       == "\"a\nb\"");
+}
+
+TEST_CASE( "parse_cpu_list", "[util]") {
+    using iv = std::vector<int>;
+
+    CHECK(parse_cpu_list("0")          == iv{0});
+    CHECK(parse_cpu_list("0,2,4")      == iv{0, 2, 4});
+    CHECK(parse_cpu_list("0-3")        == iv{0, 1, 2, 3});
+    CHECK(parse_cpu_list("8,0-2,5-5")  == iv{8, 0, 1, 2, 5});
+
+    CHECK_THROWS_AS(parse_cpu_list(""),      std::runtime_error);
+    CHECK_THROWS_AS(parse_cpu_list("a"),     std::runtime_error);
+    CHECK_THROWS_AS(parse_cpu_list("1,,2"),  std::runtime_error);
+    CHECK_THROWS_AS(parse_cpu_list("3-1"),   std::runtime_error);
+    CHECK_THROWS_AS(parse_cpu_list("1-2-3"), std::runtime_error);
+    CHECK_THROWS_AS(parse_cpu_list("-1"),    std::runtime_error);
+}
+
+TEST_CASE( "distribution_stats", "[stats]") {
+    using namespace Stats;
+    std::vector<double> v{1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+    CHECK(percentile_sorted(v, 0)   == 1);
+    CHECK(percentile_sorted(v, 10)  == 2);
+    CHECK(percentile_sorted(v, 50)  == 6);
+    CHECK(percentile_sorted(v, 100) == 11);
+    CHECK(percentile_sorted({1, 2}, 50) == 1.5);
+    CHECK(percentile_sorted({7}, 90) == 7);
+
+    CHECK(stddev(v.begin(), v.begin() + 1) == 0);
+    CHECK(stddev(v.begin(), v.begin() + 3) == Approx(1.0));
+
+    Histogram h = make_histogram(v.begin(), v.end(), 5);
+    CHECK(h.lo == 1);
+    CHECK(h.width == 2);
+    CHECK(h.bound(5) == 11);
+    CHECK(h.counts == std::vector<size_t>{2, 2, 2, 2, 3});
+
+    std::vector<double> same{3, 3};
+    CHECK(make_histogram(same.begin(), same.end(), 2).counts == std::vector<size_t>{2, 0});
+}
+
+TEST_CASE( "parse_param_spec", "[params]") {
+    using pv = param_values;
+    CHECK(parse_param_spec("5") == pv{5});
+    CHECK(parse_param_spec("1,3,-2") == pv{1, 3, -2});
+    CHECK(parse_param_spec("1..4") == pv{1, 2, 3, 4});
+    CHECK(parse_param_spec("0..10:+4") == pv{0, 4, 8});
+    CHECK(parse_param_spec("16..100:x2") == pv{16, 32, 64});
+    CHECK(parse_param_spec("1,8..64:x4,100") == pv{1, 8, 32, 100});
+    CHECK(parse_param_spec("4..4:x2") == pv{4});
+    CHECK(to_param_spec({1, 2, 30}) == "1,2,30");
+
+    CHECK_THROWS(parse_param_spec(""));
+    CHECK_THROWS(parse_param_spec("1,,2"));
+    CHECK_THROWS(parse_param_spec("abc"));
+    CHECK_THROWS(parse_param_spec("4..1"));
+    CHECK_THROWS(parse_param_spec("1..4:x1"));
+    CHECK_THROWS(parse_param_spec("0..4:x2"));
+    CHECK_THROWS(parse_param_spec("1..4:+0"));
+    CHECK_THROWS(parse_param_spec("1..4:-1"));
+}
+
+TEST_CASE( "metric_expr", "[derived]") {
+    std::vector<std::string> names{"Cycles", "INST_RETIRED.ANY", "L1D.REPLACEMENT"};
+    auto lookup = [&](const std::string& name) -> size_t {
+        auto i = std::find(names.begin(), names.end(), name);
+        if (i == names.end()) {
+            throw std::runtime_error("unknown " + name);
+        }
+        return i - names.begin();
+    };
+    std::vector<double> values{4, 8, 2};
+    CHECK(MetricExpr("INST_RETIRED.ANY/Cycles", lookup).eval(values) == 2);
+    CHECK(MetricExpr("1000*L1D.REPLACEMENT/INST_RETIRED.ANY", lookup).eval(values) == 250);
+    CHECK(MetricExpr("1 + 2 * 3", lookup).eval(values) == 7);
+    CHECK(MetricExpr("(1 + 2) * 3", lookup).eval(values) == 9);
+    CHECK(MetricExpr("8 / 4 / 2", lookup).eval(values) == 1);
+    CHECK(MetricExpr("-Cycles - -1", lookup).eval(values) == -3);
+    CHECK(MetricExpr("1.5e1", lookup).eval(values) == 15);
+
+    CHECK_THROWS(MetricExpr("", lookup));
+    CHECK_THROWS(MetricExpr("1 +", lookup));
+    CHECK_THROWS(MetricExpr("(1", lookup));
+    CHECK_THROWS(MetricExpr("1 2", lookup));
+    CHECK_THROWS(MetricExpr("Nanos", lookup));
+}
+
+TEST_CASE( "extract_derived_metrics", "[derived]") {
+    using sv = std::vector<std::string>;
+    std::string events = "INST_RETIRED.ANY,IPC=INST_RETIRED.ANY/Cycles,cpu/event=0x3c,umask=0/,X=1/2";
+    CHECK(extract_derived_metrics(events) == sv{"IPC=INST_RETIRED.ANY/Cycles", "X=1/2"});
+    CHECK(events == "INST_RETIRED.ANY,cpu/event=0x3c,umask=0/");
+
+    events = "INST_RETIRED:ANY_P:c=1";
+    CHECK(extract_derived_metrics(events).empty());
+    CHECK(events == "INST_RETIRED:ANY_P:c=1");
+}
+
+/* a timer with events, like the perf timer, whose results only have values for the metrics it measures */
+class EventTimer : public TimerInfo {
+public:
+    EventTimer() : TimerInfo("events", "events", {"Cycles", "INST_RETIRED.ANY"}) {}
+    virtual void init(Context&) override {}
+    virtual void listEvents(Context&) override {}
+};
+
+TEST_CASE( "append_derived_metrics", "[derived]") {
+    EventTimer timer;
+    add_derived_metrics(timer, {"IPC=INST_RETIRED.ANY/Cycles", "CPI=1/IPC"});
+    REQUIRE(timer.getMetricNames().size() == 4);
+    REQUIRE(timer.measuredMetricCount() == 2);
+    // sized as in PerfTimer::to_result
+    std::vector<double> values(timer.measuredMetricCount());
+    values[0] = 4;
+    values[1] = 8;
+    append_derived_metrics(timer, values);
+    REQUIRE(values.size() == timer.getMetricNames().size());
+    CHECK(values[2] == 2);
+    CHECK(values[3] == 0.5);
+
+    // e.g., values which already include the derived metrics
+    CHECK_THROWS_AS(append_derived_metrics(timer, values), std::logic_error);
+}
+
+TEST_CASE( "parallel_groups_derived_metrics", "[parallel]") {
+    // skip calibration, and let the worker's results be replayed with a derived metric set
+    setenv("UARCH_BENCH_CLOCK_MHZ", "4500", 1);
+    std::string cpus = "--parallel-groups=" + std::to_string(get_allowed_cpus().front());
+    const char* argv[] = {"uarch-bench", "--output-format=json", cpus.c_str(), "--extra-events=GHZ=Cycles/Nanos",
+            "--test-name=cpp/div64_64-lat"};
+    std::ostringstream out;
+    Context context(sizeof(argv) / sizeof(argv[0]), const_cast<char**>(argv), &out);
+    REQUIRE_NOTHROW(context.run());
+    CHECK(out.str().find("\"path\":\"cpp/div64_64-lat\"") != std::string::npos);
+    CHECK(out.str().find("\"GHZ\":") != std::string::npos);
+}
+
+TEST_CASE( "distribution_derived_metrics", "[derived]") {
+    EventTimer timer;
+    add_derived_metrics(timer, {"IPC=INST_RETIRED.ANY/Cycles"});
+    // Cycles, INST_RETIRED.ANY
+    std::vector<TimingResult> samples{TimingResult({1, 3}), TimingResult({2, 2}), TimingResult({4, 1})};
+    auto stats = distribution(timer, samples);
+    REQUIRE(stats.size() == 6);
+    auto& min = stats[0].second.getResults();
+    auto& max = stats[4].second.getResults();
+    REQUIRE(min.size() == 3);
+    // the derived metric is computed per sample, rather than from the statistics of the other metrics
+    CHECK(min[2] == 0.25);
+    CHECK(max[2] == 3);
+}
+
+TEST_CASE( "delta_maker_setters", "[benchmark]") {
+    using calibrated_t = DeltaMaker<DefaultClockTimer, false, true>;
+    auto maker = DeltaMaker<DefaultClockTimer>(nullptr, 100).useCalibratedOverhead()
+            .setTags({"slow"}).setLoopCount(200).setFeatures({AVX2});
+    // the setters keep the algorithm chosen before them
+    CHECK((std::is_same<decltype(maker), calibrated_t>::value));
+    CHECK(maker.getLoopCount() == 200);
+    CHECK((maker.getFeatures() == featurelist_t{AVX2}));
+    CHECK((std::is_same<decltype(maker.useLoopDelta().setLoopCount(1)), DeltaMaker<DefaultClockTimer, true>>::value));
+}
+
+TEST_CASE( "baseline_key", "[baseline]") {
+    BenchmarkGroup group("grp", "a group");
+    std::unique_ptr<BenchmarkBase> bench(DeltaMaker<DefaultClockTimer>(&group).make_only<dummy_bench>("id", "a bench", 1));
+    CHECK(baseline_key(ResultRecord{bench.get(), "a bench", {}, {}, {1.0}}) == "grp/id");
+    CHECK(baseline_key(ResultRecord{bench.get(), "a bench", {{"sample", "2"}, {"samples", "35"}}, {}, {1.0}}) == "grp/id:2");
+    // --stats=full and per-thread rows aren't saved
+    CHECK(baseline_key(ResultRecord{bench.get(), "p50", {}, {{"stat", "p50"}}, {1.0}}) == "");
+    CHECK(baseline_key(ResultRecord{bench.get(), "thread 1 (cpu 3)", {}, {{"thread", "1"}}, {1.0}}) == "");
+    // but combined threaded rows are, by thread count
+    CHECK(baseline_key(ResultRecord{bench.get(), "a bench", {}, {{"threads", "4"}}, {1.0}}) == "grp/id:threads=4");
+    CHECK(baseline_key(ResultRecord{bench.get(), "a bench, 2 threads", {}, {{"threads", "2"}}, {1.0}}) == "grp/id:threads=2");
+}
+
+TEST_CASE( "baseline_save_load", "[baseline]") {
+    char filename[] = "/tmp/uarch-bench-baseline-XXXXXX";
+    int fd = mkstemp(filename);
+    REQUIRE(fd >= 0);
+    close(fd);
+
+    Baseline saved;
+    saved.machine = {{"cpu", "Some CPU @ 3.00GHz"}, {"timer", "clock"}};
+    saved.results["grp/id"] = Baseline::Entry{12.5, 0.02};
+    saved.results["grp/id:threads=4"] = Baseline::Entry{0.123456789, 0};
+    saved.save(filename);
+
+    Baseline loaded = Baseline::load(filename);
+    std::remove(filename);
+    CHECK(loaded.machineValue("cpu") == "Some CPU @ 3.00GHz");
+    CHECK(loaded.machineValue("timer") == "clock");
+    CHECK(loaded.machineValue("kernel") == "");
+    REQUIRE(loaded.results.size() == 2);
+    CHECK(loaded.results["grp/id"].value == 12.5);
+    CHECK(loaded.results["grp/id"].noise == Approx(0.02));
+    CHECK(loaded.results["grp/id:threads=4"].value == Approx(0.123456789));
+
+    CHECK_THROWS_AS(Baseline::load("/nonexistent/baseline"), std::runtime_error);
+}
+
+TEST_CASE( "baseline_comparison", "[baseline]") {
+    // quiet runs use the minimum threshold
+    BaselineComparison quiet({100, 0}, {100.5, 0.001});
+    CHECK(quiet.threshold == BaselineComparison::MIN_THRESHOLD);
+    CHECK(quiet.change == Approx(0.005));
+    CHECK(!quiet.slower());
+    CHECK(!quiet.faster());
+
+    CHECK(BaselineComparison({100, 0}, {102, 0}).slower());
+    CHECK(BaselineComparison({100, 0}, {98, 0}).faster());
+
+    // otherwise the noisier of the two runs sets the threshold
+    BaselineComparison noisy({100, 0.05}, {104, 0.02});
+    CHECK(noisy.threshold == 0.05);
+    CHECK(!noisy.slower());
+    CHECK(BaselineComparison({100, 0.02}, {90, 0.05}).faster());
+}
+
+#if !UARCH_BENCH_PORTABLE
+
+TEST_CASE( "jit_loop", "[jit]") {
+    using namespace jit;
+    const code_bytes xor_eax = {0x31, 0xC0}, inc_rax = {0x48, 0xFF, 0xC0};
+
+    bench2_f* f = make_loop(xor_eax, inc_rax, 3, {});
+    REQUIRE( f(5, nullptr) == 15 );
+
+    // a body too big for the short jnz
+    f = make_loop(xor_eax, inc_rax, 100, {});
+    REQUIRE( f(7, nullptr) == 700 );
+}
+
+#endif
+
+TEST_CASE( "find_cache_levels", "[cache]") {
+    const size_t K = 1024, M = 1024 * 1024;
+    // 32K L1, 1M L2 (with a gradual transition), 16M L3 and memory whose latency creeps up
+    std::vector<SweepPoint> points{
+        {4 * K, 4.0}, {8 * K, 4.0}, {16 * K, 4.1}, {32 * K, 4.0}, {40 * K, 9.0}, {64 * K, 13.5}, {256 * K, 14.0},
+        {1 * M, 14.2}, {1100 * K, 17.0}, {1200 * K, 21.0}, {1300 * K, 26.0}, {1400 * K, 30.0}, {2 * M, 40.0},
+        {8 * M, 41.0}, {16 * M, 42.0}, {20 * M, 150.0}, {32 * M, 210.0}, {64 * M, 215.0}, {128 * M, 222.0},
+        {256 * M, 230.0}
+    };
+    auto levels = find_cache_levels(points);
+    REQUIRE( levels.size() == 4 );
+    REQUIRE( levels[0].capacity == 32 * K );
+    REQUIRE( levels[0].cycles == 4.0 );
+    REQUIRE( levels[1].first_bytes == 64 * K );
+    REQUIRE( levels[1].capacity == 1 * M );
+    REQUIRE( levels[1].cycles == 14.0 );
+    REQUIRE( levels[2].capacity == 16 * M );
+    REQUIRE( levels[2].cycles == 41.0 );
+    REQUIRE( levels[3].first_bytes == 32 * M );
+    REQUIRE( levels[3].capacity == 256 * M );
+
+    REQUIRE( find_cache_levels({}).empty() );
+    REQUIRE( find_cache_levels({{4 * K, 4.0}}).empty() );
+}
+
+TEST_CASE( "parse_cache_size", "[cache]") {
+    REQUIRE( parse_cache_size("32K") == 32 * 1024 );
+    REQUIRE( parse_cache_size("8M") == 8 * 1024 * 1024 );
+    REQUIRE( parse_cache_size("512") == 512 );
+    REQUIRE( parse_cache_size("") == 0 );
+    REQUIRE( parse_cache_size("32KB") == 0 );
+    REQUIRE( format_cache_size(48 * 1024) == "48 KiB" );
+    REQUIRE( format_cache_size(1280 * 1024) == "1.25 MiB" );
+}
+
+TEST_CASE( "wildcard-matcher", "[matchers]" ) {
+    CHECK( WildcardMatcher("foo")("foo") );
+    CHECK( !WildcardMatcher("foo")("foox") );
+    CHECK( WildcardMatcher("foo*")("foo") );
+    CHECK( WildcardMatcher("foo*")("foo/bar") );
+    CHECK( !WildcardMatcher("foo*")("fo") );
+    CHECK( WildcardMatcher("*bar")("foo/bar") );
+    CHECK( !WildcardMatcher("*bar")("foo/barx") );
+    CHECK( WildcardMatcher("f*/*r")("foo/bar") );
+    CHECK( WildcardMatcher("*")("") );
+    CHECK( !WildcardMatcher("a*b*c")("abcb") );
+
+    // can a string starting with the given prefix match?
+    CHECK( WildcardMatcher("memory/load-*").matchesPrefix("memory/") );
+    CHECK( WildcardMatcher("memory/load-*").matchesPrefix("memory/load-parallel/") );
+    CHECK( !WildcardMatcher("memory/load-*").matchesPrefix("memory/store-parallel/") );
+    CHECK( WildcardMatcher("*/lat").matchesPrefix("cpp/") );
+    CHECK( WildcardMatcher("cpp/div").matchesPrefix("cpp/") );
+    CHECK( !WildcardMatcher("cpp/div").matchesPrefix("cpp/div/") );
+}
+
 TEST_CASE( "tag-matcher", "[matchers]" ) {
     {
         TagMatcher matcher("foo*");
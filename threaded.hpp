@@ -0,0 +1,453 @@
+/*
+ * threaded.hpp
+ *
+ * Multi-threaded delta benchmarks. The same benchmark method is run concurrently on one thread per CPU
+ * returned by Context::getThreadCpus(), with every thread pinned to its CPU. All threads are released
+ * together through a spin barrier before every sample, so the samples on different threads overlap
+ * as closely as possible. This lets us measure things that only show up when several cores are busy at
+ * once, such as shared cache and memory bandwidth scaling.
+ *
+ * Thread 0 is always the thread that called runAndPrint (temporarily re-pinned to the first CPU in the
+ * list), so its results are valid for every timer. The perf timer only programs its counters for that
+ * thread, so for the other threads only the clock timer gives meaningful per-thread results.
+ */
+
+#ifndef THREADED_HPP_
+#define THREADED_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+#include "benchmark.hpp"
+#include "isa-support.hpp"
+#include "result-sink.hpp"
+#include "simple-timer.hpp"
+
+/**
+ * A simple reusable sense-reversing barrier which spins rather than blocking, so that all waiting
+ * threads are released within a few hundred cycles of each other.
+ *
+ * If one of the threads fails, it calls abort() so that the others don't wait forever for it: every
+ * wait, current or future, then throws SpinBarrier::Aborted.
+ */
+class SpinBarrier {
+    const unsigned count_;
+    std::atomic<unsigned> waiting_;
+    std::atomic<unsigned> generation_;
+    std::atomic<bool> aborted_;
+
+public:
+    struct Aborted : std::runtime_error {
+        Aborted() : std::runtime_error("another thread aborted the barrier") {}
+    };
+
+    explicit SpinBarrier(unsigned count) : count_{count}, waiting_{0}, generation_{0}, aborted_{false} {}
+
+    void wait() {
+        if (aborted_.load(std::memory_order_acquire)) {
+            throw Aborted();
+        }
+        unsigned gen = generation_.load(std::memory_order_acquire);
+        if (waiting_.fetch_add(1, std::memory_order_acq_rel) + 1 == count_) {
+            // last one in releases everyone else
+            waiting_.store(0, std::memory_order_relaxed);
+            generation_.fetch_add(1, std::memory_order_release);
+        } else {
+            while (generation_.load(std::memory_order_acquire) == gen) {
+                if (aborted_.load(std::memory_order_relaxed)) {
+                    throw Aborted();
+                }
+#if !UARCH_BENCH_PORTABLE
+                __builtin_ia32_pause();
+#endif
+            }
+        }
+    }
+
+    /* release every waiting thread, and make all later waits throw Aborted */
+    void abort() {
+        aborted_.store(true, std::memory_order_release);
+    }
+};
+
+/**
+ * True if the timer measures whichever thread reads it, so the results of every thread are valid, rather than
+ * counters which are only programmed for the thread which initialized the timer (perf and libpfc).
+ */
+inline bool per_thread_timer(const TimerInfo& ti) {
+    return ti.getName() == "clock" || ti.getName() == "tsc";
+}
+
+/**
+ * Like time_some, but every thread waits on the barrier before each sample.
+ */
+template <typename TIMER, bench2_f METHOD>
+HEDLEY_NEVER_INLINE
+NO_STACK_PROTECTOR
+std::vector<typename TIMER::delta_t> time_some_barrier(size_t loop_count, void* arg, size_t samples, SpinBarrier& barrier) {
+    std::vector<typename TIMER::delta_t> result(samples);
+    for (size_t i = 0; i < samples; i++) {
+        barrier.wait();
+        auto t0 = TIMER::now();
+        METHOD(loop_count, arg);
+        auto t1 = TIMER::now();
+        result[i] = TIMER::delta(t1, t0);
+    }
+    return result;
+}
+
+/**
+ * The threaded equivalent of DeltaAlgo, sharing its raw result type and aggregation. Adaptive sampling
+ * isn't supported since every thread must take the same number of samples to keep the barriers in step,
+ * so this always takes DeltaAlgo::total_samples.
+ */
+template <typename TIMER>
+struct ThreadedDeltaAlgo {
+    using delta_algo = DeltaAlgo<TIMER>;
+    using raw_result = typename delta_algo::raw_result;
+    using raw_f      = raw_result (*)(size_t loop_count, void *arg, SpinBarrier& barrier);
+
+    static constexpr int total_samples = delta_algo::total_samples;
+
+    template <bench2_f BENCH_METHOD, bench2_f BASE_METHOD>
+    static raw_result delta_bench(size_t loop_count, void *arg, SpinBarrier& barrier) {
+        raw_result result;
+        result.base  = time_some_barrier<TIMER, BASE_METHOD> (loop_count, arg, total_samples, barrier);
+        result.bench = time_some_barrier<TIMER, BENCH_METHOD>(loop_count, arg, total_samples, barrier);
+        return result;
+    }
+};
+
+template <typename TIMER>
+class ThreadedBench : public BenchmarkBase {
+public:
+    using ALGO       = ThreadedDeltaAlgo<TIMER>;
+    using raw_result = typename ALGO::raw_result;
+    using raw_f      = typename ALGO::raw_f;
+
+private:
+    size_t loop_count;
+    raw_f  raw_func;
+    arg_provider_t arg_provider;
+
+public:
+
+    /**
+     * Set by ThreadScalingGroup around each of its runs, so that runAndPrint runs on the given CPUs and reports
+     * only the mean over the threads. Going through runAndPrint means the run gets the same event batching and
+     * frequency checks as any other benchmark.
+     */
+    struct ScalingRun {
+        std::vector<int> cpus;
+        /* called before every run, including the repeats for event batches or frequency reruns */
+        std::function<void()> before;
+        /* the combined result of the last run, see total */
+        std::vector<double> total;
+    };
+
+    ScalingRun* scaling = nullptr;
+
+    ThreadedBench(BenchArgs args, size_t loop_count, raw_f raw_func, arg_provider_t arg_provider) :
+        BenchmarkBase(std::move(args)), loop_count{loop_count}, raw_func{raw_func}, arg_provider{std::move(arg_provider)} {}
+
+    virtual TimingResult run(Context& c) override {
+        throw std::logic_error("threaded benchmarks need the thread CPUs from the Context, use runAndPrint");
+    }
+
+    /**
+     * Run the benchmark with one thread per given CPU, and return the normalized result for each thread.
+     */
+    std::vector<TimingResult> runThreads(const TimerInfo& ti, const std::vector<int>& cpus) {
+        assert(!cpus.empty());
+        size_t count = cpus.size();
+        SpinBarrier barrier(count);
+        std::vector<raw_result> raws(count);
+        // the arg providers generally aren't thread-safe (many return a shared static region), so
+        // args are created and freed one thread at a time, before the first barrier
+        std::mutex arg_lock;
+        // the exception thrown by each thread, if any, which is rethrown here once all threads are done
+        std::vector<std::exception_ptr> errors(count);
+
+        auto worker = [&](size_t t) {
+            void *arg = nullptr;
+            bool have_arg = false;
+            try {
+                pin_to_cpu(cpus[t]);
+                {
+                    std::lock_guard<std::mutex> guard(arg_lock);
+                    arg = arg_provider.make();
+                    have_arg = true;
+                }
+                raws[t] = raw_func(loop_count, arg, barrier);
+            } catch (const SpinBarrier::Aborted&) {
+                // another thread failed, and its exception is the one reported
+            } catch (...) {
+                errors[t] = std::current_exception();
+                barrier.abort();
+            }
+            if (have_arg) {
+                std::lock_guard<std::mutex> guard(arg_lock);
+                arg_provider.free(arg);
+            }
+        };
+
+        /* joins every started thread however we leave, since destroying a joinable std::thread terminates */
+        struct JoinGuard {
+            std::vector<std::thread>& threads;
+            ~JoinGuard() {
+                for (auto& thread : threads) {
+                    thread.join();
+                }
+            }
+        };
+
+        // thread 0 runs on this thread, which is normally pinned to --pinned-cpu, so we restore that afterwards
+        std::vector<int> original_cpus = get_allowed_cpus();
+        {
+            std::vector<std::thread> threads;
+            JoinGuard join{threads};
+            try {
+                for (size_t t = 1; t < count; t++) {
+                    threads.emplace_back(worker, t);
+                }
+            } catch (...) {
+                // the threads already started would otherwise wait at the first barrier forever
+                barrier.abort();
+                throw;
+            }
+            worker(0);
+        }
+        if (original_cpus.size() == 1) {
+            pin_to_cpu(original_cpus.front());
+        }
+        for (auto& error : errors) {
+            if (error) {
+                std::rethrow_exception(error);
+            }
+        }
+
+        std::vector<TimingResult> results;
+        for (auto& raw : raws) {
+            TimingResult result = TIMER::to_result(static_cast<const TIMER &>(ti), ALGO::delta_algo::aggregate(raw));
+            results.push_back(normalize(result, args, loop_count));
+        }
+        return results;
+    }
+
+    /**
+     * The combined result for all threads: the slowest thread divided by the number of threads, i.e.,
+     * the effective time per operation with all threads running. Counter timers only give valid results
+     * for thread 0, so for those it's thread 0 divided by the number of threads.
+     */
+    static TimingResult total(const TimerInfo& ti, const std::vector<TimingResult>& results) {
+        if (!per_thread_timer(ti)) {
+            return results.front() * (1.0 / results.size());
+        }
+        auto slowest = std::max_element(results.begin(), results.end(),
+                [](const TimingResult& l, const TimingResult& r){ return l.getCycles() < r.getCycles(); });
+        return *slowest * (1.0 / results.size());
+    }
+
+    /* the mean of each metric over the threads, or just thread 0's values if the timer only counts for it */
+    static std::vector<double> mean(const TimerInfo& ti, const std::vector<TimingResult>& results) {
+        if (!per_thread_timer(ti)) {
+            return results.front().getResults();
+        }
+        std::vector<double> mean(results.front().getResults().size());
+        for (auto& r : results) {
+            for (size_t i = 0; i < mean.size(); i++) {
+                mean[i] += r.getResults()[i] / results.size();
+            }
+        }
+        return mean;
+    }
+
+    virtual void runAndPrintInner(Context& c) override {
+        if (scaling) {
+            size_t n = scaling->cpus.size();
+            scaling->before();
+            std::vector<TimingResult> results = runThreads(c.getTimerInfo(), scaling->cpus);
+            ResultRecord record{this, string_format("%s, %zu thread%s", getDescription().c_str(), n, n == 1 ? "" : "s"),
+                    {}, {{"threads", std::to_string(n)}}, mean(c.getTimerInfo(), results)};
+            addSampleCount(c, record, ALGO::total_samples);
+            c.getSink().result(c, record);
+            scaling->total = total(c.getTimerInfo(), results).getResults();
+            return;
+        }
+        const std::vector<int>& cpus = c.getThreadCpus();
+        std::vector<TimingResult> results = runThreads(c.getTimerInfo(), cpus);
+        ResultRecord record{this, getDescription(), {}, {{"threads", std::to_string(cpus.size())}}, total(c.getTimerInfo(), results).getResults()};
+        addSampleCount(c, record, ALGO::total_samples);
+        c.getSink().result(c, record);
+        for (size_t t = 0; t < results.size(); t++) {
+            ResultRecord thread_record{this, string_format("thread %zu (cpu %d)", t, cpus[t]), {},
+                    {{"thread", std::to_string(t)}, {"cpu", std::to_string(cpus[t])}}, results[t].getResults()};
+            addSampleCount(c, thread_record, ALGO::total_samples);
+            c.getSink().result(c, thread_record);
+        }
+    }
+};
+
+/**
+ * A factory for multi-threaded delta benchmarks. It works like DeltaMaker (the reported time is the
+ * difference between BENCH_METHOD and BASE_METHOD), except that the benchmark runs on every CPU
+ * selected with --cpus and --threads, and reports the combined result followed by one line per thread.
+ *
+ * The arg_provider is called once in each thread, so each thread can get its own argument.
+ */
+template <typename TIMER>
+class ThreadedDeltaMaker : public MakerBase<TIMER, ThreadedDeltaMaker<TIMER>> {
+public:
+
+    using base_t = MakerBase<TIMER, ThreadedDeltaMaker<TIMER>>;
+    using ALGO   = ThreadedDeltaAlgo<TIMER>;
+
+    ThreadedDeltaMaker(BenchmarkGroup* parent, uint32_t loop_count = DeltaMaker<TIMER>::default_loop_count) :
+        base_t(parent, loop_count) {}
+
+    template <bench2_f BENCH_METHOD, bench2_f BASE_METHOD = dummy_bench>
+    void make(
+                const std::string& id,
+                const std::string& description,
+                uint32_t ops_per_loop,
+                const arg_provider_t& arg_provider = null_provider)
+    {
+        if (!this->parent->isSelected()) {
+            return;
+        }
+        Benchmark b = make_only<BENCH_METHOD, BASE_METHOD>(id, description, ops_per_loop, arg_provider);
+        this->parent->add(b);
+    }
+
+    template <bench2_f BENCH_METHOD, bench2_f BASE_METHOD = dummy_bench>
+    Benchmark make_only(
+            const std::string& id,
+            const std::string& description,
+            uint32_t ops_per_loop,
+            const arg_provider_t& arg_provider = null_provider)
+    {
+        typename ALGO::raw_f f = ALGO::template delta_bench<BENCH_METHOD, BASE_METHOD>;
+        return new ThreadedBench<TIMER>(this->make_args(id, description, ops_per_loop), this->loop_count, f, arg_provider);
+    }
+};
+
+/**
+ * A group of threaded benchmarks, made with ThreadedDeltaMaker, which runs each of them with 1, 2, 4, ... and
+ * finally all of the CPUs from Context::getThreadCpus() (the first CPUs of the list each time), to show how they
+ * scale with the thread count. Each run is reported as the mean result over its threads (just thread 0 for
+ * counter timers, see per_thread_timer), and once all the selected benchmarks have run, printSummary gets the
+ * results of every run.
+ */
+template <typename TIMER>
+class ThreadScalingGroup : public BenchmarkGroup {
+public:
+    using bench_t = ThreadedBench<TIMER>;
+
+    struct ScalingResult {
+        /* the mean of each metric over the threads, see ThreadedBench::mean */
+        std::vector<double> mean;
+        /* the combined result for all threads, see ThreadedBench::total */
+        std::vector<double> total;
+    };
+
+    /* the results of each benchmark which ran, by thread count */
+    using results_t = std::map<const BenchmarkBase*, std::map<size_t, ScalingResult>>;
+
+    ThreadScalingGroup(const std::string& id, const std::string& desc) : BenchmarkGroup(id, desc) {}
+
+    /* 1, 2, 4, ... threads, and all of them */
+    static std::vector<size_t> threadCounts(size_t cpus) {
+        std::vector<size_t> counts;
+        for (size_t n = 1; n < cpus; n *= 2) {
+            counts.push_back(n);
+        }
+        counts.push_back(cpus);
+        return counts;
+    }
+
+    /* the metric which rates are per unit of: Nanos if the timer has it, otherwise the first metric */
+    static size_t rateMetric(const TimerInfo& ti) {
+        auto& names = ti.getMetricNames();
+        auto nanos = std::find(names.begin(), names.end(), "Nanos");
+        return nanos == names.end() ? 0 : nanos - names.begin();
+    }
+
+    virtual void runIf(Context& c, const predicate_t& predicate) override {
+        results_t totals;
+        // the means are taken from the results as they're reported, i.e., merged over the event batches
+        run_with_summary(c, *this, [&]{ runScaling(c, predicate, totals); },
+                [&](const std::vector<ResultRecord>& records){
+                    results_t results;
+                    for (auto& record : records) {
+                        auto threads = std::find_if(record.attrs.begin(), record.attrs.end(),
+                                [](const attr_list::value_type& attr){ return attr.first == "threads"; });
+                        assert(threads != record.attrs.end());
+                        size_t n = std::stoul(threads->second);
+                        ScalingResult& result = results[record.bench][n];
+                        result.mean = record.values;
+                        // the run's total only has the events of its last event batch, so for counter timers it's
+                        // made from the merged mean instead: thread 0's result divided by the thread count, as
+                        // ThreadedBench::total does
+                        result.total = totals[record.bench][n].total;
+                        if (!per_thread_timer(c.getTimerInfo())) {
+                            result.total = record.values;
+                            for (auto& v : result.total) {
+                                v /= n;
+                            }
+                        }
+                    }
+                    printSummary(c, c.getSink().isText() ? c.out() : c.log(), threadCounts(c.getThreadCpus().size()), results);
+                });
+    }
+
+private:
+    /* run every selected benchmark with each thread count, keeping the total of each run in totals */
+    void runScaling(Context& c, const predicate_t& predicate, results_t& totals) {
+        const std::vector<int>& cpus = c.getThreadCpus();
+        SimpleTimer timer;
+        bool header = false;
+        for (auto& b : getBenches()) {
+            if (!predicate(b)) {
+                continue;
+            }
+            if (!header) {
+                c.getSink().groupStart(c, *this);
+                header = true;
+            }
+            if (!supports(b->getFeatures())) {
+                c.getSink().skipped(c, *b, "hardware doesn't support required features: " + container_to_string(b->getFeatures()));
+                continue;
+            }
+            auto bench = static_cast<bench_t*>(b);
+            for (size_t n : threadCounts(cpus.size())) {
+                typename bench_t::ScalingRun run{{cpus.begin(), cpus.begin() + n}, [=]{ beforeRun(n); }, {}};
+                bench->scaling = &run;
+                try {
+                    bench->runAndPrint(c);
+                } catch (...) {
+                    bench->scaling = nullptr;
+                    throw;
+                }
+                bench->scaling = nullptr;
+                totals[b][n].total = std::move(run.total);
+            }
+        }
+        if (header) {
+            c.getSink().groupEnd(c, *this, timer.elapsed<std::chrono::milliseconds>());
+        }
+    }
+
+protected:
+    /* called before each run of a benchmark with the given number of threads, e.g., to reset per-run state */
+    virtual void beforeRun(size_t threads) {}
+
+    /* print a summary of the results after the benchmarks have run, to os */
+    virtual void printSummary(Context& c, std::ostream& os, const std::vector<size_t>& counts, const results_t& results) = 0;
+};
+
+#endif /* THREADED_HPP_ */
@@ -56,6 +56,19 @@ typedef std::function<TimingResult (size_t)> full_bench_t;  // a full timing met
 struct TimerArgs {
     // a string of requested "extra events" passed via the --extra-events string
     std::string extra_events;
+    // true if the top-down breakdown was requested with --topdown
+    bool topdown;
+    // the NAME=EXPR derived metrics from --extra-events, which are removed from extra_events
+    std::vector<std::string> derived_metrics;
+};
+
+/**
+ * A metric which is computed from the other metrics of each result, rather than measured directly.
+ */
+struct DerivedMetric {
+    std::string name;
+    /* compute the metric from the values of the metrics before it, in the order of TimerInfo::getMetricNames() */
+    std::function<double (const std::vector<double>& values)> compute;
 };
 
 
@@ -69,6 +82,7 @@ class TimerInfo {
 	std::string name_, description_;
 protected:
 	std::vector<std::string> metric_names_;
+	std::vector<DerivedMetric> derived_metrics_;
 public:
 
 	TimerInfo(std::string name, std::string description, std::vector<std::string> metric_names) :
@@ -87,6 +101,33 @@ public:
 	    return metric_names_;
 	}
 
+	/*
+	 * Return the derived metrics, which come after all the measured metrics in getMetricNames(). Timers only
+	 * produce the measured values, and the derived values are appended to each result by a DerivedMetricSink.
+	 */
+	const std::vector<DerivedMetric>& getDerivedMetrics() const {
+	    return derived_metrics_;
+	}
+
+	/*
+	 * Return the full event names of the measured metrics, in the same order, which derived metric expressions
+	 * can use as well as the metric names. By default these are just the metric names.
+	 */
+	virtual std::vector<std::string> getEventNames() const {
+	    return {metric_names_.begin(), metric_names_.begin() + measuredMetricCount()};
+	}
+
+	/* the number of metrics the timer measures itself, i.e., not counting the derived metrics */
+	size_t measuredMetricCount() const {
+	    return metric_names_.size() - derived_metrics_.size();
+	}
+
+	/* add a derived metric, which must be done after all the measured metrics have been named */
+	void addDerivedMetric(DerivedMetric metric) {
+	    metric_names_.push_back(metric.name);
+	    derived_metrics_.push_back(std::move(metric));
+	}
+
 	/*
 	 * Do any initialization required prior to using the timer. Of course, you can put initialization
 	 * in the constructor as well, but slow initialization, or init that might fail can usefully go
@@ -106,6 +147,31 @@ public:
 	// this static method can be overridden to implement custom behavior at the start of the benchmark run
 	static void customRunHandler(Context& c) {}
 
+	/*
+	 * Timers which can count more events than the hardware can count at once split them into batches, and every
+	 * benchmark is run once per batch. The metrics for events outside the selected batch are NaN in the results,
+	 * and BenchmarkBase::runAndPrint merges the runs into single results. The first metric (usually cycles) is
+	 * measured in every batch.
+	 */
+	virtual size_t batchCount() const { return 1; }
+
+	/* program the events for the given batch, 0 <= batch < batchCount() */
+	virtual void selectBatch(Context& c, size_t batch) {}
+
+	/*
+	 * The core frequency in GHz which the timer assumes when it converts time to cycles, or 0 for timers which
+	 * count cycles directly. Only valid after init. See FreqMonitor.
+	 */
+	virtual double calibratedGHz() const { return 0; }
+
+	/*
+	 * Return false if the sample between the now() readings t0 and t1 was disrupted, so it should be taken
+	 * again. Timers which can tell (e.g., the perf timer, when the kernel moves its events) hide this with
+	 * their own version.
+	 */
+	template <typename NOW>
+	static bool valid(const NOW& t0, const NOW& t1) { return true; }
+
 	// if the --list-events command line argument is specified, this will be called on your timer (if your timer
 	// is selected), and you should ouutput any additional supported events to Context.out()
 	virtual void listEvents(Context& c) = 0;
@@ -4,8 +4,20 @@
  * Implementation for some generic timers defined mostly in timers.h.
  */
 
+#include <cerrno>
 #include <chrono>
+#include <cmath>
+#include <fstream>
 #include <iostream>
+#include <map>
+
+#include <sched.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if !UARCH_BENCH_PORTABLE
+#include <cpuid.h>
+#endif
 
 #include "timers.hpp"
 #include "stats.hpp"
@@ -26,7 +38,7 @@ using namespace Stats;
 using namespace std::chrono;
 
 /*
- * Calculate the frequency of the CPU based on timing a tight loop that we expect to
+ * Calculate the number of CPU cycles per tick of CLOCK based on timing a tight loop that we expect to
  * take one iteration per cycle.
  *
  * ITERS is the base number of iterations to use: the calibration routine is actually
@@ -34,18 +46,9 @@ using namespace std::chrono;
  * remove measurement overhead.
  */
 template <size_t ITERS, typename CLOCK, size_t TRIES = 10, size_t WARMUP = 100>
-double CalcCpuFreq() {
+double CalcCyclesPerTick() {
     static_assert((ITERS & 3) == 0, "iters must be divisible by 4 because we unroll some loops by 4");
-    const char* mhz;
-    if ((mhz = getenv("UARCH_BENCH_CLOCK_MHZ"))) {
-        double ghz = std::stoi(mhz) / 1000.0;
-        fprintf(stderr, "Frequency set to %6.3f GHz using UARCH_BENCH_CLOCK_MHZ\n", ghz);
-        return ghz;
-    } else {
-        fprintf(stderr, "UARCH_BENCH_CLOCK_MHZ not set, running calibration\n");
-    }
-
-    std::array<nanoseconds::rep, TRIES> results;
+    std::array<int64_t, TRIES> results;
 
     for (size_t w = 0; w < WARMUP + 1; w++) {
         for (size_t r = 0; r < TRIES; r++) {
@@ -65,8 +68,130 @@ double CalcCpuFreq() {
 
     DescriptiveStats stats = get_stats(results.begin(), results.end());
 
-    double ghz = ((double)ITERS / stats.getMedian());
-    return ghz;
+    return (double)ITERS / stats.getMedian();
+}
+
+/* the frequency set by UARCH_BENCH_CLOCK_MHZ in GHz, or 0 if it isn't set */
+static double env_ghz() {
+    const char* mhz = getenv("UARCH_BENCH_CLOCK_MHZ");
+    return mhz ? std::stoi(mhz) / 1000.0 : 0;
+}
+
+/*
+ * The calibration file, given by UARCH_BENCH_CALIBRATION_CACHE, or by default uarch-bench/calibration in
+ * the XDG cache directory. Returns the empty string if UARCH_BENCH_CALIBRATION_CACHE is set but empty,
+ * which disables the cache.
+ */
+static std::string calibration_cache_file() {
+    if (const char* file = getenv("UARCH_BENCH_CALIBRATION_CACHE")) {
+        return file;
+    }
+    const char* xdg = getenv("XDG_CACHE_HOME");
+    const char* home = getenv("HOME");
+    if (xdg && *xdg) {
+        return std::string(xdg) + "/uarch-bench/calibration";
+    }
+    return home ? std::string(home) + "/.cache/uarch-bench/calibration" : "";
+}
+
+/*
+ * The key for a cached calibration of the named clock: everything that changes the speed of the calibration
+ * loop relative to the clock, i.e., the CPU model, microcode, and the governor and turbo state of the
+ * current CPU.
+ */
+static std::string calibration_key(const char* clock) {
+    std::string cpufreq = string_format("/sys/devices/system/cpu/cpu%d/cpufreq/", sched_getcpu());
+    std::string turbo = read_first_line("/sys/devices/system/cpu/intel_pstate/no_turbo");
+    turbo = turbo != "unknown" ? "no_turbo=" + turbo :
+            "boost=" + read_first_line("/sys/devices/system/cpu/cpufreq/boost");
+    return string_format("%s|%s|%s|%s|%s", clock, cpuinfo_value("model name").c_str(), cpuinfo_value("microcode").c_str(),
+            read_first_line(cpufreq + "scaling_governor").c_str(), turbo.c_str());
+}
+
+/* read the whole calibration file, as a map from key to cycles per tick */
+static std::map<std::string, double> read_calibration_cache(const std::string& file) {
+    std::map<std::string, double> cache;
+    std::ifstream in(file);
+    std::string line;
+    while (std::getline(in, line)) {
+        auto tab = line.rfind('\t');
+        if (tab != std::string::npos) {
+            cache[line.substr(0, tab)] = atof(line.c_str() + tab + 1);
+        }
+    }
+    return cache;
+}
+
+/*
+ * Write the calibration file, creating its directory if needed. The file is replaced atomically so concurrent
+ * runs never see a partial file. Failures only cause a warning, since the cache is just an optimization.
+ */
+static void write_calibration_cache(const std::string& file, const std::map<std::string, double>& cache) {
+    for (size_t slash = file.find('/', 1); slash != std::string::npos; slash = file.find('/', slash + 1)) {
+        mkdir(file.substr(0, slash).c_str(), 0755);
+    }
+    std::string tmp = string_format("%s.%d", file.c_str(), (int)getpid());
+    {
+        std::ofstream out(tmp);
+        for (auto& entry : cache) {
+            out << entry.first << '\t' << string_format("%.6f", entry.second) << '\n';
+        }
+        if (!out) {
+            fprintf(stderr, "WARNING: couldn't write calibration cache %s\n", tmp.c_str());
+            return;
+        }
+    }
+    if (rename(tmp.c_str(), file.c_str())) {
+        fprintf(stderr, "WARNING: couldn't write calibration cache %s: %s\n", file.c_str(), errno_to_str(errno).c_str());
+        remove(tmp.c_str());
+    }
+}
+
+/*
+ * Like CalcCyclesPerTick, but using the value cached for the named clock in the calibration file (see
+ * calibration_cache_file) if there is one for the current CPU configuration. The cached value is only
+ * used if a short spot check agrees with it to within 2%, otherwise the full calibration runs and the
+ * result is cached for next time.
+ */
+template <size_t ITERS, typename CLOCK, size_t TRIES = 10, size_t WARMUP = 100>
+double CachedCyclesPerTick(const char* clock) {
+    std::string file = calibration_cache_file();
+    if (file.empty()) {
+        return CalcCyclesPerTick<ITERS, CLOCK, TRIES, WARMUP>();
+    }
+
+    std::string key = calibration_key(clock);
+    auto cache = read_calibration_cache(file);
+    auto found = cache.find(key);
+    if (found != cache.end()) {
+        double check = CalcCyclesPerTick<ITERS, CLOCK, 20, 10>();
+        if (std::abs(check - found->second) <= 0.02 * found->second) {
+            fprintf(stderr, "Using cached calibration from %s\n", file.c_str());
+            return found->second;
+        }
+        fprintf(stderr, "Cached calibration %.3f doesn't match spot check %.3f, recalibrating\n", found->second, check);
+    }
+
+    double result = CalcCyclesPerTick<ITERS, CLOCK, TRIES, WARMUP>();
+    cache[key] = result;
+    write_calibration_cache(file, cache);
+    return result;
+}
+
+/*
+ * Calculate the frequency of the CPU in GHz, i.e., the cycles per nanosecond of CLOCK, unless it is
+ * set by UARCH_BENCH_CLOCK_MHZ.
+ */
+template <size_t ITERS, typename CLOCK, size_t TRIES = 10, size_t WARMUP = 100>
+double CalcCpuFreq() {
+    if (double ghz = env_ghz()) {
+        fprintf(stderr, "Frequency set to %6.3f GHz using UARCH_BENCH_CLOCK_MHZ\n", ghz);
+        return ghz;
+    } else {
+        fprintf(stderr, "UARCH_BENCH_CLOCK_MHZ not set, running calibration\n");
+    }
+
+    return CachedCyclesPerTick<ITERS, CLOCK, TRIES, WARMUP>("clock");
 }
 
 template <typename CLOCK>
@@ -77,7 +202,7 @@ double ClockTimerT<CLOCK>::getGHz() {
 
 template <typename CLOCK>
 void ClockTimerT<CLOCK>::init(Context &c) {
-        c.out() << "Median CPU speed: " << std::fixed << std::setw(4) << std::setprecision(3)
+        c.log() << "Median CPU speed: " << std::fixed << std::setw(4) << std::setprecision(3)
         << getGHz() << " GHz" << std::endl;
 }
 
@@ -85,6 +210,50 @@ void ClockTimerT<CLOCK>::init(Context &c) {
 template double DefaultClockTimer::getGHz();
 template void DefaultClockTimer::init(Context& c);
 
+#if !UARCH_BENCH_PORTABLE
+
+/* adapts TscTimer to the CLOCK interface, though the "nanos" are really TSC ticks */
+struct TscClock {
+    static int64_t nanos() { return TscTimer::now(); }
+};
+
+/* the TSC frequency in GHz, measured against the steady clock over a few short intervals */
+static double CalcTscFreq() {
+    std::array<double, 5> results;
+    for (auto& r : results) {
+        auto n0 = StdClockAdapt<steady_clock>::nanos();
+        auto t0 = TscTimer::now();
+        while (StdClockAdapt<steady_clock>::nanos() - n0 < 20 * 1000 * 1000) {}
+        auto t1 = TscTimer::now();
+        auto n1 = StdClockAdapt<steady_clock>::nanos();
+        r = (double)(t1 - t0) / (n1 - n0);
+    }
+    return get_stats(results.begin(), results.end()).getMedian();
+}
+
+void TscTimer::init(Context &c) {
+    unsigned eax, ebx, ecx, edx;
+    if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) || !(edx & (1u << 8))) {
+        c.err() << "WARNING: this CPU doesn't report an invariant TSC, so the TSC rate may change with the "
+                "core frequency and TSC timer results may be wrong" << endl;
+    }
+
+    tsc_ghz_ = CalcTscFreq();
+    if (double ghz = env_ghz()) {
+        c.log() << "Core frequency set to " << std::fixed << std::setprecision(3) << ghz
+                << " GHz using UARCH_BENCH_CLOCK_MHZ" << endl;
+        cycles_per_tick_ = ghz / tsc_ghz_;
+    } else {
+        cycles_per_tick_ = CachedCyclesPerTick<10000,TscClock,1000>("tsc");
+    }
+
+    c.log() << "TSC frequency: " << std::fixed << std::setprecision(3) << tsc_ghz_ << " GHz, core cycles per TSC tick: "
+            << std::setprecision(4) << cycles_per_tick_ << " (" << std::setprecision(3) << tsc_ghz_ * cycles_per_tick_
+            << " GHz core clock)" << endl;
+}
+
+#endif // !UARCH_BENCH_PORTABLE
+
 // stuff for calculating clock overhead
 
 template <size_t ITERS, typename CLOCK>
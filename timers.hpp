@@ -30,6 +30,12 @@
 #define IF_PERF_TIMER(x)
 #endif
 
+#if !UARCH_BENCH_PORTABLE
+#define IF_TSC_TIMER(x) x
+#else
+#define IF_TSC_TIMER(x)
+#endif
+
 
 
 /**
@@ -93,6 +99,10 @@ public:
     /* return the statically calculated clock speed of the CPU in ghz for this clock */
     static double getGHz();
 
+    virtual double calibratedGHz() const override {
+        return getGHz();
+    }
+
     virtual void listEvents(Context& c) override {
         c.out() << "The clock timer doesn't have any supported extra events";
     }
@@ -101,6 +111,67 @@ public:
 // the default ClockTimer will use high_resolution_clock
 using DefaultClockTimer = ClockTimerT<StdClockAdapt<std::chrono::high_resolution_clock>>;
 
+#if !UARCH_BENCH_PORTABLE
+
+/*
+ * This timer reads the TSC directly, which is much cheaper than going through clock_gettime and doesn't need
+ * any perf access. The TSC ticks at a constant rate which is generally not the core clock, so ticks are
+ * converted to core cycles using a ratio calibrated once at startup, which is only accurate as long as the
+ * core frequency doesn't change after calibration (e.g., turbo is disabled).
+ *
+ * Each read is fenced on both sides with lfence so it can't be reordered with the benchmark code. We don't use
+ * rdtscp since it only waits for earlier instructions, so it would need a trailing lfence anyway.
+ */
+class TscTimer : public TimerInfo {
+public:
+
+    typedef int64_t now_t;
+    typedef int64_t delta_t;
+
+    TscTimer() : TimerInfo("tsc",
+            "Use rdtsc to measure TSC ticks, and convert to cycles using a calibrated TSC to core clock ratio",
+            {"Cycles", "Nanos", "Ticks"}) {}
+
+    void init(Context &c) override;
+
+    HEDLEY_ALWAYS_INLINE
+    static int64_t now() {
+        uint32_t lo, hi;
+        asm volatile ("lfence\n\t"
+                      "rdtsc\n\t"
+                      "lfence" : "=a" (lo), "=d" (hi) :: "memory");
+        return ((int64_t)hi << 32) | lo;
+    }
+
+    static TimingResult to_result(const TscTimer& ti, int64_t ticks) {
+        return TimingResult({ticks * ti.cycles_per_tick_, ticks / ti.tsc_ghz_, (double)ticks});
+    }
+
+    /*
+     * Return the delta of a and b, that is a minus b.
+     */
+    static int64_t delta(int64_t a, int64_t b) {
+        return a - b;
+    }
+
+    static int64_t aggr_value(int64_t delta) {
+        return delta;
+    }
+
+    virtual void listEvents(Context& c) override {
+        c.out() << "The TSC timer doesn't have any supported extra events";
+    }
+
+    virtual double calibratedGHz() const override {
+        return cycles_per_tick_ * tsc_ghz_;
+    }
+
+private:
+    double tsc_ghz_ = 0, cycles_per_tick_ = 0;
+};
+
+#endif // !UARCH_BENCH_PORTABLE
+
 // print a variety of information about system clock overheads to the given ostream
 void printClockOverheads(std::ostream& out);
 
@@ -109,6 +180,7 @@ void printClockOverheads(std::ostream& out);
 // class for all possible timers
 #define ALL_TIMERS_X(FN) \
                       FN(DefaultClockTimer)  \
+        IF_TSC_TIMER( FN(TscTimer         )) \
         IF_LIBPFC(    FN(LibpfcTimer      )) \
         IF_PERF_TIMER(FN(PerfTimer        )) \
 
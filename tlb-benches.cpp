@@ -0,0 +1,255 @@
+/*
+ * tlb-benches.cpp
+ *
+ * TLB reach and page walk cost. The memory/tlb group chases pointers with one load per page over a sweep of
+ * page counts, for 4K pages, 2M (transparent huge) pages and, if any are reserved, 1G hugetlbfs pages. The
+ * latency has a plateau for each level of the TLB hierarchy which the pages fit in, and a step up when they
+ * no longer fit, so after the benchmarks run a summary of the levels found is printed, for each page size.
+ *
+ * The data touched is one line per page, so for large page counts the lines no longer fit in L1 and some of
+ * each step is cache latency. Counting the dtlb_load_misses events with --extra-events separates the two:
+ * the summary uses them, if they are there, to tell which levels are STLB hits and which are page walks.
+ */
+
+#include "benchmark.hpp"
+#include "cache-levels.hpp"
+#include "cpp-benches.hpp"
+#include "result-sink.hpp"
+#include "table.hpp"
+#include "util.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cinttypes>
+#include <cmath>
+#include <map>
+#include <numeric>
+#include <random>
+
+namespace {
+
+struct PageKind {
+    /* used in the benchmark and parameter IDs */
+    const char* id;
+    const char* name;
+    size_t bytes;
+    /* fixed for each kind, rather than following --page-size */
+    PageBacking backing;
+    const char* default_pages;
+    int64_t max_pages;
+};
+
+constexpr size_t GIB = 1024 * 1024 * 1024;
+
+const PageKind PAGE_KINDS[] = {
+    {"4k", "4K", 4096,            PageBacking::SMALL,      "8..64:+8,96..256:+32,320..1024:+64,1280..4096:+256,6144..16384:+2048,32768..65536:x2", 1024 * 1024},
+    {"2m", "2M", 2 * 1024 * 1024, PageBacking::THP,        "2..32:+2,40..64:+8,96..256:+32,384..1024:+128", 16 * 1024},
+    {"1g", "1G", GIB,             PageBacking::HUGETLB_1G, "1..16", 1024},
+};
+
+/* the fewest loads per sample, for small page counts */
+constexpr int64_t MIN_LOOPS = 16 * 1024;
+
+/* a level ends when the latency rises by more than this, relative */
+constexpr double TOLERANCE = 0.1;
+
+/*
+ * The storage for the chases with the given page size, shared by all of its benchmarks, and allocated on
+ * first use with room for the given number of pages.
+ */
+char* page_storage(const PageKind& kind, size_t pages) {
+    static std::map<size_t, char*> storage;
+    char*& ptr = storage[kind.bytes];
+    if (!ptr) {
+        ptr = static_cast<char*>(new_backed_ptr(pages * kind.bytes, kind.backing));
+    }
+    return ptr;
+}
+
+/*
+ * Link one line in each of the first pages pages of storage into a cycle, in a random page order so that the
+ * prefetchers and the paging-structure caches get no help from locality. The line used moves along within each
+ * page so that the lines are spread over the cache sets.
+ *
+ * The chases for all page counts share the storage, so the links are made again on every call, but the
+ * returned region is kept for each page size and count, and shouldn't be freed.
+ */
+region* make_page_chase(char* storage, size_t page_size, size_t pages) {
+    static std::map<std::pair<size_t, size_t>, region> regions;
+    std::vector<size_t> order(pages);
+    std::iota(order.begin(), order.end(), 0);
+    std::shuffle(order.begin(), order.end(), std::mt19937_64{123});
+    size_t lines = page_size / UB_CACHE_LINE_SIZE;
+    auto line = [=](size_t page) { return storage + page * page_size + page % lines * UB_CACHE_LINE_SIZE; };
+    for (size_t i = 0; i < pages; i++) {
+        *(void**)line(order[i]) = line(order[(i + 1) % pages]);
+    }
+    region& r = regions[{page_size, pages}];
+    r = region{pages * page_size, line(order[0])};
+    return &r;
+}
+
+/* an event name in the perf style, e.g., skl::DTLB_LOAD_MISSES:STLB_HIT becomes dtlb_load_misses.stlb_hit */
+std::string normalize_event(std::string name) {
+    auto colons = name.find("::");
+    if (colons != std::string::npos) {
+        name = name.substr(colons + 2);
+    }
+    for (char& ch : name) {
+        ch = ch == ':' ? '.' : tolower((unsigned char)ch);
+    }
+    return name;
+}
+
+/* the metric index of the first of the given events which is counted, or -1 if none are */
+int find_event(const std::vector<std::string>& event_names, std::initializer_list<const char*> events) {
+    for (auto event : events) {
+        for (size_t i = 0; i < event_names.size(); i++) {
+            if (normalize_event(event_names[i]) == event) {
+                return i;
+            }
+        }
+    }
+    return -1;
+}
+
+class TlbGroup : public BenchmarkGroup {
+    struct SweepInfo {
+        const PageKind* kind;
+        int64_t pages;
+    };
+
+    /* the page size and count for each benchmark, for the summary */
+    std::map<const BenchmarkBase*, SweepInfo> sweep_info_;
+
+    /* the median of the given metric over the points of the level, or NaN if it isn't counted */
+    static double level_median(const std::map<int64_t, const ResultRecord*>& points, const PageKind& kind,
+            const CacheLevel& level, int metric) {
+        std::vector<double> values;
+        for (auto& p : points) {
+            size_t bytes = p.first * kind.bytes;
+            if (metric >= 0 && bytes >= level.first_bytes && bytes <= level.capacity && (size_t)metric < p.second->values.size()) {
+                values.push_back(p.second->values[metric]);
+            }
+        }
+        if (values.empty()) {
+            return NAN;
+        }
+        std::sort(values.begin(), values.end());
+        return values[(values.size() - 1) / 2];
+    }
+
+    void printSummary(Context& c, const std::vector<ResultRecord>& results) {
+        using namespace table;
+        auto event_names = c.getTimerInfo().getEventNames();
+        int stlb_hits   = find_event(event_names, {"dtlb_load_misses.stlb_hit"});
+        int walks       = find_event(event_names, {"dtlb_load_misses.miss_causes_a_walk", "dtlb_load_misses.walk_completed"});
+        int walk_cycles = find_event(event_names, {"dtlb_load_misses.walk_active", "dtlb_load_misses.walk_duration"});
+        std::ostream& os = c.getSink().isText() ? c.out() : c.log();
+
+        for (auto& kind : PAGE_KINDS) {
+            std::map<int64_t, const ResultRecord*> points;
+            for (auto& r : results) {
+                auto info = sweep_info_.find(r.bench);
+                if (info != sweep_info_.end() && info->second.kind == &kind && !r.values.empty()) {
+                    points[info->second.pages] = &r;
+                }
+            }
+            if (points.size() < 2) {
+                continue;
+            }
+            std::vector<SweepPoint> sweep;
+            for (auto& p : points) {
+                sweep.push_back(SweepPoint{p.first * kind.bytes, p.second->values[0]});
+            }
+            auto levels = find_cache_levels(sweep, TOLERANCE);
+
+            Table t;
+            auto& header = t.newRow().add("Level").add("Pages").add("Reach").add("Latency").add("Extra");
+            if (walk_cycles >= 0) {
+                header.add("Cycles/walk");
+            }
+            for (size_t i = 0; i < levels.size(); i++) {
+                auto& level = levels[i];
+                // the events say which level this is if they are counted, otherwise go by the order
+                double stlb_rate = level_median(points, kind, level, stlb_hits);
+                double walk_rate = level_median(points, kind, level, walks);
+                const char* name = i == 0 ? "L1 DTLB" : i == 1 ? "STLB" : "Page walk";
+                if (!std::isnan(stlb_rate) && !std::isnan(walk_rate)) {
+                    name = walk_rate > 0.5 ? "Page walk" : stlb_rate > 0.5 ? "STLB" : "L1 DTLB";
+                }
+                auto& row = t.newRow().add(name);
+                if (i + 1 == levels.size() && level.capacity == sweep.back().bytes) {
+                    // the sweep ended on this level, so its capacity is unknown
+                    row.add("-").add("-");
+                } else {
+                    row.add(level.capacity / kind.bytes).add(format_cache_size(level.capacity));
+                }
+                row.add(string_format("%.1f", level.cycles)).add(string_format("%+.1f", level.cycles - levels.front().cycles));
+                if (walk_cycles >= 0) {
+                    double per_walk = level_median(points, kind, level, walk_cycles) / walk_rate;
+                    row.add(walk_rate > 0.05 && std::isfinite(per_walk) ? string_format("%.1f", per_walk) : "-");
+                }
+            }
+            for (size_t col = 1; col < 6; col++) {
+                t.colInfo(col).justify = ColInfo::RIGHT;
+            }
+            os << std::endl << "** TLB levels found with " << kind.name << " pages (latency in "
+                    << c.getTimerInfo().getMetricNames().at(0) << " per load) **" << std::endl << t.str();
+        }
+
+        if (stlb_hits < 0 || walks < 0) {
+            c.log() << "NOTE: the levels are labeled by their order, count the dtlb_load_misses.stlb_hit and "
+                    "dtlb_load_misses.miss_causes_a_walk events (and optionally walk_active) with --extra-events to "
+                    "label them by what they are" << std::endl;
+        }
+    }
+
+public:
+    TlbGroup() : BenchmarkGroup("memory/tlb", "TLB reach and page walk cost, one load per page") {}
+
+    void addSweep(Benchmark b, const PageKind& kind, int64_t pages) {
+        sweep_info_[b] = SweepInfo{&kind, pages};
+        add(b);
+    }
+
+    virtual void runIf(Context& c, const predicate_t& predicate) override {
+        run_with_summary(c, *this, [&]{ BenchmarkGroup::runIf(c, predicate); },
+                [&](const std::vector<ResultRecord>& results){ printSummary(c, results); });
+    }
+};
+
+}  // namespace
+
+template <typename TIMER>
+void register_tlb(GroupList& list) {
+    auto group = std::make_shared<TlbGroup>();
+    list.push_back(group);
+    auto maker = DeltaMaker<TIMER>(group.get()).setTags({"slow"});
+
+    for (auto& kind : PAGE_KINDS) {
+        auto pages_list = group->param(std::string("pages-") + kind.id, string_format("Page counts for the %s page chases", kind.name),
+                kind.default_pages, 1, kind.max_pages);
+        if (kind.bytes == GIB) {
+            // only as many as are reserved, since they can't fall back to smaller pages
+            size_t free = hugetlb_free_pages(kind.bytes);
+            pages_list.erase(std::remove_if(pages_list.begin(), pages_list.end(), [=](int64_t p){ return (size_t)p > free; }), pages_list.end());
+        }
+        if (!group->isSelected() || pages_list.empty()) {
+            continue;
+        }
+        size_t max_pages = *std::max_element(pages_list.begin(), pages_list.end());
+        for (int64_t pages : pages_list) {
+            // each sample chases through every page at least once
+            Benchmark b = maker.setLoopCount(std::max(pages, MIN_LOOPS)).template make_only<pointer_chase>(
+                    string_format("%s-pages-%" PRId64, kind.id, pages),
+                    string_format("%" PRId64 " %s pages, one load each", pages, kind.name), 1,
+                    [=, &kind]{ return make_page_chase(page_storage(kind, max_pages), kind.bytes, pages); });
+            group->addSweep(b, kind, pages);
+        }
+    }
+}
+
+#define REG_DEFAULT(CLOCK) template void register_tlb<CLOCK>(GroupList& list);
+
+ALL_TIMERS_X(REG_DEFAULT)
@@ -3,17 +3,27 @@
  */
 
 #include "util.hpp"
+#include "matchers.hpp"
 #include "opt-control.hpp"
 #include "page-info.h"
 
-#include <regex>
+#include <algorithm>
+#include <array>
 #include <cassert>
+#include <map>
+#include <thread>
 #include <numeric>
 #include <random>
 #include <cstring>
 #include <exception>
+#include <fstream>
+#include <iostream>
 
 #include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sched.h>
+#include <unistd.h>
+#include <linux/mempolicy.h>
 
 #if !UARCH_BENCH_PORTABLE
 #include <immintrin.h>
@@ -31,47 +41,76 @@
 #endif
 #endif
 
-#if defined(__GNUC__) && !defined(__clang__)
-#define GCC_VERSION (__GNUC__ * 10000 + __GNUC_MINOR__ * 100 + __GNUC_PATCHLEVEL__)
-#endif
-
-#if defined(GCC_VERSION) && (GCC_VERSION < 40900)
-#warning "Your gcc is too old to support regex, wildcard matches will be disabled - use gcc 4.9 or higher if you need them"
-#define NO_CXX11_REGEX
-#endif
-
-#ifdef NO_CXX11_REGEX
-
-// support only a basic form of wildcard matches with works with literal patterns (no wildcards)
-// or a single trailing wildcard
 bool wildcard_match(const std::string& target, const std::string& pattern) {
-    auto first_star = pattern.find('*');
-    if (first_star == std::string::npos) {
-        return target == pattern;
-    } else if (first_star == pattern.length() - 1) {
-        std::string prefix = pattern.substr(0, pattern.length() - 1);
-        return target.find(prefix) == 0;
-    } else {
-        throw std::runtime_error("You tried to use a non-trailing wildcard match, but this feature that requires C++ regex support");
-    }
+    return WildcardMatcher{pattern}(target);
 }
 
-#else
-
-std::string escape_for_regex(const std::string& input) {
-    // see https://stackoverflow.com/a/40195721/149138
-    static std::regex chars_to_escape{ R"([-[\]{}()*+?.\^$|])" };
-    return std::regex_replace( input, chars_to_escape, R"(\$&)" );
+std::string json_quote(const std::string& s) {
+    std::string ret = "\"";
+    for (char c : s) {
+        switch (c) {
+        case '"':  ret += "\\\""; break;
+        case '\\': ret += "\\\\"; break;
+        case '\n': ret += "\\n";  break;
+        case '\r': ret += "\\r";  break;
+        case '\t': ret += "\\t";  break;
+        default:
+            if ((unsigned char)c < 0x20) {
+                ret += string_format("\\u%04x", (unsigned)c);
+            } else {
+                ret += c;
+            }
+        }
+    }
+    return ret + "\"";
 }
 
-bool wildcard_match(const std::string& target, const std::string& pattern) {
-    // we implement wildcards just by replacing all *s with .*
-    std::string escaped = escape_for_regex(std::move(pattern));
-    std::string regex   = std::regex_replace(escaped, std::regex(R"(\\\*)"), R"(.*)");
-    return std::regex_match(target, std::regex(regex));
+std::string json_value(const std::string& s) {
+    // the JSON number grammar: -?(0|[1-9][0-9]*)(\.[0-9]+)?([eE][+-]?[0-9]+)?
+    size_t i = 0, n = s.size();
+    auto digits = [&]() {
+        size_t start = i;
+        while (i < n && s[i] >= '0' && s[i] <= '9') {
+            i++;
+        }
+        return i > start;
+    };
+    bool number = true;
+    if (i < n && s[i] == '-') {
+        i++;
+    }
+    if (i < n && s[i] == '0') {
+        i++;
+    } else {
+        number = digits();
+    }
+    if (number && i < n && s[i] == '.') {
+        i++;
+        number = digits();
+    }
+    if (number && i < n && (s[i] == 'e' || s[i] == 'E')) {
+        i++;
+        if (i < n && (s[i] == '+' || s[i] == '-')) {
+            i++;
+        }
+        number = digits();
+    }
+    return number && i == n ? s : json_quote(s);
 }
 
-#endif
+std::string csv_quote(const std::string& s) {
+    if (s.find_first_of(",\"\r\n") == std::string::npos) {
+        return s;
+    }
+    std::string ret = "\"";
+    for (char c : s) {
+        if (c == '"') {
+            ret += '"';
+        }
+        ret += c;
+    }
+    return ret + "\"";
+}
 
 const size_t TWO_MB = 2 * 1024 * 1024;
 const size_t STORAGE_SIZE = 512 * 1024 * 1024;
@@ -91,18 +130,79 @@ void *new_aligned_pointer(size_t size, size_t alignment) {
     return ptr;
 }
 
-void *new_huge_ptr(size_t size, bool huge) {
-    void *ptr = new_aligned_pointer(size + TWO_MB, TWO_MB);
+static PageBacking page_backing = PageBacking::THP;
+/* true if the backing was set explicitly, so not getting it is an error */
+static bool page_backing_explicit = false;
+
+PageBacking parse_page_backing(const std::string& name) {
+    if (name == "thp") {
+        return PageBacking::THP;
+    } else if (name == "4k") {
+        return PageBacking::SMALL;
+    } else if (name == "2m") {
+        return PageBacking::HUGETLB_2M;
+    } else if (name == "1g") {
+        return PageBacking::HUGETLB_1G;
+    }
+    throw std::runtime_error("unknown page size '" + name + "', expected 4k, 2m, 1g or thp");
+}
+
+void set_page_backing(PageBacking backing) {
+    page_backing = backing;
+    page_backing_explicit = true;
+}
+
+/* the node set by set_mem_node, or -1 */
+static int mem_node = -1;
+
+/* the stream set by set_log_stream */
+static std::ostream* log_stream = &std::cerr;
+
+void set_log_stream(std::ostream* log) {
+    log_stream = log;
+}
+
+void *new_huge_ptr(size_t size, bool huge, int node) {
+    return new_backed_ptr(size, huge ? page_backing : PageBacking::SMALL, node);
+}
+
+void *new_backed_ptr(size_t size, PageBacking backing, int node) {
+    void *ptr;
+    // the length actually mapped, in whole pages, which is what must be bound to a node: mbind on only part of
+    // a hugetlb page fails
+    size_t mapped_size;
+    if (backing == PageBacking::HUGETLB_2M || backing == PageBacking::HUGETLB_1G) {
+        size_t page_size = backing == PageBacking::HUGETLB_2M ? TWO_MB : 1024 * 1024 * 1024;
+        mapped_size = (size + page_size - 1) / page_size * page_size;
+        ptr = new_hugetlb_ptr(mapped_size, page_size);
+    } else {
+        bool huge = backing == PageBacking::THP;
+        if (huge && page_backing_explicit && read_first_line("/sys/kernel/mm/transparent_hugepage/enabled").find("[never]") != std::string::npos) {
+            throw std::runtime_error("transparent huge pages were requested, but they are disabled in /sys/kernel/mm/transparent_hugepage/enabled");
+        }
+        // rounded up to whole huge pages, since a partial one at the end can't be a THP
+        size_t alloc_size = (size + TWO_MB - 1) / TWO_MB * TWO_MB;
+        mapped_size = alloc_size;
+        ptr = new_aligned_pointer(alloc_size + TWO_MB, TWO_MB);
 #if UARCH_BENCH_USE_HUGEPAGES
-    madvise(ptr, size + TWO_MB, huge ? MADV_HUGEPAGE : MADV_NOHUGEPAGE);
-    ptr = ((char *)ptr + TWO_MB);
+        madvise(ptr, alloc_size + TWO_MB, huge ? MADV_HUGEPAGE : MADV_NOHUGEPAGE);
+        ptr = ((char *)ptr + TWO_MB);
 #else
-    static bool once;
-    if (!once) {
-        fprintf(stderr, "WARNING: huge pages not available\n");
-        once = true;
-    }
+        static bool once;
+        if (!once) {
+            *log_stream << "WARNING: huge pages not available" << std::endl;
+            once = true;
+        }
+        if (huge && page_backing_explicit) {
+            throw std::runtime_error("transparent huge pages were requested, but aren't supported on this system");
+        }
 #endif
+    }
+    node = node < 0 ? mem_node : node;
+    if (node >= 0) {
+        // before the pages are touched, so they are allocated on the node in the first place
+        bind_to_node(ptr, mapped_size, node);
+    }
     // It is critical that we memset the memory region to touch each page, otherwise all or some pages
     // can be mapped to the zero page, leading to unexpected results for read-only tests (i.e., "too good to be true"
     // results for benchmarks that read large amounts of memory, because internally these are all mapped
@@ -117,17 +217,26 @@ void *new_huge_ptr(size_t size, bool huge) {
     opt_control::modify(ptr);
 
 #ifdef KPF_THP
-    if (huge) {
+    if (backing == PageBacking::THP || (backing == PageBacking::SMALL && page_backing_explicit)) {
         page_info_array pinfo = get_info_for_range(ptr, (char *)ptr + size);
         flag_count thp_count = get_flag_count(pinfo, KPF_THP);
         if (thp_count.pages_available) {
-            printf("Source pages allocated with transparent hugepages: %4.1f\n", 100.0 * thp_count.pages_set / thp_count.pages_total);
+            if (backing == PageBacking::THP) {
+                *log_stream << string_format("Source pages allocated with transparent hugepages: %4.1f",
+                        100.0 * thp_count.pages_set / thp_count.pages_total) << std::endl;
+            }
+            if (page_backing_explicit && thp_count.pages_set != (backing == PageBacking::THP ? thp_count.pages_total : 0)) {
+                throw std::runtime_error(string_format("%s pages were requested, but %lu of the %lu pages in a %zu KiB region are"
+                        " transparent huge pages", backing == PageBacking::THP ? "Transparent huge" : "4K",
+                        thp_count.pages_set, thp_count.pages_total, size / 1024));
+            }
             if (thp_count.pages_available != thp_count.pages_total) {
-                printf("WARNING: THP status of some pages couldn't be determined: (%lu total pages, %4.1f%% flagged)\n",
-                        thp_count.pages_total, 100.0 * thp_count.pages_available / thp_count.pages_total);
+                *log_stream << string_format("WARNING: THP status of some pages couldn't be determined: (%lu total pages, %4.1f%% flagged)",
+                        thp_count.pages_total, 100.0 * thp_count.pages_available / thp_count.pages_total) << std::endl;
             }
-        } else {
-            printf("WARNING: couldn't determine hugepage info (it's OK, you are probably not running as root)\n");
+        } else if (backing == PageBacking::THP || page_backing_explicit) {
+            *log_stream << "WARNING: couldn't determine hugepage info (it's OK, you are probably not running as root)"
+                    << (page_backing_explicit ? ", so the page size can't be checked" : "") << std::endl;
         }
     }
 #endif
@@ -135,6 +244,28 @@ void *new_huge_ptr(size_t size, bool huge) {
     return ptr;
 }
 
+void *new_hugetlb_ptr(size_t size, size_t page_size) {
+    assert(is_pow2(page_size) && size % page_size == 0);
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#if defined(MAP_HUGETLB) && defined(MAP_HUGE_SHIFT)
+    // the page size goes in the bits above MAP_HUGE_SHIFT, as log2 of the size
+    flags |= MAP_HUGETLB | (__builtin_ctzll(page_size) << MAP_HUGE_SHIFT);
+    void *ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (ptr == MAP_FAILED) {
+        throw std::runtime_error(string_format("failed to map %zu hugetlbfs pages of %zu KiB (free: %zu): %s",
+                size / page_size, page_size / 1024, hugetlb_free_pages(page_size), errno_to_str(errno).c_str()));
+    }
+    return ptr;
+#else
+    throw std::runtime_error("hugetlbfs pages aren't supported on this system");
+#endif
+}
+
+size_t hugetlb_free_pages(size_t page_size) {
+    std::string free = read_first_line(string_format("/sys/kernel/mm/hugepages/hugepages-%zukB/free_hugepages", page_size / 1024));
+    return free == "unknown" ? 0 : strtoull(free.c_str(), nullptr, 10);
+}
+
 void *align(size_t base_alignment, size_t required_size, void* p, size_t space) {
     /* std::align isn't available in GCC and clang until fairly
      * recently. This just gives us a bit more portability for older
@@ -203,12 +334,145 @@ size_t count(CacheLine* first) {
     return count;
 }
 
+/* the CPUs parallel_for may use, by default those the process was allowed to run on at startup */
+static std::vector<int> helper_cpus = get_allowed_cpus();
+
+void set_helper_cpus(std::vector<int> cpus) {
+    helper_cpus = std::move(cpus);
+}
+
+#if !UARCH_BENCH_PORTABLE
+
+/*
+ * The permutations behind shuffled_region are built with a fast PRNG (splitmix64), and large ones are built by
+ * several threads at once: each element is sent to a random bucket, then each bucket is shuffled independently,
+ * which gives a uniformly random permutation, and is deterministic for a given size no matter how many threads
+ * are used.
+ */
+
+struct SplitMix64 {
+    uint64_t state;
+
+    uint64_t operator()() {
+        uint64_t z = (state += 0x9e3779b97f4a7c15);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+        return z ^ (z >> 31);
+    }
+
+    /* a random value in [0, range) */
+    uint32_t below(uint32_t range) {
+        return (uint32_t)(((unsigned __int128)(*this)() * range) >> 64);
+    }
+};
+
+/* below this many lines a single thread is fast enough */
+constexpr size_t PARALLEL_MIN_LINES = 64 * 1024;
+
+/*
+ * Call f(i) for i in [0, count) using up to count helper threads, each pinned to one of the helper CPUs, since
+ * threads created after pinning would otherwise all share the CPU of the main thread. With fewer than two
+ * helper CPUs, it all runs on the calling thread.
+ */
+template <typename F>
+static void parallel_for(size_t count, F f) {
+    size_t nthreads = std::min(count, helper_cpus.size());
+    if (nthreads <= 1) {
+        for (size_t i = 0; i < count; i++) {
+            f(i);
+        }
+        return;
+    }
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < nthreads; t++) {
+        threads.emplace_back([=]{
+            pin_to_cpu(helper_cpus[t]);
+            for (size_t i = t; i < count; i += nthreads) {
+                f(i);
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+}
+
+static void fisher_yates(uint32_t* first, uint32_t* last, SplitMix64 rng) {
+    for (size_t i = last - first; i > 1; i--) {
+        std::swap(first[i - 1], first[rng.below(i)]);
+    }
+}
+
+/*
+ * Return the successor of each line in a single random cycle over size_lines lines, i.e., line i should
+ * point to line result[i].
+ */
+static std::vector<uint32_t> make_successors(size_t size_lines, uint64_t seed) {
+    // the number of buckets for the parallel version, which doesn't depend on the number of CPUs so that the
+    // result is the same everywhere
+    constexpr uint32_t BUCKETS = 16;
+
+    std::vector<uint32_t> perm(size_lines);
+    if (size_lines < PARALLEL_MIN_LINES) {
+        std::iota(perm.begin(), perm.end(), 0);
+        fisher_yates(perm.data(), perm.data() + size_lines, SplitMix64{seed});
+    } else {
+        // each chunk of input indices assigns its elements to random buckets
+        std::vector<uint8_t> bucket_of(size_lines);
+        std::vector<std::array<size_t, BUCKETS>> counts(BUCKETS);
+        auto chunk_start = [=](size_t c){ return c * size_lines / BUCKETS; };
+        parallel_for(BUCKETS, [&](size_t c) {
+            SplitMix64 rng{seed + c};
+            auto& count = counts[c];
+            count.fill(0);
+            for (size_t i = chunk_start(c), e = chunk_start(c + 1); i < e; i++) {
+                count[bucket_of[i] = rng.below(BUCKETS)]++;
+            }
+        });
+
+        // bucket b holds the elements sent to it by chunk 0, then chunk 1, etc
+        std::vector<std::array<size_t, BUCKETS>> starts(BUCKETS);
+        size_t pos = 0;
+        std::vector<size_t> bucket_start(BUCKETS + 1);
+        for (uint32_t b = 0; b < BUCKETS; b++) {
+            bucket_start[b] = pos;
+            for (size_t c = 0; c < BUCKETS; c++) {
+                starts[c][b] = pos;
+                pos += counts[c][b];
+            }
+        }
+        bucket_start[BUCKETS] = pos;
+
+        parallel_for(BUCKETS, [&](size_t c) {
+            auto next = starts[c];
+            for (size_t i = chunk_start(c), e = chunk_start(c + 1); i < e; i++) {
+                perm[next[bucket_of[i]]++] = i;
+            }
+        });
+
+        parallel_for(BUCKETS, [&](size_t b) {
+            fisher_yates(perm.data() + bucket_start[b], perm.data() + bucket_start[b + 1], SplitMix64{seed + BUCKETS + b});
+        });
+    }
+
+    std::vector<uint32_t> successors(size_lines);
+    for (size_t i = 0; i + 1 < size_lines; i++) {
+        successors[perm[i]] = perm[i + 1];
+    }
+    successors[perm[size_lines - 1]] = perm[0];
+    return successors;
+}
+
+#endif
+
 /**
  * Return a region of memory of size bytes, where each cache line sized chunk points to another random chunk
  * within the region. The pointers cover all chunks in a cycle of maximum size.
  *
- * The region_struct is returned by reference and points to a static variable that is overwritten every time
- * this function is called.
+ * The permutation for each size is built once and cached. Every call checks the links in the region and rewrites
+ * only the lines which are wrong, e.g., because the previous call was for a different size or offset, or a
+ * benchmark stored to the region, then flushes the region from the cache. Large regions are checked and
+ * flushed by several threads.
  */
 region& shuffled_region(const size_t size, const size_t offset) {
 #if UARCH_BENCH_PORTABLE
@@ -219,38 +483,59 @@ region& shuffled_region(const size_t size, const size_t offset) {
     assert(size % UB_CACHE_LINE_SIZE == 0);
     size_t size_lines = size / UB_CACHE_LINE_SIZE;
     assert(size_lines > 0);
+    static_assert(MAX_SHUFFLED_REGION_SIZE / UB_CACHE_LINE_SIZE <= UINT32_MAX, "line indexes must fit in uint32_t");
+
+    constexpr uint64_t SEED = 123;
+    // the cache is cleared if it would grow beyond this many successor entries in total
+    constexpr size_t MAX_CACHED_LINES = 2 * MAX_SHUFFLED_REGION_SIZE / UB_CACHE_LINE_SIZE;
 
     // only get the storage once and keep re-using it, to minimize variance (e.g., some benchmarks getting huge pages
     // and others not, etc)
     static char* storage_ = static_cast<char*>(new_huge_ptr(MAX_SHUFFLED_REGION_SIZE));
+    static std::map<size_t, std::vector<uint32_t>> successor_cache;
+    static size_t cached_lines = 0;
+    static std::map<std::pair<size_t, size_t>, region> regions;
 
     // NOTE: for non-zero offset this is technically UB since storage won't be aligned appropriately, currently not
     // a problem on x86 with any compiler I'm aware of but perhaps we should use a final memmove to apply the offset
     CacheLine* storage = reinterpret_cast<CacheLine*>(storage_ + offset);
 
-    std::memset(storage, -1, size);
-
-    std::vector<size_t> indexes(size_lines);
-    std::iota(indexes.begin(), indexes.end(), 0);
-    std::shuffle(indexes.begin(), indexes.end(), std::mt19937_64{123});
-
-    CacheLine* p = storage + indexes[0];
-    for (size_t i = 1; i < size_lines; i++) {
-        CacheLine* next = storage + indexes[i];
-        p->setNexts(next);
-        p = next;
+    auto found = successor_cache.find(size_lines);
+    if (found == successor_cache.end()) {
+        if (cached_lines + size_lines > MAX_CACHED_LINES) {
+            successor_cache.clear();
+            cached_lines = 0;
+        }
+        found = successor_cache.emplace(size_lines, make_successors(size_lines, SEED)).first;
+        cached_lines += size_lines;
     }
-    p->setNexts(storage + indexes[0]);
+    const uint32_t* successors = found->second.data();
+
+    // check and repair the links in line order, a chunk per thread
+    size_t chunks = size_lines < PARALLEL_MIN_LINES ? 1 : 16;
+    parallel_for(chunks, [=](size_t c) {
+        for (size_t i = c * size_lines / chunks, e = (c + 1) * size_lines / chunks; i < e; i++) {
+            CacheLine* next = storage + successors[i];
+            CacheLine& line = storage[i];
+            if (std::any_of(std::begin(line.nexts), std::end(line.nexts), [=](CacheLine* p){ return p != next; })) {
+                line.setNexts(next);
+            }
+        }
+    });
 
     assert(count(storage) == size_lines);
 
-    for (char *p = (char *)storage, *e = p + size; p < e; p += UB_CACHE_LINE_SIZE) {
-        _mm_clflush(p);
-    }
-
-    _mm_mfence();
+    // flushing is the slow part for large regions, so it's split across the threads too
+    parallel_for(chunks, [=](size_t c) {
+        for (size_t i = c * size_lines / chunks, e = (c + 1) * size_lines / chunks; i < e; i++) {
+            _mm_clflush(storage + i);
+        }
+        _mm_mfence();
+    });
 
-    return *(new region{ size, storage }); // leak
+    region& r = regions[{size, offset}];
+    r = region{ size, storage };
+    return r;
 #endif
 }
 
@@ -325,6 +610,139 @@ std::string errno_to_str(int e) {
     return strerror_r(e, buf, sizeof(buf));
 }
 
+std::string cpuinfo_value(const std::string& key) {
+    std::ifstream in("/proc/cpuinfo");
+    std::string line;
+    while (std::getline(in, line)) {
+        auto colon = line.find(':');
+        if (colon != std::string::npos && line.compare(0, key.size(), key) == 0) {
+            auto start = line.find_first_not_of(" \t", colon + 1);
+            return start == std::string::npos ? "" : line.substr(start);
+        }
+    }
+    return "unknown";
+}
+
+std::string read_first_line(const std::string& path) {
+    std::ifstream in(path);
+    std::string line;
+    return std::getline(in, line) ? line : "unknown";
+}
+
+std::vector<int> get_allowed_cpus() {
+    cpu_set_t cpu_set;
+    if (sched_getaffinity(0, sizeof(cpu_set), &cpu_set)) {
+        throw std::runtime_error("failed while getting existing cpu affinity: " + errno_to_str(errno));
+    }
+    std::vector<int> cpus;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &cpu_set)) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+void pin_to_cpu(int cpu) {
+    if (cpu < 0 || cpu >= CPU_SETSIZE) {
+        throw std::runtime_error("can't pin to invalid cpu " + std::to_string(cpu));
+    }
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(cpu, &cpuset);
+    // pid 0 means the calling thread, not the whole process
+    if (sched_setaffinity(0, sizeof(cpuset), &cpuset)) {
+        throw std::runtime_error("failed to pin to cpu " + std::to_string(cpu) + ": " + errno_to_str(errno));
+    }
+}
+
+std::vector<int> numa_nodes() {
+    std::string online = read_first_line("/sys/devices/system/node/online");
+    return online == "unknown" ? std::vector<int>{0} : parse_cpu_list(online);
+}
+
+std::vector<int> numa_node_cpus(int node) {
+    std::string cpus = read_first_line(string_format("/sys/devices/system/node/node%d/cpulist", node));
+    if (cpus == "unknown") {
+        return node == 0 && numa_nodes() == std::vector<int>{0} ? get_allowed_cpus() : std::vector<int>{};
+    }
+    return cpus.empty() ? std::vector<int>{} : parse_cpu_list(cpus);
+}
+
+/* the maximum number of nodes in the masks passed to mbind and set_mempolicy */
+constexpr int MAX_NODES = 1024;
+
+using node_mask = std::array<unsigned long, MAX_NODES / (8 * sizeof(unsigned long))>;
+
+static node_mask make_node_mask(int node) {
+    if (node < 0 || node >= MAX_NODES) {
+        throw std::runtime_error("invalid NUMA node " + std::to_string(node));
+    }
+    node_mask mask{};
+    mask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+    return mask;
+}
+
+/*
+ * The kernel doesn't have the NUMA syscalls if it was built without NUMA support, in which case there is only
+ * node 0 and so nothing to bind.
+ */
+static bool numa_unsupported(int err, int node) {
+    return err == ENOSYS && node == 0;
+}
+
+void bind_to_node(void *ptr, size_t size, int node) {
+    node_mask mask = make_node_mask(node);
+    // the kernel only looks at maxnode - 1 bits, for some reason
+    if (syscall(SYS_mbind, ptr, size, MPOL_BIND, mask.data(), MAX_NODES + 1, MPOL_MF_MOVE | MPOL_MF_STRICT)
+            && !numa_unsupported(errno, node)) {
+        throw std::runtime_error(string_format("failed to bind %zu KiB to NUMA node %d: %s", size / 1024, node,
+                errno_to_str(errno).c_str()));
+    }
+}
+
+void set_mem_node(int node) {
+    node_mask mask = make_node_mask(node);
+    if (syscall(SYS_set_mempolicy, MPOL_BIND, mask.data(), MAX_NODES + 1) && !numa_unsupported(errno, node)) {
+        throw std::runtime_error(string_format("failed to bind memory to NUMA node %d: %s", node, errno_to_str(errno).c_str()));
+    }
+    mem_node = node;
+}
+
+static int parse_cpu(const std::string& s, const std::string& list) {
+    size_t idx = 0;
+    int cpu = -1;
+    try {
+        cpu = std::stoi(s, &idx);
+    } catch (std::logic_error&) {
+    }
+    if (s.empty() || idx != s.size() || cpu < 0) {
+        throw std::runtime_error("bad cpu list '" + list + "': can't parse '" + s + "'");
+    }
+    return cpu;
+}
+
+std::vector<int> parse_cpu_list(const std::string& list) {
+    std::vector<int> cpus;
+    for (auto& range : split_on_string(list, ",")) {
+        auto ends = split_on_string(range, "-");
+        if (ends.size() == 1) {
+            cpus.push_back(parse_cpu(ends[0], list));
+        } else if (ends.size() == 2) {
+            int first = parse_cpu(ends[0], list), last = parse_cpu(ends[1], list);
+            if (first > last) {
+                throw std::runtime_error("bad cpu list '" + list + "': descending range " + range);
+            }
+            for (int cpu = first; cpu <= last; cpu++) {
+                cpus.push_back(cpu);
+            }
+        } else {
+            throw std::runtime_error("bad cpu list '" + list + "': can't parse '" + range + "'");
+        }
+    }
+    return cpus;
+}
+
 int always_zero() {
     return zero;
 }
@@ -37,23 +37,75 @@ static inline int64_t nanos() {
     return std::chrono::time_point_cast<std::chrono::nanoseconds>(t).time_since_epoch().count();
 }
 
+/* the kind of pages backing a region */
+enum class PageBacking {
+    /* transparent huge pages, which the kernel may silently not provide */
+    THP,
+    /* 4K pages */
+    SMALL,
+    /* hugetlbfs pages, which must be reserved */
+    HUGETLB_2M,
+    HUGETLB_1G,
+};
+
+/* parse a --page-size value: thp, 4k, 2m or 1g, throws std::runtime_error for anything else */
+PageBacking parse_page_backing(const std::string& name);
+
+/*
+ * Set the backing used by new_huge_ptr for huge regions, which are those behind aligned_ptr, shuffled_region
+ * and flush_caches. Setting it explicitly also means that an allocation fails with std::runtime_error if it
+ * can be seen not to have the requested backing, rather than just warning.
+ */
+void set_page_backing(PageBacking backing);
+
 /**
  * @brief Allocate a 2 MB-aligned pointer and set its hugepage status.
  * 
  * Return a pointer to a NEWLY ALLOCATED memory region of at least size,
  * aligned to a 2MB boundary and with an effort to ensure the pointer is
- * backed by these specified page size. Specifically, it uses
- * madvise() to try to force either hugepages or no hugepages.
+ * backed by these specified page size. With huge set, this is the backing
+ * set by set_page_backing, by default transparent huge pages, for which it
+ * uses madvise() to try to force either hugepages or no hugepages.
  * 
  * Many distributions have the sysfs tunable:
  * /sys/kernel/mm/transparent_hugepage/enabled
  * set to "madvise" and in this case both directions will work.
  *
  * @param size size of required region
- * @param huge true to force 2MB pages, false to force 4k pages
+ * @param huge true to use the huge page backing, false to force 4k pages
  * @return void* 
  */
-void *new_huge_ptr(size_t size, bool huge = true);
+void *new_huge_ptr(size_t size, bool huge = true, int node = -1);
+
+/**
+ * Set the stream that new_huge_ptr and new_backed_ptr write their diagnostics about the page backing to,
+ * which is std::cerr by default. Context keeps this pointed at Context::log().
+ */
+void set_log_stream(std::ostream* log);
+
+/**
+ * Return a pointer to a NEWLY ALLOCATED memory region of at least size, with the given backing regardless of
+ * set_page_backing, aligned to a 2MB boundary (or the page size, for 1G pages) and touched so every page
+ * is mapped. Throws std::runtime_error if hugetlbfs pages aren't available.
+ *
+ * The pages are bound to the given NUMA node, or if node is -1 to the node set by set_mem_node, if any.
+ */
+void *new_backed_ptr(size_t size, PageBacking backing, int node = -1);
+
+/**
+ * Return a pointer to a NEWLY ALLOCATED memory region of the given size, which must be a multiple of page_size,
+ * backed by hugetlbfs pages of page_size bytes (e.g., 2 MiB or 1 GiB), which must have been reserved, e.g.,
+ * through /sys/kernel/mm/hugepages. Unlike transparent huge pages, the kernel never silently falls back to 4K
+ * pages: if the pages aren't available std::runtime_error is thrown.
+ *
+ * The pages aren't touched, so they are only faulted in as they are used. The region is never freed.
+ */
+void *new_hugetlb_ptr(size_t size, size_t page_size);
+
+/**
+ * The number of free hugetlbfs pages of the given size, or 0 if that page size isn't supported.
+ */
+size_t hugetlb_free_pages(size_t page_size);
 
 /**
  * Return a pointer to a NEWLY ALLOCATED memory region of at least size, aligned to the given alignment.
@@ -67,7 +119,7 @@ void *new_aligned_pointer(size_t size, size_t alignment);
  * The same global region is REUSED for all calls to this function, so it is only appropriate
  * for temporary use within a test.
  * 
- * The pointer is allocated in huge pages if possible.
+ * The pointer is allocated in huge pages if possible, or with the backing set by set_page_backing.
  */
 void *aligned_ptr(size_t base_alignment, size_t required_size, bool set_zero = false);
 void *misaligned_ptr(size_t base_alignment, size_t required_size, ssize_t misalignment);
@@ -147,8 +199,14 @@ static inline std::vector<std::string> split_on_any(const std::string &text, con
     return split_helper(text, [=](const std::string& s, size_t start) { return std::make_pair(s.find_first_of(sep_chars, start), 1); });
 }
 
-/** Take a string and escape it so that it will be treated as a literal string in a regex */
-std::string escape_for_regex(const std::string& input);
+/** quote and escape a string so that it is a valid JSON string literal */
+std::string json_quote(const std::string& s);
+
+/** a JSON literal for the given string value: a number if it's in JSON number syntax, otherwise a quoted string */
+std::string json_value(const std::string& s);
+
+/** quote a CSV field if it needs it, per RFC 4180 */
+std::string csv_quote(const std::string& s);
 
 /**
  * Returns true if the entire string target matches pattern, where pattern can contain * wildcards
@@ -175,10 +233,11 @@ struct region {
 
 /**
  * Return a region of memory of size bytes, where each cache line sized chunk points to another random chunk
- * within the region. The pointers cover all chunks in a cycle of maximum size.
+ * within the region. The pointers cover all chunks in a cycle of maximum size. The region is flushed from the
+ * cache before returning.
  *
- * The region_struct is returned by reference and points to a static variable that is overwritten every time
- * this function is called.
+ * Every call shares the same underlying storage, so the returned region is only valid until the next call. The
+ * random cycle for each size is cached, so repeated calls only repair any links that were changed, then flush.
  *
  * Non-zero offset means that the returned region will be offset relative to the start of a cache line, e.g.,
  * offset 60 could be used to ensure each load crosses a cache line.
@@ -193,11 +252,63 @@ long touch_lines(void *region, size_t size, size_t stride = UB_CACHE_LINE_SIZE);
 
 void flush_caches(size_t working_set = 16 * 1024 * 1024);
 
+/**
+ * Return the list of CPUs the calling thread is allowed to run on, according to its affinity mask.
+ */
+std::vector<int> get_allowed_cpus();
+
+/**
+ * Pin the calling thread to the given CPU, throws std::runtime_error on failure.
+ */
+void pin_to_cpu(int cpu);
+
+/**
+ * Set the CPUs that the helper threads which build large regions (see shuffled_region) may run on. By default
+ * they are all of the CPUs the process was allowed to run on at startup, and with an empty list (or a single
+ * CPU) the regions are built on the calling thread.
+ */
+void set_helper_cpus(std::vector<int> cpus);
+
+/**
+ * The online NUMA nodes according to sysfs, or just node 0 if there's no NUMA information.
+ */
+std::vector<int> numa_nodes();
+
+/**
+ * The CPUs on the given NUMA node according to sysfs, or every allowed CPU for node 0 if there's no NUMA
+ * information, so that a machine without it looks like a single node.
+ */
+std::vector<int> numa_node_cpus(int node);
+
+/**
+ * Bind the pages of the given region to the given NUMA node with mbind, moving any that are already elsewhere,
+ * throws std::runtime_error on failure. The region must be page aligned.
+ */
+void bind_to_node(void *ptr, size_t size, int node);
+
+/**
+ * Bind all later allocations by the calling thread, and by threads it creates, to the given NUMA node with
+ * set_mempolicy, and the regions from new_huge_ptr explicitly with mbind. Throws std::runtime_error on failure.
+ */
+void set_mem_node(int node);
+
+/**
+ * Parse a CPU list in the same format used by taskset and sysfs, e.g., "0-3,8,10-11", returning
+ * the individual CPUs in the order they appear. Throws std::runtime_error if the list is malformed.
+ */
+std::vector<int> parse_cpu_list(const std::string& list);
+
 /**
  * Return the string description of the given system errno
  */
 std::string errno_to_str(int e);
 
+/* return the value of the first line in /proc/cpuinfo with the given key, or "unknown" */
+std::string cpuinfo_value(const std::string& key);
+
+/* return the first line of the given file, e.g., a sysfs attribute, or "unknown" if it can't be read */
+std::string read_first_line(const std::string& path);
+
 /**
  * This method always returns zero, but the optimizer doesn't know that.
  */
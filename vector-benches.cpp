@@ -86,6 +86,7 @@ void register_vector(GroupList& list) {
     {
         std::shared_ptr<BenchmarkGroup> group = std::make_shared<BenchmarkGroup>("vector/bypass", "Vector unit bypass latency");
         list.push_back(group);
+        group->setTags({"core-local"});
 
         auto maker = DeltaMaker<TIMER>(group.get(), 100000);
 
@@ -102,6 +103,7 @@ void register_vector(GroupList& list) {
     {
         std::shared_ptr<BenchmarkGroup> group = std::make_shared<BenchmarkGroup>("vector/load-load", "Vector load-load latency");
         list.push_back(group);
+        group->setTags({"core-local"});
 
         auto maker = DeltaMaker<TIMER>(group.get(), 100000).setFeatures({AVX2});
         auto m512  = maker.setFeatures({AVX512F});
@@ -135,6 +137,7 @@ void register_vector(GroupList& list) {
     {
         std::shared_ptr<BenchmarkGroup> group = std::make_shared<BenchmarkGroup>("vector/misc", "Miscellaneous vector benches");
         list.push_back(group);
+        group->setTags({"core-local"});
 
         auto m512  = DeltaMaker<TIMER>(group.get(), 1000).setFeatures({AVX512F});
 
@@ -146,6 +149,7 @@ void register_vector(GroupList& list) {
 
         maker.template make<intrinsic_bench>("intrinsic", "demo how to write intrinsic bench", 4);
         maker.useLoopDelta().template make<intrinsic_bench>("intrinsic-loop-delta", "demo with loop delta", 4);
+        maker.useCalibratedOverhead().template make<intrinsic_bench>("intrinsic-calibrated", "demo with calibrated overhead", 4);
 #endif
     }
 
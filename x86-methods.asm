@@ -1627,6 +1627,95 @@ define_bandwidth 32,{vmovdqa   ymm0, [rcx + offset]},load
 define_bandwidth 64,{vmovdqa64 zmm0, [rcx + offset]},load
 define_bandwidth 64,{movzx      r8d, BYTE [rcx + offset]},loadtouch
 
+; mirror of mem-benches.cpp::stream_args
+struc stream_args
+    .size : resq 1
+    .a    : resq 1
+    .b    : resq 1
+    .c    : resq 1
+endstruc
+
+; One STREAM kernel, making rdi passes over the three arrays of the stream_args in rsi, using the SMOV, SMUL,
+; SADD, R0 and R7 defines set up by define_stream for the width.
+; %1 kernel name: copy (c = a), scale (b = q * c), add (c = a + b) or triad (a = b + q * c)
+; %2 size of each load and store in bytes
+%macro define_stream_kernel 2
+define_bench stream_%1_ %+ BITSIZE
+mov     rdx, [rsi + stream_args.size]
+mov     r8,  [rsi + stream_args.a]
+mov     r9,  [rsi + stream_args.b]
+mov     r10, [rsi + stream_args.c]
+
+; q = 3.0, broadcast to every element of R7
+mov     rax, SCALAR
+push    rax
+SBCAST  R7, [rsp]
+pop     rax
+
+.top:
+xor     eax, eax
+
+.inner:
+%assign offset 0
+%rep (64 / %2)
+%ifidn %1,copy
+SMOV    R0, [r8  + rax + offset]
+SMOV    [r10 + rax + offset], R0
+%elifidn %1,scale
+SMOV    R0, [r10 + rax + offset]
+SMUL    R0, R0, R7
+SMOV    [r9  + rax + offset], R0
+%elifidn %1,add
+SMOV    R0, [r8  + rax + offset]
+SADD    R0, R0, [r9 + rax + offset]
+SMOV    [r10 + rax + offset], R0
+%elifidn %1,triad
+SMOV    R0, [r10 + rax + offset]
+SMUL    R0, R0, R7
+SADD    R0, R0, [r9 + rax + offset]
+SMOV    [r8  + rax + offset], R0
+%else
+%error unknown stream kernel %1
+%endif
+%assign offset (offset + %2)
+%endrep
+%undef offset
+add     rax, 64
+cmp     rax, rdx
+jb      .inner
+
+dec     rdi
+jnz     .top
+ret
+%endmacro
+
+; All four STREAM kernels for one load/store width.
+; %1 size of each load and store in bytes
+; %2 data register
+; %3 register holding q
+; %4 move, %5 multiply and %6 add instructions
+; %7 instruction to broadcast q from memory, %8 the bits of q = 3.0 as a float (for 32-bit) or double
+%macro define_stream 8
+%assign BITSIZE (%1 * 8)
+%define R0      %2
+%define R7      %3
+%define SMOV    %4
+%define SMUL    %5
+%define SADD    %6
+%define SBCAST  %7
+%define SCALAR  %8
+define_stream_kernel copy,  %1
+define_stream_kernel scale, %1
+define_stream_kernel add,   %1
+define_stream_kernel triad, %1
+%endmacro
+
+define_stream  4, xmm0, xmm7, vmovss,  vmulss, vaddss, vmovss,       0x40400000
+define_stream  8, xmm0, xmm7, vmovsd,  vmulsd, vaddsd, vmovsd,       0x4008000000000000
+define_stream 16, xmm0, xmm7, vmovapd, vmulpd, vaddpd, vmovddup,     0x4008000000000000
+define_stream 32, ymm0, ymm7, vmovapd, vmulpd, vaddpd, vbroadcastsd, 0x4008000000000000
+define_stream 64, zmm0, zmm7, vmovapd, vmulpd, vaddpd, vbroadcastsd, 0x4008000000000000
+
 
 
 ; version that doesn't interleave the loads in a "clever way"